@@ -103,6 +103,18 @@ class DartsExporter(bpy.types.Operator, ExportHelper):
         ),
         default="SINGLE",
     )
+    mesh_format: EnumProperty(
+        name="Mesh format",
+        items=(
+            ('OBJ', "OBJ",
+             "Write meshes as text OBJ files, with materials"),
+            ('GLB', "glTF binary",
+             "Write meshes as binary glTF (.glb) files, with materials. Much faster to write and to load"),
+            ('PLY', "PLY binary",
+             "Write meshes as binary PLY files, without materials. Much faster to write and to load"),
+        ),
+        default="OBJ",
+    )
 
     # Material-related settings
     material_mode: EnumProperty(
@@ -319,6 +331,7 @@ class DARTS_PT_export_geometry(bpy.types.Panel):
         operator = sfile.active_operator
 
         layout.prop(operator, 'mesh_mode')
+        layout.prop(operator, 'mesh_format')
         layout.prop(operator, "write_obj_files")
 
 
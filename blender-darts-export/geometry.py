@@ -6,18 +6,59 @@ from mathutils import Matrix, Vector, Euler
 def write_obj(ctx, obj_name):
     '''Export meshes to "meshes/" and then point to them in the scene file'''
 
-    relative_path = os.path.join('meshes', obj_name + ".obj")
+    extension, mesh_type = {"OBJ": (".obj", "mesh"),
+                            "GLB": (".glb", "gltf"),
+                            "PLY": (".ply", "ply")}[ctx.mesh_format]
+    relative_path = os.path.join('meshes', obj_name + extension)
+    filepath = os.path.join(ctx.directory, relative_path)
 
     # skip if we've already exported this object
     obj_id = f"obj-{relative_path}"
     if obj_id in ctx.already_exported.keys():
-        ctx.report({'WARNING'}, f"Exporting OBJ file '{relative_path}' again!")
-
-    if ctx.write_obj_files:
+        ctx.report({'WARNING'}, f"Exporting mesh file '{relative_path}' again!")
+
+    if ctx.write_obj_files and ctx.mesh_format == "GLB":
+        ctx.info(f"  Writing '{relative_path}' using glTF exporter.")
+        # keep Blender's Z-up coordinates, like the OBJ export below
+        bpy.ops.export_scene.gltf(filepath=filepath,
+                                  export_format='GLB',
+                                  use_selection=True,
+                                  export_apply=True,
+                                  export_yup=False,
+                                  export_normals=True,
+                                  export_texcoords=True,
+                                  export_materials='EXPORT' if ctx.material_mode != "OFF" else 'NONE',
+                                  check_existing=False)
+    elif ctx.write_obj_files and ctx.mesh_format == "PLY":
+        if bpy.app.version >= (3, 6, 0):
+            ctx.info(f"  Writing '{relative_path}' using C++ PLY exporter.")
+            bpy.ops.wm.ply_export(filepath=filepath,
+                                  export_selected_objects=True,
+                                  apply_modifiers=True,
+                                  export_normals=True,
+                                  export_uv=True,
+                                  export_colors='NONE',
+                                  export_triangulated_mesh=True,
+                                  ascii_format=False,
+                                  check_existing=False,
+                                  forward_axis='Y', up_axis='Z')
+        else:
+            ctx.info(
+                f"  Writing '{relative_path}' using legacy Python PLY exporter.")
+            bpy.ops.export_mesh.ply(filepath=filepath,
+                                    use_selection=True,
+                                    use_mesh_modifiers=True,
+                                    use_normals=True,
+                                    use_uv_coords=True,
+                                    use_colors=False,
+                                    use_ascii=False,
+                                    check_existing=False,
+                                    axis_forward='Y', axis_up='Z')
+    elif ctx.write_obj_files:
         if bpy.app.version >= (3, 3, 0):
             # new, faster C++ OBJ exporter
             ctx.info(f"  Writing '{relative_path}' using C++ exporter.")
-            bpy.ops.wm.obj_export(filepath=os.path.join(ctx.directory, relative_path),
+            bpy.ops.wm.obj_export(filepath=filepath,
                                   export_selected_objects=True,
                                   export_eval_mode='DAG_EVAL_RENDER',
                                   apply_modifiers=True,
@@ -31,7 +72,7 @@ def write_obj(ctx, obj_name):
             # legacy python exporter
             ctx.info(
                 f"  Writing '{relative_path}' using legacy Python exporter.")
-            bpy.ops.export_scene.obj(filepath=os.path.join(ctx.directory, relative_path),
+            bpy.ops.export_scene.obj(filepath=filepath,
                                      use_selection=True,
                                      use_mesh_modifiers=True,
                                      use_normals=True,
@@ -44,9 +85,9 @@ def write_obj(ctx, obj_name):
                                      axis_forward='Y', axis_up='Z')
 
     obj_params = {
-        "type": "mesh",
+        "type": mesh_type,
         "name": obj_name,
-        "filename": f"meshes/{obj_name}.obj",
+        "filename": f"meshes/{obj_name}{extension}",
         "material": "default"
     }
 
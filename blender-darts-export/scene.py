@@ -36,6 +36,7 @@ class SceneWriter:
                  sampler,
                  use_lights,
                  mesh_mode,
+                 mesh_format,
                  material_mode,
                  glossy_mode,
                  use_normal_maps,
@@ -69,6 +70,7 @@ class SceneWriter:
         self.use_lights = use_lights
 
         self.mesh_mode = mesh_mode
+        self.mesh_format = mesh_format
 
         self.material_mode = material_mode
         self.write_texture_files = write_texture_files
@@ -14,9 +14,11 @@ endif()
 # ============================================================================
 option(USE_NANOVDB "Include nanovdb support?" OFF)
 option(USE_FLIP "Include support for the FLIP image comparison tool?" OFF)
+option(USE_AVX2 "Compile with AVX2 instructions (enables the 8-wide SIMD box test of the bbh8 accelerator)?" OFF)
 
 message(STATUS "NANOVDB support is: ${USE_NANOVDB}")
 message(STATUS "FLIP support is: ${USE_FLIP}")
+message(STATUS "AVX2 support is: ${USE_AVX2}")
 
 # ============================================================================
 # Set a default build configuration (Release)
@@ -127,18 +129,6 @@ if(cli11_ADDED)
   list(APPEND DARTS_PUBLIC_LIBS cli11)
 endif()
 
-CPMAddPackage(
-  NAME tinyobjloader
-  GITHUB_REPOSITORY tinyobjloader/tinyobjloader
-  GIT_TAG 94d2f7fe1f7742818dbcd0917d11679d055a33de
-  DOWNLOAD_ONLY YES
-)
-if(tinyobjloader_ADDED)
-  add_library(tinyobjloader INTERFACE IMPORTED)
-  target_include_directories(tinyobjloader INTERFACE "${tinyobjloader_SOURCE_DIR}/")
-  list(APPEND DARTS_PRIVATE_LIBS tinyobjloader)
-endif()
-
 CPMAddPackage(
   NAME tinyexr
   GITHUB_REPOSITORY syoyo/tinyexr
@@ -0,0 +1,84 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <darts/common.h>
+#include <limits>
+
+/**
+    Samples one of \f$n\f$ discrete outcomes in proportion to given weights, in constant time.
+
+    Each of the \f$n\f$ equally likely slots stores a threshold and an alternative outcome (Walker's alias method): a
+    sample picks a slot, and then either the slot's own outcome or its alias by comparing against the threshold. The
+    table is built in linear time using Vose's algorithm.
+
+    \ingroup Random
+*/
+class AliasTable
+{
+public:
+    AliasTable() = default;
+
+    /**
+        Build the table for the given non-negative \p weights.
+
+        If all weights are zero (or not finite), every outcome is made equally likely.
+    */
+    void build(const vector<float> &weights);
+
+    /// The number of outcomes
+    size_t size() const
+    {
+        return m_prob.size();
+    }
+
+    bool empty() const
+    {
+        return m_prob.empty();
+    }
+
+    /**
+        Sample an outcome.
+
+        \param [in,out] rv  Random variable distributed uniformly in [0,1), which is remapped to [0,1) for reuse
+        \return             The index of the outcome
+    */
+    uint32_t sample(float &rv) const
+    {
+        float    sx    = rv * m_prob.size();
+        uint32_t slot  = std::min(uint32_t(sx), uint32_t(m_prob.size() - 1));
+        float    u     = sx - slot;
+        auto    &entry = m_slots[slot];
+        if (u < entry.threshold)
+        {
+            rv = u / entry.threshold;
+            return slot;
+        }
+        rv = std::min((u - entry.threshold) / (1.f - entry.threshold), 1.f - std::numeric_limits<float>::epsilon());
+        return entry.alias;
+    }
+
+    /// The probability of sampling outcome \p i
+    float prob(uint32_t i) const
+    {
+        return m_prob[i];
+    }
+
+private:
+    struct Slot
+    {
+        float    threshold; ///< Probability of returning the slot's own outcome instead of #alias
+        uint32_t alias;     ///< The outcome returned otherwise
+    };
+
+    vector<Slot>  m_slots;
+    vector<float> m_prob; ///< The normalized weight of each outcome
+};
+
+/**
+    \file
+    \brief Class #AliasTable
+*/
@@ -0,0 +1,486 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <darts/box.h>
+#include <darts/json.h>
+#include <darts/progress.h>
+#include <darts/surface.h>
+#include <cstring>
+#include <functional>
+
+/** \addtogroup Surfaces
+    @{
+*/
+
+/// How a BBH builder chooses where to split a set of primitives
+enum class BBH_SplitMethod : uint8_t
+{
+    SAH,    ///< Binned surface area heuristic
+    Middle, ///< Split at the center of the bounding box
+    Equal,  ///< Split so that an equal number of primitives are on either side
+    SBVH,   ///< Binned SAH over both object splits and spatial splits that clip primitives to the child boxes
+    LBVH    ///< Split along the sorted Morton codes of the centroids, optionally followed by treelet restructuring
+};
+
+/// Parameters shared by everything that builds a BBH (the BBH accelerators and accelerated meshes)
+struct BBHSettings
+{
+    /// Upper bound on the number of SAH buckets, so the per-node bucket arrays can live on the stack
+    static constexpr int max_buckets = 64;
+
+    BBH_SplitMethod split_method      = BBH_SplitMethod::SAH;
+    int             max_leaf_size     = 1;      ///< Larger nodes are always split; SAH may also split smaller ones
+    int             sah_buckets       = 12;     ///< Number of buckets per axis used by the binned SAH builder
+    float           traversal_cost    = 0.125f; ///< SAH cost of traversing an interior node
+    float           intersection_cost = 1.f;    ///< SAH cost of intersecting a single primitive
+
+    int parallel_build_cutoff = 4096; ///< Subtrees with at least this many primitives are built in a separate task
+
+    /// A refit triggers a full rebuild once the SAH cost of the tree exceeds this multiple of its cost after building
+    float rebuild_threshold = 1.5f;
+
+    /// SBVH: how many references spatial splits may add, as a fraction of the number of primitives
+    float sbvh_duplication = 0.5f;
+    /// SBVH: only look for a spatial split if the children of the best object split overlap by at least this fraction
+    /// of the root's surface area
+    float sbvh_overlap = 1e-5f;
+
+    int lbvh_treelet_size   = 7; ///< LBVH: number of leaves of the treelets that are restructured
+    int lbvh_treelet_passes = 1; ///< LBVH: number of bottom-up treelet restructuring passes (0 disables them)
+
+    BBHSettings() = default;
+
+    /// Parse the settings from the fields of \p j, keeping the defaults for missing fields
+    BBHSettings(const json &j);
+};
+
+/**
+    A node of the flattened BBH layout.
+
+    Nodes are stored in depth-first order, so the first child of an interior node immediately follows its parent in the
+    array and only the offset of the second child needs to be stored. At 32 bytes, two nodes share a 64-byte cache line.
+*/
+struct alignas(32) LinearBBHNode
+{
+    Box3f bbox; ///< The bounding box of this node
+    union
+    {
+        uint32_t primitives_offset;   ///< Leaf: index of the first primitive
+        uint32_t second_child_offset; ///< Interior: index of the second child
+    };
+    uint16_t num_primitives; ///< Number of primitives in a leaf, 0 for interior nodes
+    uint8_t  axis;           ///< Split axis of an interior node
+    uint8_t  pad[1];         ///< Explicit padding to 32 bytes
+};
+static_assert(sizeof(LinearBBHNode) == 32, "LinearBBHNode should be exactly 32 bytes");
+
+/// Maximum depth of a BBH that can be traversed by #intersect_linear_bbh
+constexpr int max_linear_bbh_depth = 64;
+
+/// Bounds and centroid of a primitive, computed once so the builder never needs to query the primitive itself
+struct BBHPrimitive
+{
+    Box3f    bbox;     ///< World-space bounds of the primitive
+    Vec3f    centroid; ///< Center of #bbox
+    uint32_t index;    ///< Index of the primitive in the caller's list of primitives
+};
+
+/**
+    Split the part of a primitive that lies within \c bbox by the plane \c axis = \c pos.
+
+    Called as \c split(index, bbox, axis, pos, left, right) by the spatial splits of #BBH_SplitMethod::SBVH, and should
+    return the bounds of the parts of primitive \c index within \c bbox on either side of the plane.
+*/
+using BBHSplitFunc = std::function<void(uint32_t, const Box3f &, int, float, Box3f &, Box3f &)>;
+
+/**
+    Split the part of triangle (\p p0, \p p1, \p p2) within \p bbox by the plane \p axis = \p pos.
+
+    The returned boxes bound the clipped triangle tightly along the split axis, which is what lets a spatial split
+    separate long, thin triangles that any box-based split would leave overlapping. Along the other axes they never
+    extend beyond \p bbox.
+*/
+void split_triangle_bounds(const Vec3f &p0, const Vec3f &p1, const Vec3f &p2, const Box3f &bbox, int axis, float pos,
+                           Box3f &left, Box3f &right);
+
+/**
+    Build a BBH over \p prims and flatten it into \p nodes in depth-first order.
+
+    \param [in,out] prims   The primitives to build over. On return, they are reordered so that each leaf references
+                            the contiguous range [primitives_offset, primitives_offset + num_primitives) of \p prims.
+                            With #BBH_SplitMethod::SBVH, a primitive may be referenced by several leaves, so \p prims
+                            may grow, and the bounds of its copies may be clipped to the leaves' boxes.
+    \param [in] settings    The split method and cost parameters
+    \param [in] progress    Advanced by the number of primitives placed in each leaf
+    \param [out] nodes      The flattened tree
+    \param [in] split       Clips primitives for the SBVH's spatial splits. If empty, the primitives' bounding boxes are
+                            split instead, which is always conservative but looser for primitives that are not boxes.
+    \return                 The depth of the tree
+*/
+int build_linear_bbh(vector<BBHPrimitive> &prims, const BBHSettings &settings, Progress &progress,
+                     vector<LinearBBHNode> &nodes, const BBHSplitFunc &split = {});
+
+/**
+    Recompute the bounds of all nodes of a flattened BBH bottom-up, keeping its topology.
+
+    Subtrees with at least \p parallel_cutoff nodes are refit in a separate task.
+
+    \param nodes            The nodes created by #build_linear_bbh
+    \param leaf_bounds      Called as \c leaf_bounds(first, count) for each leaf, and returns the current bounds of the
+                            primitives [first, first + count)
+    \param parallel_cutoff  Minimum number of nodes of a subtree refit in a separate task
+*/
+void refit_linear_bbh(vector<LinearBBHNode> &nodes, const std::function<Box3f(uint32_t, uint32_t)> &leaf_bounds,
+                      int parallel_cutoff);
+
+/**
+    Return the SAH cost of a flattened BBH: the expected cost of tracing a ray that hits the root's box.
+
+    Monitoring how the cost grows over repeated calls to #refit_linear_bbh tells when the tree has degraded enough to be
+    worth rebuilding.
+*/
+float linear_bbh_sah_cost(const vector<LinearBBHNode> &nodes, const BBHSettings &settings);
+
+/**
+    Traverse a flattened BBH, visiting the near child of each interior node first.
+
+    \param nodes            The nodes created by #build_linear_bbh. The tree must be less than #max_linear_bbh_depth deep.
+    \param ray              The ray to traverse. \p intersect_leaf should shrink its \c maxt when it finds a closer hit.
+    \param nodes_visited    Incremented for every visited node
+    \param intersect_leaf   Called as \c intersect_leaf(first, count, ray) for each leaf the ray overlaps, and returns
+                            whether any of the primitives [first, first + count) were hit
+    \tparam any_hit         If true, return as soon as \p intersect_leaf reports a hit (see #occluded_linear_bbh)
+    \return                 Whether any call to \p intersect_leaf reported a hit
+*/
+template <bool any_hit = false, typename LeafFunc>
+bool intersect_linear_bbh(const vector<LinearBBHNode> &nodes, Ray3f &ray, int64_t &nodes_visited,
+                          LeafFunc &&intersect_leaf)
+{
+    if (nodes.empty())
+        return false;
+
+    bool hit_anything = false;
+
+    // visit the near child first: if the ray travels in the negative direction along the split axis, the second child
+    // (which holds the primitives with larger centroids) is the closer one
+    int   dir_is_neg[3] = {ray.d.x < 0.f, ray.d.y < 0.f, ray.d.z < 0.f};
+    Vec3f inv_d(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+
+    uint32_t to_visit[max_linear_bbh_depth];
+    int      to_visit_offset = 0;
+    uint32_t current         = 0;
+    while (true)
+    {
+        ++nodes_visited;
+        const LinearBBHNode &node = nodes[current];
+        if (node.bbox.intersect(ray, inv_d, dir_is_neg))
+        {
+            if (node.num_primitives > 0)
+            {
+                if (intersect_leaf(node.primitives_offset, uint32_t(node.num_primitives), ray))
+                {
+                    if constexpr (any_hit)
+                        return true;
+                    hit_anything = true;
+                }
+
+                if (to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            }
+            else if (dir_is_neg[node.axis])
+            {
+                to_visit[to_visit_offset++] = current + 1;
+                current                     = node.second_child_offset;
+            }
+            else
+            {
+                to_visit[to_visit_offset++] = node.second_child_offset;
+                current                     = current + 1;
+            }
+        }
+        else
+        {
+            if (to_visit_offset == 0)
+                break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+
+    return hit_anything;
+}
+
+/**
+    Check whether a ray hits anything in a flattened BBH, stopping at the first leaf that reports a hit.
+
+    \param nodes            The nodes created by #build_linear_bbh
+    \param ray              The ray to test
+    \param nodes_visited    Incremented for every visited node
+    \param occluded_leaf    Called as \c occluded_leaf(first, count, ray) for each leaf the ray overlaps, and returns
+                            whether any of the primitives [first, first + count) block the ray
+*/
+template <typename LeafFunc>
+bool occluded_linear_bbh(const vector<LinearBBHNode> &nodes, const Ray3f &ray, int64_t &nodes_visited,
+                         LeafFunc &&occluded_leaf)
+{
+    Ray3f r = ray;
+    return intersect_linear_bbh<true>(nodes, r, nodes_visited, std::forward<LeafFunc>(occluded_leaf));
+}
+
+/**
+    Traverse a flattened BBH with a packet of rays.
+
+    Each node is fetched once for the whole packet and its bounds are tested against every ray that reached it, so a
+    subtree is only entered by the rays that overlap it and is skipped as soon as none of them do. Children are visited
+    in the near-to-far order of the first active ray.
+
+    \param nodes            The nodes created by #build_linear_bbh. The tree must be less than #max_linear_bbh_depth deep.
+    \param rays             An array of #max_packet_size rays. \p intersect_leaf should shrink their \c maxt when it
+                            finds closer hits.
+    \param active           Bitmask of the rays to traverse
+    \param nodes_visited    Incremented by the number of rays that reach each visited node, so that it is comparable to
+                            the count of single-ray traversal
+    \param intersect_leaf   Called as \c intersect_leaf(first, count, rays, mask) for each leaf overlapped by the rays
+                            in \c mask, and returns the bitmask of the rays that hit one of the primitives
+                            [first, first + count)
+    \return                 Bitmask of the rays for which \p intersect_leaf reported a hit
+*/
+template <typename LeafFunc>
+uint32_t intersect_linear_bbh_packet(const vector<LinearBBHNode> &nodes, Ray3f *rays, uint32_t active,
+                                     int64_t &nodes_visited, LeafFunc &&intersect_leaf)
+{
+    if (nodes.empty() || !active)
+        return 0;
+
+    int   dir_is_neg[max_packet_size][3];
+    Vec3f inv_d[max_packet_size];
+    int   first_lane = -1;
+    for (int i = 0; i < max_packet_size; ++i)
+    {
+        if (!(active & (1u << i)))
+            continue;
+        if (first_lane < 0)
+            first_lane = i;
+        for (int a = 0; a < 3; ++a)
+        {
+            dir_is_neg[i][a] = rays[i].d[a] < 0.f;
+            inv_d[i][a]      = 1.f / rays[i].d[a];
+        }
+    }
+
+    struct StackEntry
+    {
+        uint32_t node;
+        uint32_t mask;
+    };
+    StackEntry to_visit[max_linear_bbh_depth];
+    int        to_visit_offset = 0;
+    StackEntry current{0, active};
+    uint32_t   hit_mask = 0;
+    while (true)
+    {
+        for (uint32_t m = current.mask; m; m &= m - 1)
+            ++nodes_visited;
+        const LinearBBHNode &node = nodes[current.node];
+
+        uint32_t mask = 0;
+        for (int i = 0; i < max_packet_size; ++i)
+            if ((current.mask & (1u << i)) && node.bbox.intersect(rays[i], inv_d[i], dir_is_neg[i]))
+                mask |= 1u << i;
+
+        if (mask && node.num_primitives > 0)
+            hit_mask |= intersect_leaf(node.primitives_offset, uint32_t(node.num_primitives), rays, mask);
+        else if (mask)
+        {
+            if (dir_is_neg[first_lane][node.axis])
+            {
+                to_visit[to_visit_offset++] = {current.node + 1, mask};
+                current                     = {node.second_child_offset, mask};
+            }
+            else
+            {
+                to_visit[to_visit_offset++] = {node.second_child_offset, mask};
+                current                     = {current.node + 1, mask};
+            }
+            continue;
+        }
+
+        if (to_visit_offset == 0)
+            break;
+        current = to_visit[--to_visit_offset];
+    }
+
+    return hit_mask;
+}
+
+/**
+    An interior node of the quantized BBH layout, which stores the bounds of both of its children with 8 bits per
+    coordinate.
+
+    The children's bounds are offsets from the lower corner of this node's own (decoded) box in steps of 2^#exponent,
+    which makes decoding exact up to a single rounding. They are rounded outward when quantizing, so a decoded box
+    always contains its child, and at worst adds a 1/255th of the node's extent on either side.
+*/
+struct QuantizedBBHNode
+{
+    uint8_t  lo[2][3];    ///< Lower corner of each child's box, in steps along each axis
+    uint8_t  hi[2][3];    ///< Upper corner of each child's box, in steps along each axis
+    int8_t   exponent[3]; ///< The step along each axis is 2^exponent
+    uint8_t  pad[1];      ///< Explicit padding
+    uint32_t child[2];    ///< Each child's index in QuantizedBBH::nodes, or a leaf made by QuantizedBBH::leaf()
+
+    /// The decoded box of child \p c, given the lower corner \p origin of this node's decoded box
+    Box3f child_box(int c, const Vec3f &origin) const
+    {
+        Box3f box;
+        for (int a = 0; a < 3; ++a)
+        {
+            // 2^exponent, built directly from its bits so that decoding needs no call to ldexp
+            uint32_t bits = uint32_t(exponent[a] + 127) << 23;
+            float    step;
+            std::memcpy(&step, &bits, sizeof(float));
+            box.min[a] = origin[a] + float(lo[c][a]) * step;
+            box.max[a] = origin[a] + float(hi[c][a]) * step;
+        }
+        return box;
+    }
+};
+static_assert(sizeof(QuantizedBBHNode) == 24, "QuantizedBBHNode should be exactly 24 bytes");
+
+/**
+    A BBH in the quantized layout.
+
+    Only interior nodes are stored, and leaves are encoded directly in the child references of their parents, so a tree
+    with \c n leaves takes 24 (\c n - 1) bytes instead of the 32 (2 \c n - 1) bytes of its LinearBBHNode%s: about 2.7
+    times less. Traversal pays for this with slightly looser boxes and a few more instructions to decode them.
+*/
+struct QuantizedBBH
+{
+    static constexpr uint32_t leaf_flag           = 0x80000000u; ///< Marks a child reference as a leaf
+    static constexpr uint32_t max_leaf_primitives = 15;          ///< Maximum number of primitives in a leaf
+    static constexpr uint32_t max_leaf_offset     = 1u << 27;    ///< Leaves must start before this primitive
+
+    Box3f                    bbox;  ///< Full-precision bounds of the root, nodes[0]
+    vector<QuantizedBBHNode> nodes; ///< The interior nodes, in depth-first order
+
+    /// Encode the leaf child with primitives [\p first, \p first + \p count) as a child reference
+    static uint32_t leaf(uint32_t first, uint32_t count)
+    {
+        return leaf_flag | count << 27 | first;
+    }
+    static bool is_leaf(uint32_t child)
+    {
+        return child & leaf_flag;
+    }
+    static uint32_t leaf_first(uint32_t child)
+    {
+        return child & (max_leaf_offset - 1);
+    }
+    static uint32_t leaf_count(uint32_t child)
+    {
+        return (child >> 27) & max_leaf_primitives;
+    }
+};
+
+/**
+    Quantize the flattened BBH \p nodes into \p quantized.
+
+    \return     False, leaving \p quantized empty, if a leaf has more than QuantizedBBH::max_leaf_primitives primitives
+                or starts at or after QuantizedBBH::max_leaf_offset
+*/
+bool quantize_linear_bbh(const vector<LinearBBHNode> &nodes, QuantizedBBH &quantized);
+
+/**
+    Expand \p quantized back into flattened BBH \p nodes with the decoded (conservative) bounds.
+
+    The nodes' split axes are not stored in the quantized layout, so this is meant for updating the tree, e.g. with
+    #refit_linear_bbh followed by #quantize_linear_bbh, rather than for traversing it.
+*/
+void unpack_quantized_bbh(const QuantizedBBH &quantized, vector<LinearBBHNode> &nodes);
+
+/**
+    Traverse a quantized BBH, visiting the child with the closer entry point first.
+
+    Both children of a node are decoded and tested together, and leaf children are intersected right away, so
+    \p nodes_visited only counts interior nodes. The parameters are the same as those of #intersect_linear_bbh.
+*/
+template <bool any_hit = false, typename LeafFunc>
+bool intersect_quantized_bbh(const QuantizedBBH &bbh, Ray3f &ray, int64_t &nodes_visited, LeafFunc &&intersect_leaf)
+{
+    int   dir_is_neg[3] = {ray.d.x < 0.f, ray.d.y < 0.f, ray.d.z < 0.f};
+    Vec3f inv_d(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    if (bbh.nodes.empty() || !bbh.bbox.intersect(ray, inv_d, dir_is_neg))
+        return false;
+
+    bool hit_anything = false;
+
+    // the lower corner of a node's decoded box is needed to decode its children, so it is kept along on the stack
+    struct StackEntry
+    {
+        uint32_t node;
+        Vec3f    origin;
+    };
+    StackEntry to_visit[max_linear_bbh_depth];
+    int        to_visit_offset = 0;
+    StackEntry current{0, bbh.bbox.min};
+    while (true)
+    {
+        ++nodes_visited;
+        const QuantizedBBHNode &node = bbh.nodes[current.node];
+
+        Box3f boxes[2] = {node.child_box(0, current.origin), node.child_box(1, current.origin)};
+        float tnear[2];
+        bool  hit[2] = {boxes[0].intersect(ray, inv_d, dir_is_neg, &tnear[0]),
+                        boxes[1].intersect(ray, inv_d, dir_is_neg, &tnear[1])};
+
+        StackEntry next[2];
+        int        num_next = 0;
+        int        nearest  = hit[0] && hit[1] ? tnear[1] < tnear[0] : hit[1];
+        for (int c : {nearest, 1 - nearest})
+        {
+            if (!hit[c])
+                continue;
+
+            uint32_t child = node.child[c];
+            if (!QuantizedBBH::is_leaf(child))
+                next[num_next++] = {child, boxes[c].min};
+            else if (intersect_leaf(QuantizedBBH::leaf_first(child), QuantizedBBH::leaf_count(child), ray))
+            {
+                if constexpr (any_hit)
+                    return true;
+                hit_anything = true;
+            }
+        }
+
+        if (num_next == 2)
+            to_visit[to_visit_offset++] = next[1];
+        if (num_next > 0)
+            current = next[0];
+        else if (to_visit_offset > 0)
+            current = to_visit[--to_visit_offset];
+        else
+            break;
+    }
+
+    return hit_anything;
+}
+
+/// Check whether a ray hits anything in a quantized BBH, the counterpart of #occluded_linear_bbh
+template <typename LeafFunc>
+bool occluded_quantized_bbh(const QuantizedBBH &bbh, const Ray3f &ray, int64_t &nodes_visited,
+                            LeafFunc &&occluded_leaf)
+{
+    Ray3f r = ray;
+    return intersect_quantized_bbh<true>(bbh, r, nodes_visited, std::forward<LeafFunc>(occluded_leaf));
+}
+
+/** @}*/
+
+/**
+    \file
+    \brief Flattened BBH nodes and the builder and traversal routines shared by all BBH-based acceleration structures
+*/
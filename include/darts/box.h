@@ -149,6 +149,43 @@ struct Box
             *hitt1 = maxT;
         return true;
     }
+
+    /**
+        Check whether a #Ray intersects this #Box using a precomputed reciprocal ray direction
+
+        Acceleration structures test the same ray against many boxes, so they can compute the reciprocal direction and
+        its sign once per ray instead of once per box and axis.
+
+        \param ray          The ray along which to check for intersection
+        \param inv_d        The component-wise reciprocal of \c ray.d
+        \param dir_is_neg   For each axis, whether \c ray.d is negative along that axis
+        \param hitt0        If not null, stores the lower bound of the intersection interval
+        \param hitt1        If not null, stores the upper bound of the intersection interval
+        \return             \c true if there is an intersection
+    */
+    bool intersect(const Ray<N, T> &ray, const Vec<N, T> &inv_d, const int dir_is_neg[N], T *hitt0 = nullptr,
+                   T *hitt1 = nullptr) const
+    {
+        T minT = ray.mint;
+        T maxT = ray.maxt;
+
+        for (auto i : range(N))
+        {
+            // choose the near and far slab by the sign of the direction instead of swapping afterwards
+            T t0 = ((dir_is_neg[i] ? max[i] : min[i]) - ray.o[i]) * inv_d[i];
+            T t1 = ((dir_is_neg[i] ? min[i] : max[i]) - ray.o[i]) * inv_d[i];
+
+            minT = t0 > minT ? t0 : minT;
+            maxT = t1 < maxT ? t1 : maxT;
+            if (maxT < minT)
+                return false;
+        }
+        if (hitt0)
+            *hitt0 = minT;
+        if (hitt1)
+            *hitt1 = maxT;
+        return true;
+    }
 };
 
 template <typename T>
@@ -150,6 +150,12 @@ public:
         instance_registry()[name] = o;
     }
 
+    /// All object instances stored with #register_instance(), by name
+    static const std::map<std::string, SharedT> &registered_instances()
+    {
+        return instance_registry();
+    }
+
 protected:
     /// Global map of #SharedT instances that have been create/parsed
     static std::map<std::string, SharedT> &instance_registry()
@@ -3,6 +3,7 @@
 #include <darts/common.h>
 
 #include <darts/ray.h>
+#include <darts/surface.h>
 
 class Integrator
 {
@@ -11,4 +12,60 @@ public:
     {
         return Color3f(1, 0, 1);
     }
-};
\ No newline at end of file
+
+    /**
+        Compute the incident radiance along a packet of primary rays.
+
+        Integrators that implement #Li_hit() find the closest hits of all rays at once using Scene::intersect_packet(),
+        which lets coherent primary rays share the traversal of the scene's acceleration structures, and then shade each
+        ray from its hit. Other integrators just call #Li() for each ray. Integrators that trace all bounces of the
+        packet together override this.
+
+        \param [in] samplers    One sampler per ray
+        \param [in] rays        The primary rays
+        \param [in] count       The number of rays, at most #packet_size()
+        \param [out] colors     The radiance along each ray
+    */
+    virtual void Li_packet(const Scene &scene, Sampler *const *samplers, const Ray3f *rays, int count,
+                           Color3f *colors) const;
+
+    /// The most rays that #Li_packet() accepts at once, and so the number of pixels Scene::raytrace() traces together
+    virtual int packet_size() const
+    {
+        return max_packet_size;
+    }
+
+protected:
+    /**
+        Randomly terminate a path after #rr_depth bounces (Russian roulette).
+
+        The path survives with a probability proportional to its \p throughput, but at most 95%, and the throughput of a
+        surviving path is divided by that probability, which keeps the estimate unbiased. This bounds the expected
+        length of paths without cutting off the light of bright ones, e.g.\ inside glass.
+
+        \param [in,out] throughput  The weight of the path so far
+        \param [in]     depth       The number of bounces of the path so far
+        \return                     Whether the path continues
+    */
+    bool russian_roulette(Sampler &sampler, Color3f &throughput, int depth) const;
+
+    int rr_depth = 5; ///< The number of bounces before #russian_roulette() starts terminating paths, from "rr depth"
+
+    /// Whether #Li_hit() is implemented
+    virtual bool shades_hits() const
+    {
+        return false;
+    }
+
+    /**
+        Compute the incident radiance along \p ray from its already known closest hit.
+
+        \param [in] found   Whether \p ray hit anything
+        \param [in] hit     The closest hit of \p ray, only valid if \p found is true
+    */
+    virtual Color3f Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                           const HitInfo &hit) const
+    {
+        return Li(scene, sampler, ray);
+    }
+};
@@ -0,0 +1,58 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+    A read-only memory mapping of a whole file.
+
+    The operating system pages the file in on demand, so reading its contents involves no copies into intermediate
+    buffers. The mapping is released when the object is destroyed.
+*/
+class MappedFile
+{
+public:
+    /// Map the file \p filename, or leave the object empty (see #valid()) if it cannot be opened or mapped
+    MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /// Whether the file was mapped successfully
+    bool valid() const
+    {
+        return m_data != nullptr;
+    }
+
+    /// Pointer to the first byte of the file
+    const uint8_t *data() const
+    {
+        return m_data;
+    }
+
+    /// Size of the file in bytes
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    const uint8_t *m_data = nullptr;
+    size_t         m_size = 0;
+#if defined(_WIN32)
+    void *m_file    = nullptr; ///< HANDLE of the open file
+    void *m_mapping = nullptr; ///< HANDLE of the file mapping
+#endif
+};
+
+/**
+    \file
+    \brief Class #MappedFile
+*/
@@ -71,6 +71,12 @@ public:
         return false;
     }
 
+    /// Return the average radiance emitted from the front side, used to estimate the power of emitters
+    virtual Color3f average_emitted() const
+    {
+        return Color3f(0, 0, 0);
+    }
+
     /**
        Sample a scattered direction at the surface hitpoint \p hit.
 
@@ -5,7 +5,10 @@
 */
 #pragma once
 
+#include <darts/bbh.h>
+#include <darts/mesh_loaders.h>
 #include <darts/surface.h>
+#include <darts/triangle_block.h>
 
 /**
     A triangle mesh.
@@ -29,11 +32,66 @@ public:
     /// Try to load a mesh from an OBJ file
     Mesh(const json &j);
 
+    /**
+        Try to load a mesh from the file in the "filename" field of \p j, using \p load to parse it.
+
+        If \p load also reads other files, \p dependencies lists them, so that they are part of the #cache_key.
+    */
+    Mesh(const json &j, MeshLoader load, MeshDependencies dependencies = nullptr);
+
     Box3f bounds() const override
     {
         return bbox_w;
     }
 
+    /// Build the BBH over the faces (only if the mesh was added to its parent as a single surface)
+    void build() override;
+
+    /**
+        Update the bounds and the BBH after the vertex positions #vs changed.
+
+        The BBH keeps its topology, and is only rebuilt if refitting raised its SAH cost above
+        BBHSettings::rebuild_threshold times #bbh_cost.
+    */
+    void refit() override;
+
+    /// Intersect a ray against all faces using the mesh's own BBH
+    bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+
+    /// Check whether a ray hits any face using the mesh's own BBH
+    bool occluded(const Ray3f &ray) const override;
+
+    /**
+        Intersect a packet of rays against all faces, traversing the mesh's BBH once for the whole packet.
+
+        The quantized layout has no packet traversal, so with #quantize the rays of the packet are intersected one by
+        one.
+    */
+    uint32_t intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const override;
+
+    /// Return the world-space bounds of face \p f, slightly padded if it lies in an axis-aligned plane
+    Box3f face_bounds(uint32_t f) const;
+
+    /// Whether face \p f has an emissive material
+    bool face_emissive(uint32_t f) const
+    {
+        return materials[Fm[f]] && materials[Fm[f]]->is_emissive();
+    }
+
+    /**
+        Fill in the full hit record for a hit on face \p f.
+
+        Traversal only keeps track of the distance and barycentric coordinates of the closest hit, so the normals, uvs
+        and material are computed just once, for the final hit.
+
+        \param t       The hit distance
+        \param u,v     The barycentric coordinates of the hit with respect to the face's second and third vertex
+    */
+    void compute_hit_info(const Ray3f &ray, uint32_t f, float t, float u, float v, HitInfo &hit) const;
+
+    /// Decode the vertex normals of face \p f into \p n, returning false if the face has none
+    bool face_normals(uint32_t f, Vec3f n[3]) const;
+
     bool empty() const
     {
         return Fv.empty() || vs.empty();
@@ -42,19 +100,89 @@ public:
     /// Report the approximate size (in bytes) of the mesh
     size_t size() const;
 
-    vector<Vec3f>                      vs;        ///< Vertex positions
-    vector<Vec3f>                      ns;        ///< Vertex normals
-    vector<Vec2f>                      uvs;       ///< Vertex texture coordinates
-    vector<Vec3i>                      Fv;        ///< Vertex indices per face (triangle)
-    vector<Vec3i>                      Fn;        ///< Normal indices per face (triangle)
-    vector<Vec3i>                      Ft;        ///< Texture indices per face (triangle)
-    vector<uint32_t>                   Fm;        ///< One material index per face (triangle)
-    vector<shared_ptr<const Material>> materials; ///< All materials in the mesh
-    Transform                          xform;     ///< Transformation that the data has already been transformed by
+    /**
+        Merge the separate position, normal and texture coordinate index streams of an OBJ file into #Fv.
+
+        Each distinct combination of the three indices used by a face corner becomes one vertex, so afterwards #ns and
+        #uvs are indexed by #Fv just like #vs, and #Fn and #Ft are empty. Meshes in which only some faces have normals
+        or texture coordinates are left unwelded.
+    */
+    void weld();
+
+    /// Encode #ns into #packed_ns and/or #uvs into #packed_uvs, according to #pack_normals and #half_uvs
+    void pack_attributes();
+
+    vector<Vec3f>                      vs;         ///< Vertex positions
+    vector<Vec3f>                      ns;         ///< Vertex normals
+    vector<Vec2f>                      uvs;        ///< Vertex texture coordinates
+    vector<uint32_t>                   packed_ns;  ///< Octahedral-encoded vertex normals, replacing #ns if not empty
+    vector<uint32_t>                   packed_uvs; ///< Half-precision texture coordinates, replacing #uvs if not empty
+    vector<Vec3i>                      Fv;         ///< Vertex indices per face (triangle)
+    vector<Vec3i>                      Fn;         ///< Normal indices per face (triangle)
+    vector<Vec3i>                      Ft;         ///< Texture indices per face (triangle)
+    vector<uint16_t>                   Fm;         ///< One material index per face (triangle)
+    vector<shared_ptr<const Material>> materials;  ///< All materials in the mesh
+    Transform                          xform;      ///< Transformation that the data has already been transformed by
     Transform object_to_texture;                  ///< Transformation from object space to texture (bounding box) space
     Box3f     bbox_w;                             ///< The bounds, after transformation (in world space)
     Box3f     bbox_o;                             ///< The bounds, before transformation (in object space)
 
+    bool weld_vertices = true;  ///< Whether to #weld() the mesh after loading, from the optional "weld" field
+    bool welded        = false; ///< Whether #weld() merged the index streams
+    bool pack_normals  = false; ///< Whether to store #packed_ns instead of #ns, from the optional "pack normals" field
+    bool half_uvs      = false; ///< Whether to store #packed_uvs instead of #uvs, from the optional "half uvs" field
+
+    /// Add the whole mesh to the parent as a single surface with its own BBH instead of one #Triangle per face
+    bool        accelerate    = true;
+    bool        use_bbh       = false; ///< Whether #add_to_parent added the mesh as a single surface
+    /// Whether the BBH leaves out the emissive faces, which #add_to_parent added as separate #Triangle%s instead
+    bool        skip_emissive = false;
+    BBHSettings bbh_settings;          ///< Settings for the mesh's BBH, from the optional "bbh" field
+
+    /**
+        Number of triangles tested at once in the BBH leaves, from the optional "simd" field.
+
+        With 4 or 8, the faces of each leaf are packed into #TriangleBlock%s and tested with the watertight kernel, and
+        leaf nodes reference ranges of blocks instead of faces. With 0, faces are tested one at a time with the scalar
+        Moller-Trumbore test.
+    */
+    int simd_width = native_triangle_block_width;
+
+    /**
+        Whether to store the BBH in the quantized layout, from the optional "quantize" field.
+
+        After building, #bbh_nodes are quantized into #quantized_bbh and freed, which shrinks the nodes by about 2.7
+        times at the cost of slightly looser boxes. This pays off for meshes whose BBH does not fit in the cache. If the
+        leaves are too large to quantize, the full-precision #bbh_nodes are kept.
+    */
+    bool quantize = false;
+
+    vector<LinearBBHNode> bbh_nodes;      ///< The flattened BBH over the faces
+    QuantizedBBH          quantized_bbh;  ///< The quantized BBH over the faces if #quantize is set
+    float                 bbh_cost = 0.f; ///< SAH cost of #bbh_nodes right after the last full build
+    vector<Vec3f>         leaf_vs;    ///< Three vertex positions per face, in the order referenced by #bbh_nodes
+    vector<uint32_t>      leaf_faces; ///< Index into #Fv of each face in #leaf_vs
+
+    vector<TriangleBlock<4>> blocks4; ///< The packed leaf faces if #simd_width is 4
+    vector<TriangleBlock<8>> blocks8; ///< The packed leaf faces if #simd_width is 8
+
+    vector<string> material_names; ///< The name of each of #materials in the mesh file, without the "material prefix"
+
+    /**
+        Binary file caching the loaded and built mesh, from the optional "cache" field (empty if caching is disabled).
+
+        Set to true, the file is placed next to the mesh file; set to a string, it is placed in that directory. The file
+        name contains #cache_key, so changing the mesh file (or a file it references), the transform or the BBH settings
+        creates a new cache file.
+        Unless both the geometry and the BBH were read from it, the file is written after the first #build(), and then
+        this field is cleared. Code that changes #bbh_settings or #simd_width of a loaded mesh should clear it, along
+        with #cached_bbh, itself.
+    */
+    string   cache_file;
+    uint64_t cache_key       = 0;     ///< See #mesh_cache_key()
+    bool     cached_geometry = false; ///< Whether the vertex and face arrays were read from #cache_file
+    bool     cached_bbh      = false; ///< Whether #bbh_nodes were read from #cache_file, so the next #build() is free
+
     virtual void add_to_parent(Surface *parent, shared_ptr<Surface> self, const json &j) override;
 };
 
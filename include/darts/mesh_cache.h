@@ -0,0 +1,53 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <darts/common.h>
+
+struct Mesh;
+class MappedFile;
+
+/** \addtogroup Surfaces
+    @{
+*/
+
+/**
+    Compute the key under which a #Mesh loaded from \p file is cached.
+
+    The key hashes the contents of the mesh file and of the files in \p dependencies, like the external buffers of a
+    glTF file, together with everything that changes the loaded or built data: the mesh's transform, the settings of
+    its BBH, its #Mesh::simd_width, and how its attributes are stored. Settings that only affect how fast the BBH is
+    built or when it is rebuilt after a refit are left out.
+*/
+uint64_t mesh_cache_key(const MappedFile &file, const vector<string> &dependencies, const Mesh &mesh);
+
+/**
+    Load the geometry and BBH of \p mesh from the cache file \p filename.
+
+    The cache file is memory mapped, and its arrays are copied into the mesh's arrays without any parsing. This is a
+    copying loader: the mesh does not keep the mapping alive, since #Mesh::refit() and later builds modify the BBH
+    arrays in place, so loading still costs one pass over the file. Only the names of the materials are stored, in
+    Mesh::material_names, so the caller still needs to look them up in the scene.
+
+    \return     False, leaving \p mesh untouched, if the file does not exist, is not a valid cache file, or was
+                written for a different \p key.
+*/
+bool read_mesh_cache(const string &filename, uint64_t key, Mesh &mesh);
+
+/**
+    Write the geometry of \p mesh, and its BBH if it has been built, to the cache file \p filename.
+
+    The file is first written under a temporary name and then renamed, so concurrent renders never map a partially
+    written cache file. Failures are only reported as warnings, since the mesh itself is unaffected.
+*/
+void write_mesh_cache(const string &filename, uint64_t key, const Mesh &mesh);
+
+/** @}*/
+
+/**
+    \file
+    \brief Memory-mappable binary cache of loaded and built meshes
+*/
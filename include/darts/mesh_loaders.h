@@ -0,0 +1,90 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <darts/math.h>
+
+class MappedFile;
+
+/** \addtogroup Surfaces
+    @{
+*/
+
+/**
+    The geometry stored in a mesh file, with polygons triangulated as fans and all indices made zero-based.
+
+    As in #Mesh, #Fn and #Ft only have an entry for the faces whose corners all have a normal or texture index.
+*/
+struct MeshData
+{
+    vector<Vec3f>    vs;             ///< Vertex positions, as stored in the file
+    vector<Vec3f>    ns;             ///< Vertex normals, as stored in the file
+    vector<Vec2f>    uvs;            ///< Vertex texture coordinates
+    vector<Vec3i>    Fv;             ///< Vertex indices per triangle
+    vector<Vec3i>    Fn;             ///< Normal indices per triangle
+    vector<Vec3i>    Ft;             ///< Texture indices per triangle
+    vector<uint32_t> Fm;             ///< Index into #material_names per triangle
+    vector<string>   material_names; ///< Distinct material names in order of first use, after an empty default name
+
+    /// Whether #ns and #uvs are already indexed by #Fv (leaving #Fn and #Ft empty), as after Mesh::weld()
+    bool welded = false;
+};
+
+/// A function that parses the mesh file \p filename, which is mapped by \p file
+using MeshLoader = MeshData (*)(const string &filename, const MappedFile &file);
+
+/// A function that lists the other files that a #MeshLoader reads for the mesh file \p filename, mapped by \p file
+using MeshDependencies = vector<string> (*)(const string &filename, const MappedFile &file);
+
+/**
+    Parse the OBJ file \p filename, mapped by \p obj, using all threads.
+
+    The file is split into chunks that end at line breaks. Each chunk is parsed on its own, and the chunks are then
+    stitched together, which resolves relative (negative) indices and the material that is in effect at the start of
+    each chunk. Only the "v", "vn", "vt", "f" and "usemtl" statements are interpreted; everything else is skipped.
+
+    \throws DartsException  If a face is malformed or refers to a missing vertex, normal, or texture coordinate.
+*/
+MeshData load_obj(const string &filename, const MappedFile &obj);
+
+/**
+    Read the binary little-endian PLY file \p filename, mapped by \p ply.
+
+    The "vertex" element provides positions ("x", "y", "z"), and optionally normals ("nx", "ny", "nz") and texture
+    coordinates ("u", "v", or "s", "t", or "texture_u", "texture_v"); the "face" element provides a list of vertex
+    indices per polygon ("vertex_indices" or "vertex_index"). Properties are copied straight out of the mapped file,
+    converting their type if needed. PLY files have no materials, so all faces use the mesh's default material.
+
+    \throws DartsException  If the file is not a binary little-endian PLY file, or lacks a required property.
+*/
+MeshData load_ply(const string &filename, const MappedFile &ply);
+
+/**
+    Read the glTF 2.0 file \p filename, mapped by \p gltf, which is either a binary .glb file or a .gltf JSON file.
+
+    Every triangle primitive of every mesh in the default scene is added, transformed by its node's accumulated
+    transformation. Buffers are read from the .glb binary chunk, from external files next to \p filename, or from
+    base64 data URIs, and accessors are copied straight out of them. Faces are assigned the material named by their
+    primitive's glTF material. Texture coordinates are flipped vertically to match the OBJ convention.
+
+    \throws DartsException  If the file is malformed, or uses features that are not supported (like sparse accessors).
+*/
+MeshData load_gltf(const string &filename, const MappedFile &gltf);
+
+/**
+    List the external buffer files that #load_gltf reads for the glTF file \p filename, mapped by \p gltf.
+
+    These are the buffers with a URI that is not a data URI, resolved relative to \p filename. A .glb file, or a .gltf
+    file that embeds its buffers, has none.
+*/
+vector<string> gltf_external_buffers(const string &filename, const MappedFile &gltf);
+
+/** @}*/
+
+/**
+    \file
+    \brief Parsers of the mesh file formats
+*/
@@ -0,0 +1,129 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <cstring>
+#include <darts/math.h>
+
+/** \addtogroup Math
+    @{
+*/
+
+/**
+    Encode a unit vector in 32 bits using the octahedral mapping of Meyer et al. [2010].
+
+    The unit sphere is projected onto the octahedron |x| + |y| + |z| = 1, whose lower half is folded over the upper one
+    so that the whole sphere maps to the square [-1,1]^2. Both coordinates are stored as 16-bit signed normalized
+    integers, which keeps the angular error well below a tenth of a degree.
+*/
+inline uint32_t encode_octahedral(const Vec3f &n)
+{
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (!(l1 > 0.f))
+        return encode_octahedral(Vec3f(0.f, 0.f, 1.f));
+
+    float u = n.x / l1, v = n.y / l1;
+    if (n.z < 0.f)
+    {
+        float fu = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+        float fv = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+        u        = fu;
+        v        = fv;
+    }
+
+    auto snorm16 = [](float x) { return uint32_t(uint16_t(int16_t(std::round(clamp(x, -1.f, 1.f) * 32767.f)))); };
+    return snorm16(u) | snorm16(v) << 16;
+}
+
+/// Decode a unit vector encoded by #encode_octahedral
+inline Vec3f decode_octahedral(uint32_t packed)
+{
+    float u = std::max(int16_t(packed & 0xffff) / 32767.f, -1.f);
+    float v = std::max(int16_t(packed >> 16) / 32767.f, -1.f);
+
+    // unfold the lower half of the octahedron
+    Vec3f n(u, v, 1.f - std::abs(u) - std::abs(v));
+    float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return normalize(n);
+}
+
+/// Convert a float to the nearest IEEE 754 half-precision float, rounding ties to even
+inline uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(float));
+
+    uint32_t sign     = (x >> 16) & 0x8000;
+    uint32_t biased   = (x >> 23) & 0xff;
+    uint32_t mantissa = x & 0x7fffff;
+    int      exponent = int(biased) - 127 + 15;
+
+    // infinities and NaNs (keeping NaNs quiet), and overflow to infinity
+    if (biased == 0xff)
+        return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    if (exponent >= 31)
+        return uint16_t(sign | 0x7c00);
+
+    uint32_t shift = 13;
+    uint32_t half  = sign | uint32_t(std::max(exponent, 0)) << 10;
+    if (exponent <= 0)
+    {
+        // subnormal halfs store the implicit leading one explicitly, or flush to zero
+        if (exponent < -10)
+            return uint16_t(sign);
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+    }
+
+    // a carry out of the mantissa correctly rounds up into the exponent
+    uint32_t rest    = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    half += mantissa >> shift;
+    if (rest > halfway || (rest == halfway && (half & 1)))
+        ++half;
+    return uint16_t(half);
+}
+
+/// Convert an IEEE 754 half-precision float to a float
+inline float half_to_float(uint16_t h)
+{
+    uint32_t sign     = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0)
+    {
+        // zero or subnormal: mantissa * 2^-24 is exact in single precision
+        float f = float(mantissa) * (1.f / 16777216.f);
+        return sign ? -f : f;
+    }
+
+    uint32_t x = sign | (exponent == 0x1f ? 0x7f800000 : (exponent + 112) << 23) | mantissa << 13;
+    float    f;
+    std::memcpy(&f, &x, sizeof(float));
+    return f;
+}
+
+/// Pack a 2D vector into two half-precision floats
+inline uint32_t pack_half2(const Vec2f &v)
+{
+    return uint32_t(float_to_half(v.x)) | uint32_t(float_to_half(v.y)) << 16;
+}
+
+/// Unpack a 2D vector packed by #pack_half2
+inline Vec2f unpack_half2(uint32_t packed)
+{
+    return Vec2f(half_to_float(uint16_t(packed & 0xffff)), half_to_float(uint16_t(packed >> 16)));
+}
+
+/** @}*/
+
+/**
+    \file
+    \brief Compact encodings of unit vectors and half-precision floats
+*/
@@ -77,6 +77,19 @@ public:
         m_current_sample = 0;
     }
 
+    /**
+        Continue pixel (x,y) at sample \p index, e.g. in a later pass of progressive rendering.
+
+        Call this right after #seed and #start_pixel for the pixel. The base class just sets the current sample index,
+        but derived classes whose random numbers do not only depend on the sample index must also make sure that the
+        samples from \p index on differ from the ones generated from the start of the pixel.
+    */
+    virtual void skip_to_sample(uint32_t index)
+    {
+        m_current_dimension = 0u;
+        m_current_sample    = index;
+    }
+
     /// Advance to the next sample
     virtual void advance()
     {
@@ -96,6 +109,12 @@ public:
         return m_sample_count;
     }
 
+    /// Change the number of pixel samples, e.g. to override the scene file from the command line
+    void set_sample_count(uint32_t count)
+    {
+        m_sample_count = count;
+    }
+
     uint32_t current_sample() const
     {
         return m_current_sample;
@@ -21,11 +21,28 @@
     @{
 */
 
+/// The random number generator of the calling thread behind #randf()
+inline pcg32 &global_rng()
+{
+    static thread_local pcg32 rng = pcg32();
+    return rng;
+}
+
 /// Global random number generator that produces floats between <tt>[0,1)</tt>
 inline float randf()
 {
-    static thread_local pcg32 rng = pcg32();
-    return rng.nextFloat();
+    return global_rng().nextFloat();
+}
+
+/**
+    Deterministically reseed the calling thread's #randf() generator.
+
+    Code that still draws from the global RNG, like Material::scatter(), can be made independent of the thread it runs
+    on by reseeding before each sample, e.g.\ from the pixel and sample index.
+*/
+inline void seed_randf(uint64_t state, uint64_t sequence)
+{
+    global_rng().seed(state, sequence);
 }
 
 inline float randf(float min , float max)
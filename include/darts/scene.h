@@ -13,6 +13,53 @@
 #include <darts/sampler.h>
 #include <darts/integrator.h>
 #include <darts/surface_group.h>
+#include <darts/tile_scheduler.h>
+
+/**
+    How Scene::raytrace() renders the image, from the optional "render" field of the scene.
+
+    By default, all samples of each pixel are rendered at once. In progressive mode, which is enabled by setting
+    #pass_samples, #time_limit, #threshold or #checkpoint_interval, every pass adds #pass_samples more samples per
+    pixel to an accumulation buffer, until the sampler's sample count is reached or one of the budgets runs out. The
+    #threshold is only checked once every pixel has #min_samples samples, since its error estimate needs at least two.
+
+    Adaptive sampling, enabled by #adaptive_threshold, tracks the mean and variance of every pixel and only gives more
+    samples to pixels whose estimated relative error is still above the threshold, between #min_samples and
+    #max_samples per pixel. Rendering then ends once no pixel needs more samples.
+*/
+struct RenderSettings
+{
+    int       tile_size  = 32;                 ///< Width and height of the tiles, from "tile size"
+    TileOrder tile_order = TileOrder::Hilbert; ///< The order in which the tiles are rendered, from "tile order"
+
+    uint32_t pass_samples        = 0;   ///< Samples per pixel of each pass, from "pass samples"; 1 if 0 but progressive
+    float    time_limit          = 0.f; ///< Wall-clock budget in seconds, from "time limit"; 0 for none
+    float    threshold           = 0.f; ///< Stop once the mean relative error is below this, from "threshold"
+    float    checkpoint_interval = 0.f; ///< Seconds between calls of #checkpoint, from "checkpoint interval"
+
+    float    adaptive_threshold = 0.f; ///< Relative error to aim for per pixel, from "adaptive threshold"; 0 for none
+    uint32_t min_samples        = 16;  ///< Samples each pixel gets before its error is trusted, from "min samples"
+    uint32_t max_samples        = 0;   ///< Most samples per pixel, from "max samples"; 0 for the sampler's count
+
+    /// Called with the image rendered so far and its average samples per pixel every #checkpoint_interval seconds
+    std::function<void(const Image3f &image, float spp)> checkpoint;
+
+    RenderSettings() = default;
+    RenderSettings(const json &j);
+
+    bool progressive() const
+    {
+        return pass_samples > 0 || time_limit > 0.f || threshold > 0.f || checkpoint_interval > 0.f ||
+               adaptive_threshold > 0.f;
+    }
+};
+
+/// Per-pixel statistics gathered by Scene::raytrace(), which show where the samples went
+struct RenderStatistics
+{
+    Image3f variance; ///< The variance of each pixel's estimate, i.e.\ its sample variance over its sample count
+    Image3f samples;  ///< The number of samples of each pixel, in all channels
+};
 
 /**
     Main scene data structure.
@@ -44,6 +91,12 @@ public:
     }
 
     bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
+
+    uint32_t intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const override;
+
+    /// Update the acceleration structures after surfaces moved, e.g. between the frames of an animation
+    void refit() override;
 
     Box3f bounds() const override
     {
@@ -70,8 +123,35 @@ public:
     */
     Color3f recursive_color(const Ray3f &ray, int depth) const;
 
-    /// Generate the entire image by ray tracing.
-    Image3f raytrace() const;
+    /// The settings from the "render" field of the scene
+    const RenderSettings &render_settings() const
+    {
+        return m_render_settings;
+    }
+
+    /// Change the number of samples per pixel of the scene's sampler
+    void set_sample_count(uint32_t count)
+    {
+        m_sampler->set_sample_count(count);
+    }
+
+    /// Generate the entire image by ray tracing, using the scene's #render_settings()
+    Image3f raytrace() const
+    {
+        return raytrace(m_render_settings);
+    }
+
+    /**
+        Generate the entire image by ray tracing.
+
+        The image is rendered in tiles by a #TileScheduler, as configured by \p settings, either in a single pass or
+        progressively. Every pixel seeds its sampler with its own coordinates, so the image does not depend on the
+        number of threads.
+
+        \param settings     How to render the image
+        \param statistics   If not null, receives the variance and sample count of every pixel
+    */
+    Image3f raytrace(const RenderSettings &settings, RenderStatistics *statistics = nullptr) const;
 
 private:
     shared_ptr<Camera>       m_camera;
@@ -80,6 +160,8 @@ private:
     Color3f m_background  = Color3f(0.2f);
     int     m_num_samples = 1;
 
+    RenderSettings m_render_settings;
+
     shared_ptr<Sampler> m_sampler;
 
     shared_ptr<Integrator> m_integrator;
@@ -15,10 +15,12 @@ public:
     Sphere(const json &j = json::object());
 
     bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
     Box3f local_bounds() const override;
 
     Color3f sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const override;
     float   pdf(const Vec3f &o, const Vec3f &v) const override;
+    float   emitted_power() const override;
 
 protected:
     float m_radius = 1.0f; ///< The radius of the sphere
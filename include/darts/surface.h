@@ -36,6 +36,16 @@ struct HitInfo
     HitInfo() = default;
 };
 
+/// The maximum number of rays in a packet passed to Surface::intersect_packet(), one bit per ray in a \c uint32_t mask
+constexpr int max_packet_size = 32;
+
+/// A cone of directions within an angle of #axis, e.g.\ to bound the normals of a surface
+struct DirectionCone
+{
+    Vec3f axis      = Vec3f(0, 0, 1); ///< The central direction of the cone
+    float cos_theta = -1.f;           ///< Cosine of the cone's half-angle; -1 for all directions
+};
+
 /// Data record for conveniently querying and sampling emitters.
 struct EmitterRecord
 {
@@ -77,6 +87,15 @@ public:
     */
     virtual void build(){};
 
+    /**
+        Update any acceleration structure of this surface after its children moved or deformed.
+
+        Unlike #build(), this keeps the structure's topology and only recomputes bounds, so it is much cheaper when the
+        geometry changes a little between frames of an animation. Surfaces without an acceleration structure compute
+        their bounds on demand, so the base class implementation does nothing.
+    */
+    virtual void refit(){};
+
     /**
         Add a child surface.
 
@@ -120,9 +139,68 @@ public:
     {
         throw DartsException("Surface intersection method not implemented.");
     }
+
+    /**
+        Intersect a packet of rays against this surface.
+
+        Acceleration structures override this to traverse their nodes once for the whole packet, testing each node's
+        bounds against all rays that are still active, which pays off for coherent rays such as primary rays.
+
+        The base class implementation just calls #intersect() for each active ray.
+
+        \param [in,out] rays    An array of #max_packet_size rays. The \c maxt of each ray that hits is set to the hit
+                                distance, so that repeated calls only report closer hits.
+        \param [in] active      Bitmask of the rays to intersect
+        \param [out] hits       An array of #max_packet_size hit records. Only the records of hit rays are written.
+        \return                 Bitmask of the rays that hit this surface
+     */
+    virtual uint32_t intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const
+    {
+        uint32_t hit_mask = 0;
+        for (int i = 0; i < max_packet_size; ++i)
+        {
+            if ((active & (1u << i)) && intersect(rays[i], hits[i]))
+            {
+                rays[i].maxt = hits[i].t;
+                hit_mask |= 1u << i;
+            }
+        }
+        return hit_mask;
+    }
+
+    /**
+        Ray-Surface occlusion test.
+
+        Check whether a ray hits this surface anywhere within [\p ray.mint, \p ray.maxt]. Unlike #intersect(), this may
+        return as soon as any hit is found, and never computes normals, texture coordinates or materials, so it is the
+        cheaper query for visibility (shadow) rays.
+
+        The base class implementation just calls #intersect().
+
+        \param [in] ray     A 3-dimensional ray data structure with minimum/maximum extent information
+        \return             True if any intersection was found
+     */
+    virtual bool occluded(const Ray3f &ray) const
+    {
+        HitInfo hit;
+        return intersect(ray, hit);
+    }
+
     /// Return the surface's world-space AABB.
     virtual Box3f bounds() const = 0;
 
+    /**
+        Bound the parts of this surface within \p bbox on either side of the plane \p axis = \p pos.
+
+        Used by the spatial splits of an SBVH. The base class implementation just splits \p bbox itself, which is
+        conservative for any surface.
+    */
+    virtual void split_bounds(const Box3f &bbox, int axis, float pos, Box3f &left, Box3f &right) const
+    {
+        left = right   = bbox;
+        left.max[axis] = right.min[axis] = pos;
+    }
+
     /**
         Sample a direction from \p rec.o towards this surface.
 
@@ -165,12 +243,34 @@ public:
         return {this, 1.f};
     }
 
-    /// Return the probability of a child generated by #sample_child
-    virtual float child_prob() const
+    /// Return the probability that #sample_child picks \p child
+    virtual float child_prob(const Surface *child) const
+    {
+        return child == this ? 1.f : 0.f;
+    }
+
+    /**
+        Return an estimate of the power emitted by this surface, used to sample emitters in proportion to it.
+
+        Only relative values matter, so this is just the luminance of the emitted radiance times the surface area.
+        Surfaces that cannot estimate their area all report 1.
+    */
+    virtual float emitted_power() const
     {
         return 1.f;
     }
 
+    /**
+        Return a cone that bounds the normals on the emitting side of this surface.
+
+        Diffuse emitters only emit within 90 degrees of these normals, which lets #LightTree skip emitters that face
+        away from a shading point. Surfaces that do not know their orientation return the cone of all directions.
+    */
+    virtual DirectionCone normal_cone() const
+    {
+        return DirectionCone();
+    }
+
 };
 
 /**
@@ -194,6 +294,18 @@ public:
     /// Return the surface's local-space AABB.
     virtual Box3f local_bounds() const = 0;
 
+    /// Return the local-to-world transformation
+    const Transform &transform() const
+    {
+        return m_xform;
+    }
+
+    /// Move the surface, e.g. for the next frame of an animation. Call Surface::refit() on its parents afterwards.
+    void set_transform(const Transform &xform)
+    {
+        m_xform = xform;
+    }
+
 protected:
     Transform m_xform = Transform(); ///< Local-to-world Transformation
 };
@@ -5,7 +5,9 @@
 */
 #pragma once
 
+#include <darts/alias_table.h>
 #include <darts/surface.h>
+#include <unordered_map>
 
 /**
     A collection of Surfaces grouped together.
@@ -29,6 +31,18 @@ public:
 
     virtual void add_child(shared_ptr<Surface> surface) override;
 
+    /**
+        Prepare the group for sampling its children.
+
+        Builds an #AliasTable over the #emitted_power() of the children, so that #sample_child picks bright and large
+        emitters more often, along with an index of the children, which makes #child_prob constant time. Accelerators
+        override this to build their hierarchy instead, and then sample their children uniformly.
+    */
+    void build() override;
+
+    /// Refit all children, and recompute the bounds of the group (and the sampling weights, if they were built)
+    void refit() override;
+
     /**
         Intersect a ray against all surfaces registered with the Accelerator.
 
@@ -36,17 +50,72 @@ public:
     */
     bool intersect(const Ray3f &ray, HitInfo &hit) const override;
 
+    /**
+        Check whether a ray hits any surface registered with the Accelerator.
+
+        \copydetails Surface::occluded()
+    */
+    bool occluded(const Ray3f &ray) const override;
+
     Box3f local_bounds() const override;
 
     Color3f sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const override;
 
     pair<const Surface *, float> sample_child(float &rv1) const override;
-    float                        child_prob() const override;
-    float                        pdf(const Vec3f &o, const Vec3f &v) const override;
+
+    /**
+        Return the probability that #sample_child picks \p child, in constant time.
+
+        This is the probability of a direct child, so it is 0 for surfaces nested deeper in the group.
+    */
+    float child_prob(const Surface *child) const override;
+
+    /**
+        Return the probability density of #sample generating direction \p v from \p o.
+
+        This evaluates the density of every child. Integrators that already know which emitter the direction leads to
+        should use #emitter_pdf instead.
+    */
+    float pdf(const Vec3f &o, const Vec3f &v) const override;
+
+    /**
+        Return the probability that #sample picks the child \p emitter when sampling from \p o.
+
+        The base class picks children independently of \p o, so this is just #child_prob, in constant time.
+    */
+    virtual float emitter_prob(const Surface *emitter, const Vec3f &o) const
+    {
+        return child_prob(emitter);
+    }
+
+    /// Return the density of sampling direction \p v from \p o towards the child \p emitter
+    float emitter_pdf(const Surface *emitter, const Vec3f &o, const Vec3f &v) const
+    {
+        float prob = emitter_prob(emitter, o);
+        return prob > 0.f ? prob * emitter->pdf(o, v) : 0.f;
+    }
+
+    /// The total power of the children
+    float emitted_power() const override;
+
+    /// Whether the group has no children, e.g.\ an emitter group of a scene without lights
+    bool empty() const
+    {
+        return m_surfaces.empty();
+    }
 
 protected:
+    /// The probability of picking child \p i: from #m_sampling_weights if they were built, and uniform otherwise
+    float child_prob(uint32_t i) const
+    {
+        return m_sampling_weights.size() == m_surfaces.size() ? m_sampling_weights.prob(i) : 1.f / m_surfaces.size();
+    }
+
     vector<shared_ptr<Surface>> m_surfaces; ///< All children
     Box3f m_bounds;
+
+    AliasTable                                    m_sampling_weights; ///< Picks children in proportion to their power
+    std::unordered_map<const Surface *, uint32_t> m_child_index;      ///< Index into #m_surfaces of each child
 };
 
 /**
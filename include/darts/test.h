@@ -5,10 +5,13 @@
 */
 #pragma once
 
+#include <chrono>
 #include <darts/array2d.h>
+#include <darts/box.h>
 #include <darts/common.h>
 #include <darts/fwd.h>
 #include <darts/image.h>
+#include <darts/ray.h>
 
 /// Base class for unit tests in Darts
 struct Test
@@ -48,6 +51,8 @@ struct ScatterTest : public Test
     uint64_t total_samples;
     uint32_t up_samples = 4;
     float    max_value  = -1.f;
+
+    Array2d<float> histogram; ///< The density of the sampled directions, filled by #run
 };
 
 struct SampleTest : public ScatterTest
@@ -58,8 +63,56 @@ struct SampleTest : public ScatterTest
     virtual float pdf(const Vec3f &dir, float rv1) const = 0;
 
     uint32_t super_samples;
+    /// Fail if the total variation distance between the histogram and the pdf exceeds this; negative to only report it
+    float max_difference = -1.f;
 };
 
+/**
+    \name Helpers for tests that benchmark acceleration structures
+
+    These tests time different versions of an acceleration structure on the same random rays, and fail if any version
+    finds different hits than the first one.
+    @{
+*/
+
+/// \p count rays from random points on a sphere enclosing \p bbox towards random points within it
+vector<Ray3f> random_rays_towards(const Box3f &bbox, uint32_t count);
+
+/// \p count rays from random points within \p bbox in random directions, like the rays of an interior scene
+vector<Ray3f> random_rays_within(const Box3f &bbox, uint32_t count);
+
+/// Trace \p rays through \p surface, returning the distance to each closest hit, or infinity for misses
+vector<float> trace_rays(const Surface &surface, const vector<Ray3f> &rays);
+
+/**
+    Compare the hit distances \p t of the rays with those of a reference, e.g.\ from #trace_rays.
+
+    Rays differ if only one of them hits, or if their distances differ by more than a relative 1e-4.
+
+    \param what     A description of what is compared, for the error message
+    \param allowed  The number of differing rays to tolerate
+    \return         The number of differing rays
+    \throws DartsException if more than \p allowed rays differ
+*/
+size_t check_hits(const vector<float> &t, const vector<float> &reference_t, const string &what, size_t allowed = 0);
+
+/// The fastest of \p repeats runs of \p func in milliseconds
+template <typename Func>
+double best_time_ms(int repeats, Func &&func)
+{
+    double best_ms = std::numeric_limits<double>::infinity();
+    for (int r = 0; r < std::max(repeats, 1); ++r)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        best_ms  = std::min(best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best_ms;
+}
+
+/** @}*/
+
 /**
     \file
     \brief Class #Test.
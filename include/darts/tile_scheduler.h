@@ -0,0 +1,100 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <darts/box.h>
+#include <darts/surface.h>
+#include <functional>
+
+/** \addtogroup Parallel
+    @{
+*/
+
+/// The order in which #TileScheduler hands out the tiles of the image
+enum class TileOrder
+{
+    Scanline, ///< Row by row, starting at the top
+    Spiral,   ///< In rings around the center of the image, so the center is finished first
+    Hilbert   ///< Along a Hilbert curve, so consecutive tiles are close to each other
+};
+
+/**
+    Distributes the pixels of an image over worker threads in square tiles.
+
+    The image is split into tiles of #tile_size × #tile_size pixels, and each tile into packets of at most
+    #packet_capacity() pixels, which are traced together. Every worker takes the next tile in #TileOrder and renders its
+    packets. Once all tiles have been started, idle workers steal the remaining packets of tiles that are still being
+    rendered, so the threads run out of work at nearly the same time. All of this uses atomic counters, without locks.
+
+    Which worker renders a packet depends on timing, so renderers that need deterministic output should make the samples
+    of a pixel depend only on the pixel (e.g. by seeding a sampler with its coordinates).
+*/
+class TileScheduler
+{
+public:
+    /// A function that renders the \p count pixels of a packet using the state of worker \p worker
+    using PacketFunction = std::function<void(uint32_t worker, const Vec2i *pixels, int count)>;
+
+    /**
+        Split an image of size \p resolution into tiles.
+
+        \param resolution   The size of the image in pixels
+        \param tile_size    The width and height of the tiles in pixels
+        \param order        The order in which the tiles are started
+        \param packet_size  The most pixels per packet, e.g.\ Integrator::packet_size(); packets never span tiles
+    */
+    TileScheduler(const Vec2i &resolution, int tile_size = 32, TileOrder order = TileOrder::Hilbert,
+                  int packet_size = max_packet_size);
+
+    /// Parse a #TileOrder from one of the strings "scanline", "spiral", or "hilbert"
+    static TileOrder parse_order(const string &name);
+
+    /// The number of workers that #run uses, which is one more than the pool size, since the calling thread helps
+    static uint32_t num_workers();
+
+    uint32_t num_tiles() const
+    {
+        return uint32_t(m_tiles.size());
+    }
+
+    /// The most pixels in a packet
+    int packet_capacity() const
+    {
+        return m_packet_size.x * m_packet_size.y;
+    }
+
+    /// The pixels covered by the \p i-th tile in rendering order, clipped to the image
+    Box2i tile(uint32_t i) const;
+
+    /// The number of packets in tile \p t
+    uint32_t num_packets(uint32_t t) const;
+
+    /**
+        Look up the pixels of packet \p p in tile \p t.
+
+        \param [out] pixels  The pixel coordinates, which must have room for #packet_capacity() entries
+        \return              The number of pixels in the packet
+    */
+    int packet(uint32_t t, uint32_t p, Vec2i *pixels) const;
+
+    /// Call \p func for every packet of the image, in parallel on #num_workers() workers
+    void run(const PacketFunction &func) const;
+
+    int       tile_size; ///< The width and height of the tiles in pixels
+    TileOrder order;     ///< The order in which the tiles are started
+
+protected:
+    Vec2i         m_resolution;
+    Vec2i         m_packet_size; ///< The size of the rectangular packets, which fits into the requested packet size
+    vector<Vec2i> m_tiles;       ///< The upper-left pixel of each tile, in rendering order
+};
+
+/** @}*/
+
+/**
+    \file
+    \brief Class #TileScheduler
+*/
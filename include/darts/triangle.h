@@ -18,17 +18,34 @@ public:
     Triangle(const json &j, shared_ptr<const Mesh> mesh, uint32_t tri_number);
 
     bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
+
+    /**
+        Find the distance and barycentric coordinates of a hit of \p ray with the triangle, but nothing else.
+
+        Accelerators use this instead of #intersect, and call #hit_info just once, for the closest hit.
+    */
+    bool find_hit(const Ray3f &ray, float &t, float &u, float &v) const;
+
+    /// Fill in \p hit for a hit found by #find_hit
+    void hit_info(const Ray3f &ray, float t, float u, float v, HitInfo &hit) const
+    {
+        m_mesh->compute_hit_info(ray, m_face_idx, t, u, v, hit);
+    }
 
     Box3f bounds() const override;
+    void  split_bounds(const Box3f &bbox, int axis, float pos, Box3f &left, Box3f &right) const override;
 
     Color3f sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const override;
     float   pdf(const Vec3f &o, const Vec3f &v) const override;
+    float   emitted_power() const override;
 
+    /// The cone of the face's shading normals, which decide the side that emits, or the geometric normal if it has none
+    DirectionCone normal_cone() const override;
 
     bool is_emissive() const override
     {
-        return m_mesh && m_mesh->materials[m_mesh->Fm[m_face_idx]] &&
-               m_mesh->materials[m_mesh->Fm[m_face_idx]]->is_emissive();
+        return m_mesh && m_mesh->face_emissive(m_face_idx);
     }
 
 protected:
@@ -42,12 +59,82 @@ protected:
     uint32_t               m_face_idx;
 };
 
+/**
+    The closest hit of a ray during the traversal of an accelerator, which defers the hit information of triangles.
+
+    Triangles only record their distance and barycentric coordinates here, so their normals, uvs and material are only
+    computed by #finish, once for the closest hit, instead of for every closer hit found along the way. Other surfaces
+    fill in the hit record right away, and discard any triangle hit that they are closer than.
+
+    \ingroup Surfaces
+*/
+struct DeferredTriangleHit
+{
+    const Triangle *triangle = nullptr; ///< The triangle of the closest hit so far, or null if it is another surface
+    float           u, v;               ///< The barycentric coordinates of the hit on #triangle
+
+    /**
+        Intersect \p ray with \p surface, which is \p triangle if that is not null, and shrink \p ray.maxt on a hit.
+
+        \return     True if \p surface was hit closer than before. Only \p hit.t is valid if this is a triangle hit.
+    */
+    bool intersect(const Surface *surface, const Triangle *triangle, Ray3f &ray, HitInfo &hit)
+    {
+        if (triangle)
+        {
+            float t, tu, tv;
+            if (!triangle->find_hit(ray, t, tu, tv))
+                return false;
+            this->triangle = triangle;
+            u              = tu;
+            v              = tv;
+            hit.t          = t;
+        }
+        else if (surface->intersect(ray, hit))
+            this->triangle = nullptr;
+        else
+            return false;
+
+        ray.maxt = hit.t;
+        return true;
+    }
+
+    /// Complete \p hit if the closest hit of \p ray was a triangle
+    void finish(const Ray3f &ray, HitInfo &hit) const
+    {
+        if (triangle)
+            triangle->hit_info(ray, hit.t, u, v, hit);
+    }
+};
+
 /// Intersect a ray with a single triangle. \ingroup Surfaces
 bool single_triangle_intersect(const Ray3f &ray, const Vec3f &v0, const Vec3f &v1, const Vec3f &v2, const Vec3f *n0,
                                const Vec3f *n1, const Vec3f *n2, const Vec2f *t0, const Vec2f *t1, const Vec2f *t2,
                                HitInfo &hit, const Material *material = nullptr, const Surface *surface = nullptr,
                                const Mesh *mesh = nullptr);
 
+/// Check whether a ray hits a single triangle, without computing any hit information. \ingroup Surfaces
+bool single_triangle_occluded(const Ray3f &ray, const Vec3f &v0, const Vec3f &v1, const Vec3f &v2);
+
+/**
+    Find the hit distance and barycentric coordinates of a ray with a single triangle.
+
+    This is the part of the intersection test that needs to run for every candidate triangle. The remaining hit
+    information can be computed with #single_triangle_hit_info once the closest hit is known.
+
+    \param [out] t      The hit distance, within [ray.mint, ray.maxt] if there is a hit
+    \param [out] u,v    The barycentric coordinates of the hit with respect to \p v1 and \p v2
+    \return             True if the ray hits the triangle
+    \ingroup Surfaces
+*/
+bool single_triangle_hit(const Ray3f &ray, const Vec3f &v0, const Vec3f &v1, const Vec3f &v2, float &t, float &u,
+                         float &v);
+
+/// Fill in \p hit for a hit found by #single_triangle_hit, interpolating the optional normals and uvs. \ingroup Surfaces
+void single_triangle_hit_info(const Ray3f &ray, const Vec3f &v0, const Vec3f &v1, const Vec3f &v2, const Vec3f *n0,
+                              const Vec3f *n1, const Vec3f *n2, const Vec2f *t0, const Vec2f *t1, const Vec2f *t2,
+                              float t, float u, float v, HitInfo &hit, const Material *material = nullptr);
+
 /**
     \file
     \brief Class #Triangle
@@ -0,0 +1,102 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+#pragma once
+
+#include <darts/common.h>
+#include <darts/ray.h>
+
+/** \addtogroup Surfaces
+    @{
+*/
+
+/**
+    Up to \p W triangles packed in structure-of-arrays form, so that a single SIMD kernel can test a ray against all
+    of them at once.
+
+    Unused lanes are marked by #num_triangles and are never reported as hit.
+*/
+template <int W>
+struct alignas(32) TriangleBlock
+{
+    float    p[3][3][W];    ///< Vertex positions, indexed by [vertex][axis][lane]
+    uint32_t face[W];       ///< Index of the face of each lane in the owning mesh
+    uint32_t num_triangles; ///< Number of used lanes
+};
+
+/**
+    Per-ray constants of the watertight ray-triangle test of Woop et al. [2013].
+
+    The test translates the triangle vertices to the ray origin, permutes the axes so that the ray travels along +z, and
+    shears the vertices so that the ray direction becomes (0,0,1). The hit test then reduces to 2D edge functions at the
+    origin. Edges shared by adjacent triangles are evaluated identically for both triangles, so rays cannot slip through
+    the cracks between them, and grazing hits are not dropped by a determinant cutoff.
+*/
+struct WatertightRay
+{
+    Vec3f o;          ///< The ray origin
+    int   kx, ky, kz; ///< Permutation of the axes so that kz is the dominant axis of the direction
+    float sx, sy, sz; ///< Shear constants
+    float mint;       ///< Minimum hit distance
+
+    WatertightRay() = default;
+    WatertightRay(const Ray3f &ray);
+};
+
+/**
+    Find the closest hit of a ray with the triangles of a block.
+
+    \param [in] block   The triangles to test
+    \param [in] ray     The precomputed ray constants
+    \param [in] maxt    Only hits closer than this are reported
+    \param [out] t      The distance of the closest hit
+    \param [out] u,v    The barycentric coordinates of the closest hit with respect to its second and third vertex
+    \return             The lane of the closest hit, or -1 if no triangle was hit
+*/
+template <int W>
+int intersect_triangle_block(const TriangleBlock<W> &block, const WatertightRay &ray, float maxt, float &t, float &u,
+                             float &v);
+
+/**
+    Pack the faces \p faces[0..count) of a mesh into ceil(count / W) blocks, appending them to \p blocks.
+
+    \param vertex   Called as \c vertex(face, i) to return the position of vertex \c i of \c face
+*/
+template <int W, typename VertexFunc>
+void pack_triangle_blocks(const uint32_t *faces, uint32_t count, vector<TriangleBlock<W>> &blocks, VertexFunc &&vertex)
+{
+    for (uint32_t first = 0; first < count; first += W)
+    {
+        TriangleBlock<W> block{};
+        block.num_triangles = std::min(uint32_t(W), count - first);
+        for (uint32_t lane = 0; lane < block.num_triangles; ++lane)
+        {
+            block.face[lane] = faces[first + lane];
+            for (int i = 0; i < 3; ++i)
+            {
+                Vec3f p = vertex(block.face[lane], i);
+                for (int a = 0; a < 3; ++a)
+                    block.p[i][a][lane] = p[a];
+            }
+        }
+        blocks.push_back(block);
+    }
+}
+
+/// The widest triangle block supported natively by the instruction set the code is compiled for (0 if none)
+#if defined(__AVX__)
+constexpr int native_triangle_block_width = 8;
+#elif defined(__SSE2__) || defined(_M_X64)
+constexpr int native_triangle_block_width = 4;
+#else
+constexpr int native_triangle_block_width = 0;
+#endif
+
+/** @}*/
+
+/**
+    \file
+    \brief SIMD-friendly blocks of triangles and a watertight ray-triangle kernel that tests a whole block at once
+*/
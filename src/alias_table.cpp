@@ -0,0 +1,65 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/alias_table.h>
+
+void AliasTable::build(const vector<float> &weights)
+{
+    size_t n = weights.size();
+    m_prob.assign(n, 0.f);
+    m_slots.assign(n, Slot{1.f, 0});
+    if (n == 0)
+        return;
+
+    double sum = 0.0;
+    for (float w : weights)
+        if (w > 0.f && std::isfinite(w))
+            sum += w;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        m_slots[i].alias = uint32_t(i);
+        if (sum > 0.0)
+            m_prob[i] = (weights[i] > 0.f && std::isfinite(weights[i])) ? float(weights[i] / sum) : 0.f;
+        else
+            m_prob[i] = 1.f / n;
+    }
+
+    // scale the probabilities so that an equally likely slot has weight 1, and sort them into under- and overfull
+    vector<double>   scaled(n);
+    vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; ++i)
+    {
+        scaled[i] = double(m_prob[i]) * n;
+        (scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+    }
+
+    // fill each underfull slot with the excess of an overfull one
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+
+        m_slots[s] = Slot{float(scaled[s]), l};
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // whatever is left is full up to round-off error
+    for (uint32_t i : small)
+        m_slots[i] = Slot{1.f, i};
+    for (uint32_t i : large)
+        m_slots[i] = Slot{1.f, i};
+}
+
+/**
+    \file
+    \brief Class #AliasTable
+*/
@@ -24,6 +24,15 @@ int main(int argc, char **argv)
     string   format = "png";
     string   scenefile;
     uint32_t threads;
+    uint32_t spp;
+    uint32_t pass_spp;
+    float    time_limit;
+    float    threshold;
+    float    checkpoint_interval;
+    float    adaptive_threshold;
+    uint32_t min_spp;
+    uint32_t max_spp;
+    bool     save_statistics = false;
 
     CLI::App app{"Dartmouth Academic Ray Tracing Skeleton", "darts"};
 
@@ -40,6 +49,31 @@ int main(int argc, char **argv)
     app.add_option("-t,--threads", threads,
                    fmt::format("Number of threads to use in the thread pool; default: number of detected cores."))
         ->check(CLI::NonNegativeNumber);
+    app.add_option("--spp", spp, "Override the number of samples per pixel of the scene's sampler.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--pass-spp", pass_spp,
+                   "Render progressively, adding this many samples per pixel in each pass; default: 1 if any of the "
+                   "options below is given.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--time-limit", time_limit,
+                   "Render progressively, and stop before the next pass would exceed this many seconds.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--threshold", threshold,
+                   "Render progressively, and stop once the mean relative error of the pixels drops below this.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--checkpoint", checkpoint_interval,
+                   "Render progressively, and write the image rendered so far as an EXR file every this many seconds.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--adaptive", adaptive_threshold,
+                   "Sample adaptively, giving more samples only to pixels whose relative error is above this.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--min-spp", min_spp, "Samples per pixel before adaptive sampling or --threshold apply; default: 16.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--max-spp", max_spp,
+                   "Maximum samples per pixel with adaptive sampling; default: the sample count of the sampler.")
+        ->check(CLI::PositiveNumber);
+    app.add_flag("--statistics", save_statistics,
+                 "Also write the variance and the number of samples of each pixel to EXR files next to the image.");
     app.add_option("-v,--verbosity", verbosity,
                    R"(Set verbosity threshold T with lower values meaning more verbose
 and higher values removing low-priority messages. All messages with
@@ -116,7 +150,43 @@ The default is 2 (info).)")
 
         spdlog::info("Will save rendered image to \"{}\"", outfile);
 
-        auto image = scene->raytrace();
+        // the command line overrides the render settings of the scene file
+        auto settings = scene->render_settings();
+        if (app.count("--spp"))
+            scene->set_sample_count(spp);
+        if (app.count("--pass-spp"))
+            settings.pass_samples = pass_spp;
+        if (app.count("--time-limit"))
+            settings.time_limit = time_limit;
+        if (app.count("--threshold"))
+            settings.threshold = threshold;
+        if (app.count("--checkpoint"))
+            settings.checkpoint_interval = checkpoint_interval;
+        if (app.count("--adaptive"))
+            settings.adaptive_threshold = adaptive_threshold;
+        if (app.count("--min-spp"))
+            settings.min_samples = min_spp;
+        if (app.count("--max-spp"))
+            settings.max_samples = max_spp;
+
+        // intermediate images are written in EXR format, next to the final image
+        string base            = outfile.substr(0, outfile.find_last_of('.'));
+        string checkpoint_file = outfile_hdr.empty() ? base + ".exr" : outfile_hdr;
+        settings.checkpoint    = [&checkpoint_file](const Image3f &image, float spp)
+        {
+            spdlog::info("Writing intermediate image with {:.1f} spp to file \"{}\"...", spp, checkpoint_file);
+            Image3f(image).save(checkpoint_file); // saving needs a mutable image
+        };
+
+        RenderStatistics statistics;
+        auto             image = scene->raytrace(settings, save_statistics ? &statistics : nullptr);
+
+        if (save_statistics)
+        {
+            spdlog::info("Writing pixel statistics to files \"{0}-variance.exr\" and \"{0}-spp.exr\"...", base);
+            statistics.variance.save(base + "-variance.exr");
+            statistics.samples.save(base + "-spp.exr");
+        }
 
         spdlog::info("Writing rendered image to file \"{}\"...", outfile);
 
@@ -9,6 +9,14 @@ class AmbientOcclusionIntegrator : public Integrator
 public:
     AmbientOcclusionIntegrator(const json &j);
     virtual Color3f Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const override;
+
+protected:
+    bool shades_hits() const override
+    {
+        return true;
+    }
+    Color3f Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                   const HitInfo &hit) const override;
 };
 
 AmbientOcclusionIntegrator::AmbientOcclusionIntegrator(const json& j)
@@ -18,16 +26,21 @@ AmbientOcclusionIntegrator::AmbientOcclusionIntegrator(const json& j)
 
 Color3f AmbientOcclusionIntegrator::Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const
 {
-    bool result = false;
     HitInfo hitinfo;
-    if (scene.intersect(ray, hitinfo))
+    bool    found = scene.intersect(ray, hitinfo);
+    return Li_hit(scene, sampler, ray, found, hitinfo);
+}
+
+Color3f AmbientOcclusionIntegrator::Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                                           const HitInfo &hitinfo) const
+{
+    if (found)
     {
         ScatterRecord srec;
         if (hitinfo.mat->sample(ray.d, hitinfo, srec, sampler.next2f(), sampler.next1f()))
         {
             Ray3f shadowray(hitinfo.p, srec.wo);
-            HitInfo shadowhit;
-            if (!scene.intersect(shadowray, shadowhit))
+            if (!scene.occluded(shadowray))
             {
                 return Color3f(1.f, 1.f, 1.f);
             }
@@ -0,0 +1,45 @@
+#include <darts/integrator.h>
+#include <darts/sampler.h>
+#include <darts/scene.h>
+
+void Integrator::Li_packet(const Scene &scene, Sampler *const *samplers, const Ray3f *rays, int count,
+                           Color3f *colors) const
+{
+    if (!shades_hits())
+    {
+        for (int i = 0; i < count; ++i)
+            colors[i] = Li(scene, *samplers[i], rays[i]);
+        return;
+    }
+
+    // copy the rays since the packet traversal shrinks their maxt
+    Ray3f   packet[max_packet_size];
+    HitInfo hits[max_packet_size];
+    for (int first = 0; first < count; first += max_packet_size)
+    {
+        int      n      = std::min(count - first, max_packet_size);
+        uint32_t active = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            packet[i] = rays[first + i];
+            active |= 1u << i;
+        }
+
+        uint32_t found = scene.intersect_packet(packet, active, hits);
+        for (int i = 0; i < n; ++i)
+            colors[first + i] = Li_hit(scene, *samplers[first + i], rays[first + i], found & (1u << i), hits[i]);
+    }
+}
+
+bool Integrator::russian_roulette(Sampler &sampler, Color3f &throughput, int depth) const
+{
+    if (depth < rr_depth)
+        return true;
+
+    float survival = std::min(maxelem(throughput), 0.95f);
+    if (survival <= 0.f || sampler.next1f() >= survival)
+        return false;
+
+    throughput /= survival;
+    return true;
+}
@@ -9,6 +9,14 @@ class NormalsIntegrator : public Integrator
 public:
     NormalsIntegrator(const json &j);
     virtual Color3f Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const override;
+
+protected:
+    bool shades_hits() const override
+    {
+        return true;
+    }
+    Color3f Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                   const HitInfo &hit) const override;
 };
 
 NormalsIntegrator::NormalsIntegrator(const json& j)
@@ -19,7 +27,14 @@ NormalsIntegrator::NormalsIntegrator(const json& j)
 Color3f NormalsIntegrator::Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const
 {
     HitInfo hitinfo;
-    if (scene.intersect(ray, hitinfo))
+    bool    found = scene.intersect(ray, hitinfo);
+    return Li_hit(scene, sampler, ray, found, hitinfo);
+}
+
+Color3f NormalsIntegrator::Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                                  const HitInfo &hitinfo) const
+{
+    if (found)
     {
         auto ret_vec = (hitinfo.sn + Vec3f(1, 1, 1)) / 2.f;
         return Color3f(ret_vec);
@@ -11,7 +11,16 @@ public:
     virtual Color3f Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const override;
 
 protected:
+    bool    shades_hits() const override
+    {
+        return true;
+    }
+    Color3f Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                   const HitInfo &hit) const override;
+
     Color3f ComputeColor(const Scene &scene, Sampler &sampler, const Ray3f &ray, int depth) const;
+    Color3f ShadeHit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found, const HitInfo &hit,
+                     int depth) const;
 
     int max_bounces = 1;
 };
@@ -19,44 +28,53 @@ protected:
 PathTracerMats::PathTracerMats(const json& j)
 {
     max_bounces = j.value("max bounces", max_bounces);
+    rr_depth    = j.value("rr depth", rr_depth);
 }
 
 Color3f PathTracerMats::ComputeColor(const Scene &scene, Sampler &sampler, const Ray3f &ray, int depth) const
 {
     HitInfo hit;
-    if (scene.intersect(ray, hit))
+    bool    found = scene.intersect(ray, hit);
+    return ShadeHit(scene, sampler, ray, found, hit, depth);
+}
+
+Color3f PathTracerMats::ShadeHit(const Scene &scene, Sampler &sampler, const Ray3f &ray_, bool found,
+                                 const HitInfo &hit_, int depth) const
+{
+    // follow the path iteratively, weighting the light found at each vertex by the throughput of the path so far
+    Ray3f   ray = ray_;
+    HitInfo hit = hit_;
+    Color3f radiance(0.f), throughput(1.f);
+    for (;; ++depth)
     {
-        Color3f emitted_color = hit.mat->emitted(ray, hit);
-        ScatterRecord srec;
-        if (depth < max_bounces && hit.mat->sample(ray.d, hit, srec, sampler.next2f(), sampler.next1f()))
+        if (!found)
         {
-            Ray3f scattered(hit.p, srec.wo);
-            auto rec_color = ComputeColor(scene, sampler, scattered, depth + 1);
-
-            Color3f calc_color(0, 0, 0);
-            if (srec.is_specular)
-            {
-                calc_color = srec.attenuation;
-            }
-            else
-            {
-                float pdf = hit.mat->pdf(ray.d, srec.wo, hit);
-                if (pdf > 0)
-                {
-                    calc_color = hit.mat->eval(ray.d, srec.wo, hit) / pdf;
-                }
-            }
-            return emitted_color + calc_color * rec_color;
+            radiance += throughput * scene.background(ray);
+            break;
         }
+
+        radiance += throughput * hit.mat->emitted(ray, hit);
+        ScatterRecord srec;
+        if (depth >= max_bounces || !hit.mat->sample(ray.d, hit, srec, sampler.next2f(), sampler.next1f()))
+            break;
+
+        if (srec.is_specular)
+            throughput *= srec.attenuation;
         else
         {
-            return emitted_color;
+            float pdf = hit.mat->pdf(ray.d, srec.wo, hit);
+            if (pdf <= 0)
+                break;
+            throughput *= hit.mat->eval(ray.d, srec.wo, hit) / pdf;
         }
+
+        if (!russian_roulette(sampler, throughput, depth))
+            break;
+
+        ray   = Ray3f(hit.p, srec.wo);
+        found = scene.intersect(ray, hit);
     }
-    else
-    {
-        return scene.background(ray);
-    }    
+    return radiance;
 }
 
 Color3f PathTracerMats::Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const
@@ -64,4 +82,10 @@ Color3f PathTracerMats::Li(const Scene &scene, Sampler &sampler, const Ray3f &ra
     return ComputeColor(scene, sampler, ray, 0);
 }
 
+Color3f PathTracerMats::Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                               const HitInfo &hit) const
+{
+    return ShadeHit(scene, sampler, ray, found, hit, 0);
+}
+
 DARTS_REGISTER_CLASS_IN_FACTORY(Integrator, PathTracerMats, "path tracer mats")
\ No newline at end of file
@@ -11,7 +11,16 @@ public:
     virtual Color3f Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const override;
 
 protected:
+    bool    shades_hits() const override
+    {
+        return true;
+    }
+    Color3f Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                   const HitInfo &hit) const override;
+
     Color3f ComputeColor(const Scene &scene, Sampler &sampler, const Ray3f &ray, int depth) const;
+    Color3f ShadeHit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found, const HitInfo &hit,
+                     int depth) const;
 
     int max_bounces = 1;
 };
@@ -19,88 +28,85 @@ protected:
 PathTracerMIS::PathTracerMIS(const json& j)
 {
     max_bounces = j.value("max bounces", max_bounces);
+    rr_depth    = j.value("rr depth", rr_depth);
 }
 
 Color3f PathTracerMIS::ComputeColor(const Scene &scene, Sampler &sampler, const Ray3f &ray, int depth) const
 {
-    const float EPSILON = 0.0000001;
-
     HitInfo hit;
-    if (scene.intersect(ray, hit))
+    bool    found = scene.intersect(ray, hit);
+    return ShadeHit(scene, sampler, ray, found, hit, depth);
+}
+
+Color3f PathTracerMIS::ShadeHit(const Scene &scene, Sampler &sampler, const Ray3f &ray_, bool found,
+                                const HitInfo &hit_, int depth) const
+{
+    // follow the path iteratively, weighting the light found at each vertex by the throughput of the path so far
+    Ray3f   ray = ray_;
+    HitInfo hit = hit_;
+    Color3f radiance(0.f), throughput(1.f);
+    for (;; ++depth)
     {
-        Color3f emitted_color = hit.mat->emitted(ray, hit);
+        if (!found)
+        {
+            radiance += throughput * scene.background(ray);
+            break;
+        }
+
+        radiance += throughput * hit.mat->emitted(ray, hit);
         ScatterRecord srec;
         Vec2f rv2 = sampler.next2f();
         float rv = sampler.next1f();
-        if (depth < max_bounces && !hit.mat->is_emissive())
+        if (depth >= max_bounces || hit.mat->is_emissive())
+            break;
+
+        bool material_sample_success = hit.mat->sample(ray.d, hit, srec, rv2, rv);
+        const auto& emitters = scene.emiiters();
+
+        EmitterRecord erec;
+        erec.o = hit.p;
+
+        emitters.sample(erec, rv2, rv);
+
+        bool picked_mat = false;
+        if (sampler.next1f() <= 0.5)
         {
-            bool material_sample_success = hit.mat->sample(ray.d, hit, srec, rv2, rv);
-            const auto& emitters = scene.emiiters();
-
-            EmitterRecord erec;
-            erec.o = hit.p;
-
-            emitters.sample(erec, rv2, rv);
-
-            bool picked_mat = false;
-            if (randf() <= 0.5)
-            {
-                picked_mat = true;
-            }
-            
-            if (!picked_mat)
-            {
-                if (dot(erec.wi, hit.sn) < 0)
-                    return emitted_color;
-            }
-            else
-            {
-                if (!material_sample_success)
-                    return emitted_color;
-            }
-
-            Vec3f scatter_o = hit.p;
-            Vec3f scatter_d;
-
-            if (picked_mat)
-            {
-                scatter_d = srec.wo;
-            }
-            else
-            {
-                scatter_d = erec.wi;
-            }
-
-            float pdf = (erec.emitter->pdf(scatter_o, erec.wi) + hit.mat->pdf(ray.d, srec.wo, hit)) / 2.f;            
-
-            Color3f calc_color(0, 0, 0);
-            if (srec.is_specular)
-            {
-                calc_color = srec.attenuation;
-            }
-            else
-            {
-                if (pdf > 0)
-                {
-                    calc_color = hit.mat->eval(ray.d, scatter_d, hit) / pdf;
-                }
-                else
-                {
-                    return emitted_color;
-                }
-            }
-
-            return emitted_color + calc_color * ComputeColor(scene, sampler, Ray3f(scatter_o, scatter_d), depth + 1);
+            picked_mat = true;
         }
+
+        if (!picked_mat)
+        {
+            if (dot(erec.wi, hit.sn) < 0)
+                break;
+        }
+        else
+        {
+            if (!material_sample_success)
+                break;
+        }
+
+        Vec3f scatter_o = hit.p;
+        Vec3f scatter_d = picked_mat ? srec.wo : erec.wi;
+
+        float pdf =
+            (emitters.emitter_pdf(erec.emitter, scatter_o, erec.wi) + hit.mat->pdf(ray.d, srec.wo, hit)) / 2.f;
+
+        if (srec.is_specular)
+            throughput *= srec.attenuation;
         else
         {
-            return emitted_color;
+            if (pdf <= 0)
+                break;
+            throughput *= hit.mat->eval(ray.d, scatter_d, hit) / pdf;
         }
+
+        if (!russian_roulette(sampler, throughput, depth))
+            break;
+
+        ray   = Ray3f(scatter_o, scatter_d);
+        found = scene.intersect(ray, hit);
     }
-    else
-    {
-        return scene.background(ray);
-    }    
+    return radiance;
 }
 
 Color3f PathTracerMIS::Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const
@@ -108,4 +114,10 @@ Color3f PathTracerMIS::Li(const Scene &scene, Sampler &sampler, const Ray3f &ray
     return ComputeColor(scene, sampler, ray, 0);
 }
 
+Color3f PathTracerMIS::Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                              const HitInfo &hit) const
+{
+    return ShadeHit(scene, sampler, ray, found, hit, 0);
+}
+
 DARTS_REGISTER_CLASS_IN_FACTORY(Integrator, PathTracerMIS, "path tracer mis")
\ No newline at end of file
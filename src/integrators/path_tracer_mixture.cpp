@@ -11,7 +11,16 @@ public:
     virtual Color3f Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const override;
 
 protected:
+    bool    shades_hits() const override
+    {
+        return true;
+    }
+    Color3f Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                   const HitInfo &hit) const override;
+
     Color3f ComputeColor(const Scene &scene, Sampler &sampler, const Ray3f &ray, int depth) const;
+    Color3f ShadeHit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found, const HitInfo &hit,
+                     int depth) const;
 
     int max_bounces = 1;
 };
@@ -19,88 +28,74 @@ protected:
 PathTracerMixture::PathTracerMixture(const json& j)
 {
     max_bounces = j.value("max bounces", max_bounces);
+    rr_depth    = j.value("rr depth", rr_depth);
 }
 
 Color3f PathTracerMixture::ComputeColor(const Scene &scene, Sampler &sampler, const Ray3f &ray, int depth) const
 {
-    const float EPSILON = 0.0000001;
-
     HitInfo hit;
-    if (scene.intersect(ray, hit))
+    bool    found = scene.intersect(ray, hit);
+    return ShadeHit(scene, sampler, ray, found, hit, depth);
+}
+
+Color3f PathTracerMixture::ShadeHit(const Scene &scene, Sampler &sampler, const Ray3f &ray_, bool found,
+                                    const HitInfo &hit_, int depth) const
+{
+    // follow the path iteratively, weighting the light found at each vertex by the throughput of the path so far
+    Ray3f   ray = ray_;
+    HitInfo hit = hit_;
+    Color3f radiance(0.f), throughput(1.f);
+    for (;; ++depth)
     {
-        Color3f emitted_color = hit.mat->emitted(ray, hit);
+        if (!found)
+        {
+            radiance += throughput * scene.background(ray);
+            break;
+        }
+
+        radiance += throughput * hit.mat->emitted(ray, hit);
         ScatterRecord srec;
         Vec2f rv2 = sampler.next2f();
         float rv = sampler.next1f();
-        if (depth < max_bounces && !hit.mat->is_emissive())
-        {
-            bool material_sample_success = hit.mat->sample(ray.d, hit, srec, rv2, rv);
-            const auto& emitters = scene.emiiters();
+        if (depth >= max_bounces || hit.mat->is_emissive())
+            break;
+
+        bool material_sample_success = hit.mat->sample(ray.d, hit, srec, rv2, rv);
+        const auto& emitters = scene.emiiters();
 
-            EmitterRecord erec;
-            erec.o = hit.p;
+        EmitterRecord erec;
+        erec.o = hit.p;
 
-            emitters.sample(erec, rv2, rv);
+        emitters.sample(erec, rv2, rv);
 
-            bool mat_sample = true;
-            bool li_sample = true;
-            if (dot(erec.wi, hit.sn) < 0)
-            {
-                //li_sample = false;
-            }
+        Vec3f scatter_d;
+        if (srec.is_specular)
+        {
             if (!material_sample_success)
-            {
-                mat_sample = false;
-            }
-
-            Color3f calc_color(0, 0, 0);
-            if (srec.is_specular)
-            {
-                calc_color = srec.attenuation;
-            }
-            else
-            {
-                if (mat_sample && li_sample)
-                {
-                    auto mat_color = hit.mat->eval(ray.d, srec.wo, hit) / hit.mat->pdf(ray.d, srec.wo, hit);
-                    mat_color *= ComputeColor(scene, sampler, Ray3f(hit.p, srec.wo), depth + 1);
-
-                    auto li_color = hit.mat->eval(ray.d, erec.wi, hit) / erec.pdf;
-                    li_color *= ComputeColor(scene, sampler, Ray3f(hit.p, erec.wi), depth + 1);
-
-                    calc_color = (mat_color + li_color) / 2.f;
-                }
-                else if (mat_sample)
-                {
-                    auto mat_color = hit.mat->eval(ray.d, srec.wo, hit) / hit.mat->pdf(ray.d, srec.wo, hit);
-                    mat_color *= ComputeColor(scene, sampler, Ray3f(hit.p, srec.wo), depth + 1);
-
-                    calc_color = mat_color;
-                }
-                else if (li_sample)
-                {
-                    auto li_color = hit.mat->eval(ray.d, erec.wi, hit) / erec.pdf;
-                    li_color *= ComputeColor(scene, sampler, Ray3f(hit.p, erec.wi), depth + 1);
-
-                    calc_color = li_color;
-                }
-                else
-                {
-                    return emitted_color;
-                }
-            }
-
-            return emitted_color + calc_color;
+                break;
+            scatter_d = srec.wo;
+            throughput *= srec.attenuation;
         }
         else
         {
-            return emitted_color;
+            // the estimate averages the material and the emitter sample. Instead of tracing both, which would double
+            // the number of paths at every bounce, follow one of them with probability 1/2, which has the same
+            // expected value
+            bool mat_sample = material_sample_success && (sampler.next1f() < 0.5f);
+            scatter_d       = mat_sample ? srec.wo : erec.wi;
+            float pdf       = mat_sample ? hit.mat->pdf(ray.d, srec.wo, hit) : erec.pdf;
+            if (pdf <= 0)
+                break;
+            throughput *= hit.mat->eval(ray.d, scatter_d, hit) / pdf;
         }
+
+        if (!russian_roulette(sampler, throughput, depth))
+            break;
+
+        ray   = Ray3f(hit.p, scatter_d);
+        found = scene.intersect(ray, hit);
     }
-    else
-    {
-        return scene.background(ray);
-    }    
+    return radiance;
 }
 
 Color3f PathTracerMixture::Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const
@@ -108,4 +103,10 @@ Color3f PathTracerMixture::Li(const Scene &scene, Sampler &sampler, const Ray3f
     return ComputeColor(scene, sampler, ray, 0);
 }
 
+Color3f PathTracerMixture::Li_hit(const Scene &scene, Sampler &sampler, const Ray3f &ray, bool found,
+                                  const HitInfo &hit) const
+{
+    return ShadeHit(scene, sampler, ray, found, hit, 0);
+}
+
 DARTS_REGISTER_CLASS_IN_FACTORY(Integrator, PathTracerMixture, "path tracer mixture")
\ No newline at end of file
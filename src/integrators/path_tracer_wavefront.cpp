@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <darts/factory.h>
+#include <darts/integrator.h>
+#include <darts/scene.h>
+#include <darts/ray.h>
+#include <darts/json.h>
+
+STAT_COUNTER("Integrator/Wavefront shadow rays", num_wavefront_shadow_rays);
+STAT_RATIO("Integrator/Wavefront paths per bounce", num_wavefront_paths, num_wavefront_bounces);
+
+namespace
+{
+    /// The paths in flight, stored as one array per field so that every stage only touches the fields it needs
+    struct PathQueue
+    {
+        vector<Ray3f>    rays;
+        vector<HitInfo>  hits;
+        vector<uint8_t>  found;      ///< Whether the ray hit anything
+        vector<Color3f>  throughput; ///< The product of the path's weights so far
+        vector<uint8_t>  specular;   ///< Whether the path's last bounce was specular, so that it counts emitted light
+        vector<uint32_t> lane;       ///< The ray of the packet that the path contributes to
+        uint32_t         size = 0;
+
+        void reserve(uint32_t n)
+        {
+            if (rays.size() >= n)
+                return;
+            rays.resize(n);
+            hits.resize(n);
+            found.resize(n);
+            throughput.resize(n);
+            specular.resize(n);
+            lane.resize(n);
+        }
+    };
+
+    /// The shadow rays of next-event estimation, along with the light they carry if they are unoccluded
+    struct ShadowQueue
+    {
+        vector<Ray3f>    rays;
+        vector<Color3f>  contribution;
+        vector<uint32_t> lane;
+        uint32_t         size = 0;
+
+        void reserve(uint32_t n)
+        {
+            if (rays.size() >= n)
+                return;
+            rays.resize(n);
+            contribution.resize(n);
+            lane.resize(n);
+        }
+    };
+
+    /// The queues of a thread, which are reused by every call of PathTracerWavefront::Li_packet()
+    struct WavefrontQueues
+    {
+        PathQueue        paths, next;
+        ShadowQueue      shadows;
+        vector<uint32_t> order; ///< The paths to shade, sorted by material
+    };
+} // namespace
+
+/**
+    A path tracer with next-event estimation that traces all paths of a packet together, one bounce at a time.
+
+    Instead of following each path depth-first, the integrator keeps the state of all paths in structure-of-arrays
+    queues and runs each stage of a bounce over the whole queue: it finds the closest hits of all rays in ray packets,
+    accumulates the light of paths that hit emitters or escape, sorts the remaining paths by material, shades them in
+    that order while queueing a shadow ray to a sampled emitter and the continuation ray of each path, and finally
+    traces the shadow rays and accumulates the light they carry.
+
+    Since Scene::raytrace() hands it as many pixels as its "queue size" (by default a 32 × 32 tile), the packets stay
+    full and each material is evaluated for large groups of paths in a row.
+
+    Light that paths hit after a non-specular bounce is already accounted for by next-event estimation, so it only
+    counts emitted light seen directly or through specular bounces.
+
+    \ingroup Integrators
+*/
+class PathTracerWavefront : public Integrator
+{
+public:
+    PathTracerWavefront(const json &j);
+    virtual Color3f Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const override;
+    void Li_packet(const Scene &scene, Sampler *const *samplers, const Ray3f *rays, int count,
+                   Color3f *colors) const override;
+
+    int packet_size() const override
+    {
+        return queue_size;
+    }
+
+protected:
+    /// Find the closest hits of all paths in \p queue
+    void intersect(const Scene &scene, PathQueue &queue) const;
+
+    /// Shade path \p i of \p paths at bounce \p depth, queueing its shadow ray in \p shadows and its continuation in
+    /// \p next
+    void shade(const Scene &scene, Sampler &sampler, const PathQueue &paths, uint32_t i, int depth,
+               ShadowQueue &shadows, PathQueue &next) const;
+
+    int max_bounces = 1;
+    int queue_size  = 1024; ///< The most paths traced together, from "queue size"
+};
+
+PathTracerWavefront::PathTracerWavefront(const json &j)
+{
+    max_bounces = j.value("max bounces", max_bounces);
+    rr_depth    = j.value("rr depth", rr_depth);
+    queue_size  = std::max(j.value("queue size", queue_size), 1);
+}
+
+void PathTracerWavefront::intersect(const Scene &scene, PathQueue &queue) const
+{
+    // the packet traversal shrinks the maxt of the rays, which is fine since every bounce creates new rays
+    for (uint32_t first = 0; first < queue.size; first += max_packet_size)
+    {
+        uint32_t n      = std::min(queue.size - first, uint32_t(max_packet_size));
+        uint32_t active = n == uint32_t(max_packet_size) ? ~0u : (1u << n) - 1;
+        uint32_t found  = scene.intersect_packet(&queue.rays[first], active, &queue.hits[first]);
+        for (uint32_t i = 0; i < n; ++i)
+            queue.found[first + i] = (found >> i) & 1;
+    }
+}
+
+void PathTracerWavefront::shade(const Scene &scene, Sampler &sampler, const PathQueue &paths, uint32_t i, int depth,
+                                ShadowQueue &shadows, PathQueue &next) const
+{
+    const Ray3f   &ray = paths.rays[i];
+    const HitInfo &hit = paths.hits[i];
+
+    ScatterRecord srec;
+    Vec2f         rv2 = sampler.next2f();
+    float         rv  = sampler.next1f();
+    if (!hit.mat->sample(ray.d, hit, srec, rv2, rv))
+        return;
+
+    Color3f weight = srec.attenuation;
+    if (!srec.is_specular)
+    {
+        // queue a shadow ray towards a point on an emitter
+        const auto &emitters = scene.emiiters();
+        if (!emitters.empty())
+        {
+            EmitterRecord erec(hit.p);
+            Vec2f         erv2  = sampler.next2f();
+            float         erv   = sampler.next1f();
+            Color3f       light = emitters.sample(erec, erv2, erv);
+            if (erec.emitter && erec.pdf > 0.f)
+            {
+                Color3f contribution = paths.throughput[i] * hit.mat->eval(ray.d, erec.wi, hit) * light;
+                if (maxelem(contribution) > 0.f)
+                {
+                    // stop the shadow ray just short of the emitter, so that it does not hit the emitter itself
+                    float    maxt           = (1.f - Ray3f::epsilon) * erec.hit.t;
+                    uint32_t s              = shadows.size++;
+                    shadows.rays[s]         = Ray3f(hit.p, erec.wi, Ray3f::epsilon, maxt);
+                    shadows.contribution[s] = contribution;
+                    shadows.lane[s]         = paths.lane[i];
+                }
+            }
+        }
+
+        float pdf = hit.mat->pdf(ray.d, srec.wo, hit);
+        if (pdf <= 0.f)
+            return;
+        weight = hit.mat->eval(ray.d, srec.wo, hit) / pdf;
+    }
+
+    Color3f throughput = paths.throughput[i] * weight;
+    if (maxelem(throughput) <= 0.f || !russian_roulette(sampler, throughput, depth))
+        return;
+
+    uint32_t n         = next.size++;
+    next.rays[n]       = Ray3f(hit.p, srec.wo);
+    next.throughput[n] = throughput;
+    next.specular[n]   = srec.is_specular;
+    next.lane[n]       = paths.lane[i];
+}
+
+void PathTracerWavefront::Li_packet(const Scene &scene, Sampler *const *samplers, const Ray3f *rays, int count,
+                                    Color3f *colors) const
+{
+    // every thread keeps its queues, so that they are only allocated once
+    thread_local WavefrontQueues queues;
+    auto                        &paths   = queues.paths;
+    auto                        &next    = queues.next;
+    auto                        &shadows = queues.shadows;
+    auto                        &order   = queues.order;
+    paths.reserve(count);
+    next.reserve(count);
+    shadows.reserve(count);
+    order.reserve(count);
+
+    // generate: start a path for every primary ray
+    for (int i = 0; i < count; ++i)
+    {
+        paths.rays[i]       = rays[i];
+        paths.throughput[i] = Color3f(1.f);
+        paths.specular[i]   = true;
+        paths.lane[i]       = i;
+        colors[i]           = Color3f(0.f);
+    }
+    paths.size = count;
+
+    for (int depth = 0; paths.size > 0; ++depth)
+    {
+        num_wavefront_paths += paths.size;
+        ++num_wavefront_bounces;
+
+        // intersect
+        intersect(scene, paths);
+
+        // accumulate the light of the paths that escape or hit an emitter, and collect the paths that go on
+        order.clear();
+        for (uint32_t i = 0; i < paths.size; ++i)
+        {
+            if (!paths.found[i])
+            {
+                colors[paths.lane[i]] += paths.throughput[i] * scene.background(paths.rays[i]);
+                continue;
+            }
+            const HitInfo &hit = paths.hits[i];
+            if (paths.specular[i])
+                colors[paths.lane[i]] += paths.throughput[i] * hit.mat->emitted(paths.rays[i], hit);
+            if (depth < max_bounces)
+                order.push_back(i);
+        }
+
+        // sort by material, so that each material shades all of its paths in a row
+        std::sort(order.begin(), order.end(),
+                  [&paths](uint32_t a, uint32_t b)
+                  {
+                      const Material *ma = paths.hits[a].mat, *mb = paths.hits[b].mat;
+                      return ma != mb ? std::less<const Material *>()(ma, mb) : a < b;
+                  });
+
+        // shade
+        next.size    = 0;
+        shadows.size = 0;
+        for (uint32_t i : order)
+            shade(scene, *samplers[paths.lane[i]], paths, i, depth, shadows, next);
+
+        // shadow-test, and accumulate the light of the unoccluded shadow rays
+        num_wavefront_shadow_rays += shadows.size;
+        for (uint32_t s = 0; s < shadows.size; ++s)
+            if (!scene.occluded(shadows.rays[s]))
+                colors[shadows.lane[s]] += shadows.contribution[s];
+
+        std::swap(paths, next);
+    }
+}
+
+Color3f PathTracerWavefront::Li(const Scene &scene, Sampler &sampler, const Ray3f &ray) const
+{
+    Sampler *samplers[] = {&sampler};
+    Color3f  color;
+    Li_packet(scene, samplers, &ray, 1, &color);
+    return color;
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Integrator, PathTracerWavefront, "path tracer wavefront")
@@ -67,7 +67,7 @@ bool Dielectric::sample(const Vec3f &wi, const HitInfo &hit, ScatterRecord &srec
     Vec3f refracted;
 
     Vec3f scatter_dir;
-    if (fr > randf() || !refract(wi, sn, refraction_ratio, refracted))
+    if (fr > rv1 || !refract(wi, sn, refraction_ratio, refracted))
     {
         scatter_dir = reflect(normalize(wi), sn);
     }
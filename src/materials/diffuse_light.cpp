@@ -22,6 +22,10 @@ public:
         return true;
     }
 
+    Color3f average_emitted() const override
+    {
+        return emit;
+    }
 
     Color3f emit; ///< The emissive color of the light
 };
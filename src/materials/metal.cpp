@@ -52,7 +52,7 @@ bool Metal::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation,
 bool Metal::sample(const Vec3f &wi, const HitInfo &hit, ScatterRecord &srec, const Vec2f &rv, float rv1) const
 {
     Vec3f reflected = reflect(normalize(wi), hit.sn);
-    srec.wo = reflected + roughness * normalize(random_in_unit_sphere());
+    srec.wo = reflected + roughness * sample_sphere(rv);
     srec.attenuation = albedo->value(wi, hit);
     srec.is_specular = true;
 
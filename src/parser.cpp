@@ -30,6 +30,19 @@ string check_key(const string &key, const string &parent, const json &j)
 STAT_COUNTER("Scene/Materials", num_materials_created);
 STAT_COUNTER("Scene/Surfaces", num_surfaces_created);
 
+RenderSettings::RenderSettings(const json &j)
+{
+    tile_size           = j.value("tile size", tile_size);
+    tile_order          = TileScheduler::parse_order(j.value("tile order", string("hilbert")));
+    pass_samples        = j.value("pass samples", pass_samples);
+    time_limit          = j.value("time limit", time_limit);
+    threshold           = j.value("threshold", threshold);
+    checkpoint_interval = j.value("checkpoint interval", checkpoint_interval);
+    adaptive_threshold  = j.value("adaptive threshold", adaptive_threshold);
+    min_samples         = j.value("min samples", min_samples);
+    max_samples         = j.value("max samples", max_samples);
+}
+
 void Scene::parse(const json &j)
 {
     spdlog::info("Parsing scene ...");
@@ -76,6 +89,12 @@ void Scene::parse(const json &j)
         m_integrator = DartsFactory<Integrator>::create(j["integrator"]);
     }
 
+    //
+    // parse how the image is rendered
+    //
+    if (j.contains("render"))
+        m_render_settings = RenderSettings(j["render"]);
+
     //
     // create the scene-wide acceleration structure so we can put other surfaces into it
     //
@@ -85,6 +104,12 @@ void Scene::parse(const json &j)
         // default to a naive linear accelerator
         m_surfaces = make_shared<SurfaceGroup>(json::object());
 
+    //
+    // create the group that emitters are sampled from, which defaults to picking them in proportion to their power
+    //
+    if (j.contains("light sampler"))
+        m_emitters = DartsFactory<SurfaceGroup>::create(j["light sampler"]);
+
     //
     // parse scene background
     //
@@ -123,8 +148,8 @@ void Scene::parse(const json &j)
 
     // set of all fields we'd expect to see at the top level of a darts scene
     // some of these are not yet supported, but we include them to be future-proof
-    set<string> toplevel_fields{"integrator",  "media",  "materials", "surfaces",
-                                "accelerator", "camera", "sampler",   "background"};
+    set<string> toplevel_fields{"integrator", "media",   "materials",  "surfaces",      "accelerator",
+                                "camera",     "sampler", "background", "light sampler", "render"};
 
     // now loop through all keys in the json file to see if there are any that we don't recognize
     for (auto it = j.begin(); it != j.end(); ++it)
@@ -132,5 +157,6 @@ void Scene::parse(const json &j)
             throw DartsException("Unsupported field '{}' here:\n{}", it.key(), it.value().dump(4));
 
     m_surfaces->build();
+    m_emitters->build();
     spdlog::info("done parsing scene.");
 }
@@ -72,6 +72,14 @@ public:
         m_dim_2D = 0;
     }
 
+    void skip_to_sample(uint32_t index) override
+    {
+        Sampler::skip_to_sample(index);
+
+        // the pattern seeds are drawn from m_rng, so move it to a part of its sequence that earlier passes left unused
+        m_rng.advance(int64_t(index) << 32);
+    }
+
     float next1f() override
     {
         float result = cmj::cmj(m_current_sample, m_sample_count, 1, (int)m_rng.nextUInt(32768)).x;
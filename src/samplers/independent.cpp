@@ -53,6 +53,14 @@ public:
         m_rng.seed(m_base_seed + x, m_base_seed + y);
     }
 
+    void skip_to_sample(uint32_t index) override
+    {
+        Sampler::skip_to_sample(index);
+
+        // jump far ahead in the random sequence, so that no pass reuses the random numbers of an earlier one
+        m_rng.advance(int64_t(index) << 32);
+    }
+
     float next1f() override
     {
         m_current_dimension++;
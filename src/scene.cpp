@@ -4,14 +4,16 @@
     Copyright (c) 2017-2022 by Wojciech Jarosz
 */
 
+#include <atomic>
+#include <chrono>
 #include <darts/scene.h>
 #include <darts/progress.h>
+#include <darts/sampling.h>
 #include <darts/stats.h>
 #include <fstream>
 #include <spdlog/sinks/stdout_sinks.h>
 
 #include <nanothread/nanothread.h>
-#include <map>
 
 namespace dr = drjit;
 
@@ -33,6 +35,12 @@ Scene::~Scene()
 {
 }
 
+void Scene::refit()
+{
+    m_surfaces->refit();
+    m_emitters->refit();
+}
+
 Color3f Scene::background(const Ray3f &ray) const
 {
     return m_background;
@@ -44,6 +52,19 @@ bool Scene::intersect(const Ray3f &ray, HitInfo &hit) const
     return m_surfaces->intersect(ray, hit);
 }
 
+uint32_t Scene::intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const
+{
+    for (uint32_t m = active; m; m &= m - 1)
+        ++g_num_traced_rays;
+    return m_surfaces->intersect_packet(rays, active, hits);
+}
+
+bool Scene::occluded(const Ray3f &ray) const
+{
+    ++g_num_traced_rays;
+    return m_surfaces->occluded(ray);
+}
+
 // compute the color corresponding to a ray by raytracing
 Color3f Scene::recursive_color(const Ray3f &ray, int depth) const
 {
@@ -84,61 +105,223 @@ Color3f Scene::recursive_color(const Ray3f &ray, int depth) const
     // 		return background color (hint: look at background())
 }
 
-namespace
-{
-    const int32_t RAY_TRACE_BLOCK_SIZE = 32;
-}
-
 // raytrace an image
-Image3f Scene::raytrace() const
+Image3f Scene::raytrace(const RenderSettings &settings, RenderStatistics *statistics) const
 {
-    std::map<uint32_t, std::unique_ptr<Sampler>> thread_samplers;
-
     // allocate an image of the proper size
     auto image = Image3f(m_camera->resolution().x, m_camera->resolution().y);
 
-    Progress progress("Rendering", image.length());
+    // render all samples at once, unless progressive rendering splits them into passes
+    uint32_t max_spp  = settings.max_samples ? settings.max_samples : m_sampler->sample_count();
+    uint32_t min_spp  = std::min(std::max(settings.min_samples, 2u), max_spp);
+    uint32_t pass_spp = max_spp;
+    if (settings.progressive())
+        pass_spp = clamp(settings.pass_samples, 1u, max_spp);
+
+    Progress progress("Rendering", int64_t(image.length()) * max_spp);
 
     // Generate a ray for each pixel in the ray image
 #if USE_NANOTHREAD_RAY_TRACING
-    dr::parallel_for(
-        dr::blocked_range<uint32_t>(/* begin = */ 0, /* end = */ image.width() * image.height(), /* block_size = */ RAY_TRACE_BLOCK_SIZE), 
-        [&, this, width = image.width(), height = image.height()](dr::blocked_range<uint32_t> brange)
+    // integrators may trace more pixels together than fit into a single ray packet
+    int           packet_size = m_integrator ? m_integrator->packet_size() : max_packet_size;
+    TileScheduler scheduler(m_camera->resolution(), settings.tile_size, settings.tile_order, packet_size);
+
+    // every worker gets its buffers and one sampler per lane of a packet up front, so rendering allocates nothing. Each
+    // pixel reseeds its sampler with its position, so the result does not depend on which worker renders it
+    struct WorkerState
+    {
+        vector<std::unique_ptr<Sampler>> samplers;
+        vector<Vec2i>                    lane_pixels;
+        vector<uint32_t>                 lane_counts;
+        vector<int>                      active;
+        vector<Sampler *>                active_samplers;
+        vector<Ray3f>                    rays;
+        vector<Color3f>                  colors;
+    };
+    vector<WorkerState> workers(TileScheduler::num_workers());
+    for (auto &worker : workers)
+    {
+        size_t lanes = scheduler.packet_capacity();
+        worker.samplers.resize(lanes);
+        for (auto &sampler : worker.samplers)
         {
-            auto& sampler = thread_samplers[pool_thread_id()];
-            if (!sampler)
-            {
-                sampler = m_sampler->clone();
-            }
-            for (uint32_t r = brange.begin(); r != brange.end(); ++r)
+            sampler = m_sampler->clone();
+            sampler->set_sample_count(max_spp);
+        }
+        worker.lane_pixels.resize(lanes);
+        worker.lane_counts.resize(lanes);
+        worker.active.resize(lanes);
+        worker.active_samplers.resize(lanes);
+        worker.rays.resize(lanes);
+        worker.colors.resize(lanes);
+    }
+
+    // the running mean, the sum of squared deviations from the mean (Welford's algorithm), and the number of samples of
+    // each pixel
+    Image3f          &mean = image;
+    Image3f           m2(image.width(), image.height());
+    Array2d<uint32_t> counts(image.width(), image.height());
+
+    // the variance of the estimate of pixel i, and its standard error relative to the pixel's luminance
+    auto variance = [&](int i)
+    { return counts(i) > 1 ? m2(i) / (float(counts(i)) * float(counts(i) - 1)) : Color3f(0.f); };
+    auto relative_error = [&](int i)
+    { return std::sqrt(std::max(0.f, luminance(variance(i)))) / std::max(luminance(mean(i)), 0.01f); };
+
+    // whether pixel i needs more samples
+    auto needs_samples = [&](int i)
+    {
+        if (counts(i) >= max_spp)
+            return false;
+        if (settings.adaptive_threshold <= 0.f || counts(i) < min_spp)
+            return true;
+        return relative_error(i) > settings.adaptive_threshold;
+    };
+
+    using clock          = std::chrono::steady_clock;
+    auto start           = clock::now();
+    auto last_checkpoint = start;
+    auto seconds_since   = [](clock::time_point t) { return std::chrono::duration<float>(clock::now() - t).count(); };
+
+    std::atomic<int64_t> total_samples(0);
+    auto                 average_spp = [&]() { return float(total_samples) / image.length(); };
+    while (true)
+    {
+        auto                 pass_start = clock::now();
+        std::atomic<int64_t> pass_samples(0);
+
+        scheduler.run(
+            [&, this](uint32_t worker, const Vec2i *pixels, int n)
             {
-                auto y = r / width;
-                auto x = r % width;
+                // find the pixels of the packet that still need samples, and how many they get in this pass
+                auto    &state       = workers[worker];
+                auto    &samplers    = state.samplers;
+                auto    &lane_pixels = state.lane_pixels;
+                auto    &lane_counts = state.lane_counts;
+                int      lanes       = 0;
+                uint32_t most        = 0;
+                int64_t  rendered    = 0;
+                for (int i = 0; i < n; ++i)
+                {
+                    int p = image.index_1d(pixels[i].x, pixels[i].y);
+                    if (!needs_samples(p))
+                        continue;
 
-                sampler->start_pixel(x, y);
+                    lane_pixels[lanes] = pixels[i];
+                    lane_counts[lanes] = std::min(pass_spp, max_spp - counts(p));
+                    most               = std::max(most, lane_counts[lanes]);
+                    samplers[lanes]->seed(pixels[i].x, pixels[i].y);
+                    samplers[lanes]->start_pixel(pixels[i].x, pixels[i].y);
+                    samplers[lanes]->skip_to_sample(counts(p));
+                    ++lanes;
+                }
 
-                Color3f sum_color = Color3f(0.f);
-                for (auto i : range(sampler->sample_count()))
+                // trace the pixels together, one sample of each per packet, so that their coherent primary rays share
+                // the traversal of the scene. Pixels that are done with this pass drop out of the packet
+                auto &active          = state.active;
+                auto &active_samplers = state.active_samplers;
+                auto &rays            = state.rays;
+                auto &colors          = state.colors;
+                for (uint32_t s = 0; s < most; ++s)
                 {
-                    Vec2f cam_ran = sampler->next2f();
-                    auto ray = m_camera->generate_ray(Vec2f(x + 0.5f + cam_ran.x, y + 0.5f + cam_ran.y));
+                    int m = 0;
+                    for (int l = 0; l < lanes; ++l)
+                        if (s < lane_counts[l])
+                        {
+                            Vec2f cam_ran      = samplers[l]->next2f();
+                            rays[m]            = m_camera->generate_ray(Vec2f(lane_pixels[l]) + 0.5f + cam_ran);
+                            active_samplers[m] = samplers[l].get();
+                            active[m++]        = l;
+                        }
+
                     if (m_integrator)
-                    {
-                        sum_color += m_integrator->Li(*this, *sampler.get(), ray);
-                    }
+                        m_integrator->Li_packet(*this, active_samplers.data(), rays.data(), m, colors.data());
                     else
+                        for (int i = 0; i < m; ++i)
+                        {
+                            // the materials' scatter() draws from the global RNG, so reseed it for every sample of
+                            // every pixel to keep the image independent of the thread that renders it
+                            int p = image.index_1d(lane_pixels[active[i]].x, lane_pixels[active[i]].y);
+                            seed_randf((uint64_t(p) << 32) | counts(p), random_seed);
+                            colors[i] = recursive_color(rays[i], 0);
+                        }
+
+                    for (int i = 0; i < m; ++i)
                     {
-                        sum_color += recursive_color(ray, 0);
+                        // each pixel belongs to exactly one packet per pass, so its statistics need no synchronization
+                        int     p     = image.index_1d(lane_pixels[active[i]].x, lane_pixels[active[i]].y);
+                        Color3f delta = colors[i] - mean(p);
+                        counts(p) += 1;
+                        mean(p) += delta / float(counts(p));
+                        m2(p) += delta * (colors[i] - mean(p));
+                        active_samplers[i]->advance();
                     }
-
-                    sampler->advance();
+                    rendered += m;
                 }
+                pass_samples += rendered;
+                progress += rendered;
+            });
+        total_samples += pass_samples;
 
-                image(x, y) = sum_color / sampler->sample_count();
-                ++progress;
+        // a single pass takes all samples unless rendering is progressive, so only check for pixels that need more
+        // samples in between passes, instead of running another pass that renders nothing
+        if (!settings.progressive())
+            break;
+        bool done = true;
+        for (int i = 0; i < image.length() && done; ++i)
+            done = !needs_samples(i);
+        if (done)
+            break;
+
+        // stop early if the next pass would likely exceed the time limit
+        if (settings.time_limit > 0.f && seconds_since(start) + seconds_since(pass_start) > settings.time_limit)
+        {
+            spdlog::info("Stopping after {:.1f} samples per pixel to stay within the time limit.", average_spp());
+            break;
+        }
+
+        // pixels with fewer than min_spp samples have no usable variance estimate yet (with a single sample it is
+        // zero), so only judge convergence once every pixel has at least that many
+        if (settings.threshold > 0.f)
+        {
+            bool   estimated = true;
+            double total     = 0.0;
+            for (int i = 0; i < image.length() && estimated; ++i)
+            {
+                estimated = counts(i) >= min_spp;
+                total += relative_error(i);
+            }
+            float error = float(total / image.length());
+            if (estimated && error < settings.threshold)
+            {
+                spdlog::info("Stopping after {:.1f} samples per pixel, since the relative error {} is below {}.",
+                             average_spp(), error, settings.threshold);
+                break;
             }
         }
-    );
+
+        if (settings.checkpoint && settings.checkpoint_interval > 0.f &&
+            seconds_since(last_checkpoint) >= settings.checkpoint_interval)
+        {
+            settings.checkpoint(image, average_spp());
+            last_checkpoint = clock::now();
+        }
+    }
+
+    if (settings.adaptive_threshold > 0.f)
+        spdlog::info("Adaptive sampling took {:.1f} samples per pixel on average, out of at most {}.", average_spp(),
+                     max_spp);
+
+    if (statistics)
+    {
+        statistics->variance = Image3f(image.width(), image.height());
+        statistics->samples  = Image3f(image.width(), image.height());
+        for (int i = 0; i < image.length(); ++i)
+        {
+            statistics->variance(i) = variance(i);
+            statistics->samples(i)  = Color3f(float(counts(i)));
+        }
+    }
 #else
     for (auto y : range(image.height()))
     {
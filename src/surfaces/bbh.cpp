@@ -4,57 +4,163 @@
     Copyright (c) 2017-2022 by Wojciech Jarosz
 */
 
+#include <darts/bbh.h>
 #include <darts/parallel.h>
 #include <darts/progress.h>
 #include <darts/sampling.h>
 #include <darts/stats.h>
 #include <darts/surface_group.h>
+#include <darts/triangle.h>
+#include <atomic>
 #include <future>
+#include <mutex>
 
 #include <functional>
 
-#include <nanothread/nanothread.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
-#define USE_NANONTHREAD_BUILD_BBH 1
+#include <nanothread/nanothread.h>
 
 namespace dr = drjit;
 
-struct BBHNode;
-
-namespace
-{
-    int g_max_leaf_size = 1;
-
-    int parallel_depth_threshold = 4;
-}
-
 // STAT_MEMORY_COUNTER("Memory/BBH", treeBytes);
 STAT_RATIO("BBH/Surfaces per leaf node", total_surfaces, total_leaf_nodes);
 STAT_COUNTER("BBH/Interior nodes", interior_nodes);
 STAT_COUNTER("BBH/Leaf nodes", leaf_nodes);
 STAT_RATIO("BBH/Nodes visited per ray", bbh_nodes_visited, total_rays);
 
-enum class BBH_SplitMethod : uint8_t
+enum class BBH_Layout : uint8_t
 {
-    SAH,
-    Middle,
-    Equal
+    Tree,  ///< Traverse a pointer tree of BBHNode/BBHLeaf surfaces
+    Linear ///< Traverse the contiguous array of LinearBBHNodes created by the builder
 };
 
 /// An axis-aligned bounding box hierarchy acceleration structure. \ingroup Surfaces
 struct BBH : public SurfaceGroup
 {
-    shared_ptr<BBHNode> root;
-    BBH_SplitMethod split_method    = BBH_SplitMethod::Middle;
-    int max_leaf_size = 1;
+    /// Maximum depth of a BBH that can be traversed using the linear layout
+    static constexpr int max_linear_depth = max_linear_bbh_depth;
+
+    shared_ptr<Surface> root;
+    BBHSettings         settings;
+    BBH_Layout          layout = BBH_Layout::Linear;
+
+    vector<LinearBBHNode>   nodes;            ///< The flattened tree (only used by the linear layout)
+    vector<const Surface *> ordered_surfaces; ///< Leaf surfaces, in the order referenced by #nodes
+    /// Each of #ordered_surfaces that is a Triangle, or null, so traversal can defer their hit information
+    vector<const Triangle *> ordered_triangles;
+    float                   built_cost = 0.f; ///< SAH cost of the tree right after the last full build
 
     BBH(const json &j = json::object());
 
     /// Construct the BBH (must be called before @ref intersect)
     void build() override;
 
+    /**
+        Update the node bounds after the surfaces moved, rebuilding instead if that degraded the tree too much.
+
+        The tree is rebuilt if its SAH cost exceeds BBHSettings::rebuild_threshold times #built_cost. The tree layout
+        is always rebuilt.
+    */
+    void refit() override;
+
+    /// Intersect a ray against all surfaces registered with the Accelerator
+    bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+
+    /// Check whether a ray hits any surface registered with the Accelerator
+    bool occluded(const Ray3f &ray) const override;
+
+    /// Intersect a packet of rays against all surfaces, traversing the linear layout once for the whole packet
+    uint32_t intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const override;
+
+protected:
+    /// Recursively convert the subtree rooted at nodes[\p index] into a pointer tree of BBHNodes and BBHLeafs
+    shared_ptr<Surface> make_tree(uint32_t index, const vector<BBHPrimitive> &prims) const;
+
+    /// Iterative, stack-based traversal of the linear layout
+    bool intersect_linear(const Ray3f &ray, HitInfo &hit) const;
+
+    /// Any-hit traversal of the linear layout
+    bool occluded_linear(const Ray3f &ray) const;
+};
+
+/**
+    A node of the wide BBH layout.
+
+    Stores the bounds of up to \p W children in structure-of-arrays form so that a single SIMD slab test can intersect
+    a ray against all of them at once. Unused lanes hold empty boxes, which never report a hit.
+*/
+template <int W>
+struct alignas(32) WideBBHNode
+{
+    float    lo[3][W];          ///< Per-axis lower bounds of the children's boxes
+    float    hi[3][W];          ///< Per-axis upper bounds of the children's boxes
+    uint32_t offset[W];         ///< Interior child: index in WideBBH::wide_nodes, leaf child: first surface index
+    uint16_t num_primitives[W]; ///< Number of surfaces of a leaf child, 0 for interior children
+    uint8_t  num_children;      ///< Number of used lanes
+};
+
+/**
+    A BBH with 4- or 8-wide nodes. \ingroup Surfaces
+
+    The binary tree is built with any of the usual split methods, and then collapsed by repeatedly opening the child
+    with the largest surface area until each node has \p W children.
+*/
+template <int W>
+struct WideBBH : public BBH
+{
+    static_assert(W == 4 || W == 8, "Only 4- and 8-wide BBHs are supported");
+
+    /// Upper bound on the number of entries on the traversal stack
+    static constexpr int max_wide_stack = max_linear_depth * (W - 1) + 1;
+
+    vector<WideBBHNode<W>> wide_nodes; ///< The collapsed tree (only used by the linear layout)
+
+    WideBBH(const json &j = json::object()) : BBH(j)
+    {
+        // the wide nodes are collapsed from the flattened binary tree
+        if (layout != BBH_Layout::Linear)
+        {
+            spdlog::warn("The {}-wide BBH only supports the \"linear\" layout. Ignoring \"layout\": \"{}\".", W,
+                         j.value("layout", ""));
+            layout = BBH_Layout::Linear;
+        }
+    }
+
+    /// Construct the binary BBH and collapse it into wide nodes
+    void build() override;
+
+    /// Update the bounds of the wide nodes after the surfaces moved, rebuilding if that degraded the tree too much
+    void refit() override;
+
     /// Intersect a ray against all surfaces registered with the Accelerator
     bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+
+    /// Check whether a ray hits any surface registered with the Accelerator
+    bool occluded(const Ray3f &ray) const override;
+
+    /// The wide layout has no packet traversal, so this intersects each ray of the packet separately
+    uint32_t intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const override
+    {
+        return Surface::intersect_packet(rays, active, hits);
+    }
+
+protected:
+    /// Recursively collapse the binary subtree rooted at nodes[\p index], returning the index of the new wide node
+    uint32_t collapse(uint32_t index);
+
+    /**
+        Recursively recompute the bounds of the children of wide_nodes[\p index], returning their union.
+
+        The wide nodes are stored depth first, so the subtree of the node occupies the indices [\p index, \p end).
+        Like #refit_linear_bbh, subtrees with more than \p parallel_cutoff nodes are refit in separate tasks.
+    */
+    Box3f refit_wide(uint32_t index, uint32_t end, uint32_t parallel_cutoff);
+
+    /// SAH cost of the wide tree, the counterpart of #linear_bbh_sah_cost
+    float wide_sah_cost() const;
 };
 
 
@@ -69,6 +175,8 @@ public:
         Ray3f ray          = ray_;
         bool  hit_anything = false;
 
+        ++bbh_nodes_visited;
+
         // This is a linear intersection test that iterates over all primitives
         // within the scene. It's the most naive intersection test and hence very
         // slow if you have many primitives.
@@ -85,6 +193,17 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const Ray3f &ray) const override
+    {
+        ++bbh_nodes_visited;
+
+        for (auto surface : surfaces)
+            if (surface->occluded(ray))
+                return true;
+
+        return false;
+    }
+
     Box3f bounds() const override
     {
         Box3f b;
@@ -103,12 +222,14 @@ struct BBHNode : public Surface
     Box3f               bbox;        ///< The bounding box of this node
     shared_ptr<Surface> left_child;  ///< Pointer to left child
     shared_ptr<Surface> right_child; ///< Pointer to right child
+    int                 split_axis = 0; ///< The axis along which the surfaces were split
 
-    BBHNode(vector<shared_ptr<Surface>> surfaces, Progress &progress, int depth = 0);
+    BBHNode() = default;
 
     ~BBHNode();
 
     bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
 
     Box3f bounds() const override
     {
@@ -116,464 +237,1019 @@ struct BBHNode : public Surface
     }
 };
 
-template<BBH_SplitMethod method>
-struct BBHNode_SplitMethodTemplated : public BBHNode
+BBHNode::~BBHNode()
 {
-    BBHNode_SplitMethodTemplated(vector<shared_ptr<Surface>> surfaces, Progress &progress, int depth = 0);
-};
+}
 
-namespace
+bool BBHNode::intersect(const Ray3f &ray_, HitInfo &hit) const
 {
-    bool surface_compare(const shared_ptr<Surface>& op1, const shared_ptr<Surface>& op2, int axis)
+    ++bbh_nodes_visited;
+    // TODO: Implement BBH intersection, following chapter 2 of the book.
+    if (!bbox.intersect(ray_))
+        return false;
+    
+    Ray3f tray(ray_);
+    bool hit_left = false;
+    bool hit_right = false;
+    if (left_child)
     {
-        return op1->bounds().center()[axis] < op2->bounds().center()[axis];
+        hit_left = left_child->intersect(tray, hit);
     }
-
-    std::function<bool(const shared_ptr<Surface>& op1, const shared_ptr<Surface>& op2)> comparors[] = {
-        std::bind(surface_compare, std::placeholders::_1, std::placeholders::_2, 0), 
-        std::bind(surface_compare, std::placeholders::_1, std::placeholders::_2, 1), 
-        std::bind(surface_compare, std::placeholders::_1, std::placeholders::_2, 2)};
-
-    bool surface_box_compare(const shared_ptr<Surface>& op1, const Box3f& box2, int axis)
+    if (hit_left)
+    {
+        tray.maxt = hit.t;
+    }
+    if (right_child)
     {
-        return op1->bounds().center()[axis] < box2.center()[axis];
+        hit_right = right_child->intersect(tray, hit);
     }
 
-    std::function<bool(const shared_ptr<Surface>& op1, const Box3f& box2)> surface_box_comparors[] = {
-        std::bind(surface_box_compare, std::placeholders::_1, std::placeholders::_2, 0), 
-        std::bind(surface_box_compare, std::placeholders::_1, std::placeholders::_2, 1), 
-        std::bind(surface_box_compare, std::placeholders::_1, std::placeholders::_2, 2)};
+    return hit_left || hit_right;
+}
+
+bool BBHNode::occluded(const Ray3f &ray) const
+{
+    ++bbh_nodes_visited;
+    if (!bbox.intersect(ray))
+        return false;
 
-    template<BBH_SplitMethod method>
-    int choose_bbox_axis(const Box3f& bbox, int depth);
+    return (left_child && left_child->occluded(ray)) || (right_child && right_child->occluded(ray));
+}
 
-    int choose_bbox_max_axis(const Box3f& bbox)
+namespace
+{
+    int choose_bbox_max_axis(const Box3f &bbox)
     {
         Vec3f box_size = bbox.diagonal();
         float max_comp = std::max({box_size.x, box_size.y, box_size.z});
 
         if (max_comp == box_size.x)
-        {
             return 0;
-        }
         else if (max_comp == box_size.y)
-        {
             return 1;
-        }
-        else 
-        {
+        else
             return 2;
-        }
-    }
-
-    int choose_axis_by_depth(int depth)
-    {
-        return depth % 3;
-    }
-
-    template<>
-    int choose_bbox_axis<BBH_SplitMethod::Equal>(const Box3f& bbox, int depth)
-    {
-        return choose_bbox_max_axis(bbox);
     }
 
-    template<>
-    int choose_bbox_axis<BBH_SplitMethod::Middle>(const Box3f& bbox, int depth)
+    /// A node of the temporary tree created by the builder before it is flattened
+    struct BuildNode
     {
-        return choose_bbox_max_axis(bbox);
-    }
-
-    template<>
-    int choose_bbox_axis<BBH_SplitMethod::SAH>(const Box3f& bbox, int depth)
-    {
-        return choose_bbox_max_axis(bbox);
-    }    
-
-    template<BBH_SplitMethod method>
-    void split_nodes(vector<shared_ptr<Surface>>& input_surfaces, const Box3f& bbox, int axis, vector<shared_ptr<Surface>>& left_surfaces, vector<shared_ptr<Surface>>& right_surfaces);
+        Box3f                 bbox;        ///< Bounds of all primitives in this subtree
+        uint32_t              begin, end;  ///< Range of primitives covered by this subtree
+        int                   axis = 0;    ///< Split axis of an interior node
+        unique_ptr<BuildNode> children[2]; ///< Both null for leaves
+    };
 
-    template<>
-    void split_nodes<BBH_SplitMethod::Equal>(vector<shared_ptr<Surface>>& input_surfaces, const Box3f& bbox, int axis, vector<shared_ptr<Surface>>& left_surfaces, vector<shared_ptr<Surface>>& right_surfaces)
-    {
-        auto comp = comparors[axis];
+    /**
+        Builds a BBH for any of the split methods.
 
-        int mid = input_surfaces.size() / 2;
-        std::nth_element(input_surfaces.begin(), input_surfaces.begin() + mid, input_surfaces.end(), comp);
-        left_surfaces.assign(input_surfaces.begin(), input_surfaces.begin() + mid);
-        right_surfaces.assign(input_surfaces.begin() + mid, input_surfaces.end());
-    }
+        The primitive array is partitioned in place as the tree is built, so no per-node lists of primitives are
+        allocated. Subtrees larger than BBHSettings::parallel_build_cutoff are built as separate nanothread tasks.
 
-    template<>
-    void split_nodes<BBH_SplitMethod::Middle>(vector<shared_ptr<Surface>>& input_surfaces, const Box3f& bbox, int axis, vector<shared_ptr<Surface>>& left_surfaces, vector<shared_ptr<Surface>>& right_surfaces)
+        The SAH split bins the centroids along all three axes and evaluates the cost of every bucket boundary with one
+        forward and one backward prefix sweep, so the split search is linear in the number of buckets.
+    */
+    struct BBHBuilder
     {
-        auto comp_o = surface_box_comparors[axis];
-        auto comp = std::bind(comp_o, std::placeholders::_1, std::cref(bbox));
-
-        auto iter_split = std::partition(input_surfaces.begin(), input_surfaces.end(), comp);
-
-        if (iter_split == input_surfaces.begin() || iter_split == input_surfaces.end())
+        static constexpr int max_buckets = BBHSettings::max_buckets;
+
+        vector<BBHPrimitive> &prims;
+        Progress             &progress;
+
+        BBH_SplitMethod split_method;
+        uint32_t        max_leaf_size;
+        int             num_buckets;
+        float           traversal_cost;
+        float           intersection_cost;
+        uint32_t        parallel_cutoff;
+
+        BBHBuilder(vector<BBHPrimitive> &prims, Progress &progress, const BBHSettings &settings) :
+            prims(prims), progress(progress), split_method(settings.split_method),
+            max_leaf_size(clamp(settings.max_leaf_size, 1, int(std::numeric_limits<uint16_t>::max()))),
+            num_buckets(clamp(settings.sah_buckets, 2, max_buckets)), traversal_cost(settings.traversal_cost),
+            intersection_cost(settings.intersection_cost), parallel_cutoff(std::max(settings.parallel_build_cutoff, 2))
         {
-            split_nodes<BBH_SplitMethod::Equal>(input_surfaces, bbox, axis, left_surfaces, right_surfaces);
         }
-        else
+
+        unique_ptr<BuildNode> make_leaf(uint32_t begin, uint32_t end, const Box3f &bbox)
         {
-            left_surfaces.assign(input_surfaces.begin(), iter_split);
-            right_surfaces.assign(iter_split, input_surfaces.end());
+            auto leaf   = make_unique<BuildNode>();
+            leaf->bbox  = bbox;
+            leaf->begin = begin;
+            leaf->end   = end;
+
+            ++leaf_nodes;
+            ++total_leaf_nodes;
+            total_surfaces += end - begin;
+            progress.step(end - begin);
+            return leaf;
         }
-    }
 
-    template<>
-    void split_nodes<BBH_SplitMethod::SAH>(vector<shared_ptr<Surface>>& input_surfaces, const Box3f& bbox, int axis, vector<shared_ptr<Surface>>& left_surfaces, vector<shared_ptr<Surface>>& right_surfaces)
-    {
-        auto comp = comparors[axis];
-
-        int mid = input_surfaces.size() / 2;
-        std::nth_element(input_surfaces.begin(), input_surfaces.begin() + mid, input_surfaces.end(), comp);
-        left_surfaces.assign(input_surfaces.begin(), input_surfaces.begin() + mid);
-        right_surfaces.assign(input_surfaces.begin() + mid, input_surfaces.end());
-    }
+        int bucket_of(const BBHPrimitive &p, const Box3f &centroid_bounds, int axis) const
+        {
+            float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+            int   b      = int(num_buckets * ((p.centroid[axis] - centroid_bounds.min[axis]) / extent));
+            return clamp(b, 0, num_buckets - 1);
+        }
 
-    template<BBH_SplitMethod method>
-    void build_node(const vector<shared_ptr<Surface>>& surfaces, Progress& progress, int depth, shared_ptr<Surface>& out_node)
-    {
-        if (surfaces.size() > 0)
+        /// Partition [begin, end) so that the two halves have an equal number of primitives
+        uint32_t split_equal(uint32_t begin, uint32_t end, int axis)
         {
-            if (surfaces.size() <= g_max_leaf_size)
-            {
-                auto leaf_node      = make_shared<BBHLeaf>();
-                leaf_node->surfaces = surfaces;
-                out_node          = leaf_node;
+            uint32_t mid = begin + (end - begin) / 2;
+            std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+                             [axis](const BBHPrimitive &a, const BBHPrimitive &b)
+                             { return a.centroid[axis] < b.centroid[axis]; });
+            return mid;
+        }
 
-                progress.step(surfaces.size());
-            }
-            else
-            {
-                out_node = make_shared<BBHNode_SplitMethodTemplated<method>>(surfaces, progress, depth + 1);
-            }
+        /// Partition [begin, end) at the center of \p bbox along \p axis
+        uint32_t split_middle(uint32_t begin, uint32_t end, const Box3f &bbox, int axis)
+        {
+            float center = bbox.center()[axis];
+            auto  mid    = std::partition(prims.begin() + begin, prims.begin() + end,
+                                          [axis, center](const BBHPrimitive &p) { return p.centroid[axis] < center; });
+            return uint32_t(mid - prims.begin());
         }
-    }
-}
 
-BBHNode::BBHNode(vector<shared_ptr<Surface>> surfaces, Progress &progress, int depth)
-{
-    // TODO: Implement BBH construction, following chapter 2 of the book.
-    // Hints:
-    //     -- To get a random number in [0, n-1], you can use int(randf()*n)
-    //     -- To sort a list of surfaces based on some sorting criterion, you can use std::sort and lambdas, like so:
-    //
-    //          std::sort(surfaces.begin(), surfaces.end(), [&](const Surface *a, const Surface *b) {
-    //              return isASmallerThanB(a, b);
-    //          });
-    //
-    //     For example, to sort them based on centroid along an axis, you could do
-    //
-    //          return a->bounds().center()[axis] < b->bounds().center()[axis]
-    //
-    //     -- To split a list (in C++: a 'vector') of things into two lists so that the first list has the first
-    //     k elements of the original list, and the other list has the rest of the elements, you can do
-    //          std::vector<Surface*> listA, listB
-    //          listA.insert(listA.end(), originalList.begin(), originalList.begin() + k);
-    //          listB.insert(listB.end(), originalList.begin() + k, originalList.end();
-    //
-    //     -- After construction, you need to compute the bounding box of this BBH node and assign it to bbox
-    //     -- You can get the bounding box of a surface using surf->bounds();
-    //     -- To take the union of two boxes, look at Box2f::enclose()
-}
+        /**
+            Partition [begin, end) at the cheapest SAH bucket boundary over all three axes.
 
+            As in pbrt, nodes with more than #max_leaf_size primitives are always split, falling back to equal halves if
+            binning cannot separate the primitives. Smaller nodes are only split if SAH rates that as cheaper than a
+            leaf; otherwise this returns \p begin. Stores the split axis in \p axis.
+        */
+        uint32_t split_sah(uint32_t begin, uint32_t end, const Box3f &bbox, int &axis)
+        {
+            uint32_t n = end - begin;
 
-BBHNode::~BBHNode()
-{
-}
+            Box3f centroid_bounds;
+            for (uint32_t i = begin; i < end; ++i)
+                centroid_bounds.enclose(prims[i].centroid);
 
-bool BBHNode::intersect(const Ray3f &ray_, HitInfo &hit) const
-{
-    ++bbh_nodes_visited;
-    // TODO: Implement BBH intersection, following chapter 2 of the book.
-    if (!bbox.intersect(ray_))
-        return false;
-    
-    Ray3f tray(ray_);
-    bool hit_left = false;
-    bool hit_right = false;
-    if (left_child)
-    {
-        hit_left = left_child->intersect(tray, hit);
-    }
-    if (hit_left)
-    {
-        tray.maxt = hit.t;
-    }
-    if (right_child)
-    {
-        hit_right = right_child->intersect(tray, hit);
-    }
+            float best_cost   = std::numeric_limits<float>::infinity();
+            int   best_axis   = -1;
+            int   best_bucket = -1;
+            for (int a = 0; a < 3; ++a)
+            {
+                if (centroid_bounds.max[a] <= centroid_bounds.min[a])
+                    continue;
 
-    return hit_left || hit_right;
-}
+                int   counts[max_buckets] = {};
+                Box3f boxes[max_buckets];
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    int b = bucket_of(prims[i], centroid_bounds, a);
+                    counts[b]++;
+                    boxes[b].enclose(prims[i].bbox);
+                }
 
-template <BBH_SplitMethod method>
-BBHNode_SplitMethodTemplated<method>::BBHNode_SplitMethodTemplated(vector<shared_ptr<Surface>> surfaces,
-                                                                   Progress &progress, int depth)
-    : BBHNode(surfaces, progress, depth)
-{
-    if (surfaces.size() == 0)
-        return;
+                // forward sweep: cost contribution of everything left of (and including) each boundary bucket
+                float left_cost[max_buckets];
+                Box3f left_box;
+                int   left_count = 0;
+                for (int b = 0; b < num_buckets - 1; ++b)
+                {
+                    left_box.enclose(boxes[b]);
+                    left_count += counts[b];
+                    left_cost[b] = left_count ? left_count * left_box.area() : 0.f;
+                }
 
-    if (surfaces.size() > 0)
-    {
-        bbox = surfaces[0]->bounds();
+                // backward sweep: add the contribution of everything right of each boundary
+                Box3f right_box;
+                int   right_count = 0;
+                for (int b = num_buckets - 1; b > 0; --b)
+                {
+                    right_box.enclose(boxes[b]);
+                    right_count += counts[b];
+                    float cost = left_cost[b - 1] + (right_count ? right_count * right_box.area() : 0.f);
+                    if (cost < best_cost)
+                    {
+                        best_cost   = cost;
+                        best_axis   = a;
+                        best_bucket = b - 1;
+                    }
+                }
+            }
 
-        for (uint32_t i = 1; i < surfaces.size(); ++i)
-        {
-            bbox.enclose(surfaces[i]->bounds());
-        }
-    }
+            if (best_axis < 0)
+            {
+                // all centroids coincide, so binning cannot separate them
+                axis = choose_bbox_max_axis(bbox);
+                return n <= max_leaf_size ? begin : split_equal(begin, end, axis);
+            }
 
-    int axis = choose_bbox_axis<method>(bbox, depth);
-    auto comp = comparors[axis];
+            axis = best_axis;
 
-    vector<shared_ptr<Surface>> left_surfaces;
-    vector<shared_ptr<Surface>> right_surfaces;
+            // best_cost holds the area-weighted primitive counts; normalize by the parent's area
+            float area       = bbox.area();
+            float split_cost = traversal_cost + intersection_cost * (area > 0.f ? best_cost / area : float(n));
+            if (n <= max_leaf_size && intersection_cost * n <= split_cost)
+                return begin;
 
-    if (surfaces.size() == 1)
-    {
-        left_surfaces = surfaces;
-    }
-    else if (surfaces.size() == 2)
-    {
-        if (comp(surfaces[0], surfaces[1]))
-        {
-            left_surfaces.push_back(surfaces[0]);
-            right_surfaces.push_back(surfaces[1]);
+            auto mid = std::partition(prims.begin() + begin, prims.begin() + end,
+                                      [&](const BBHPrimitive &p)
+                                      { return bucket_of(p, centroid_bounds, best_axis) <= best_bucket; });
+            return uint32_t(mid - prims.begin());
         }
-        else
+
+        unique_ptr<BuildNode> build(uint32_t begin, uint32_t end)
         {
-            left_surfaces.push_back(surfaces[1]);
-            right_surfaces.push_back(surfaces[0]);
-        }
-    }
-    else
-    {
-        split_nodes<method>(surfaces, bbox, axis, left_surfaces, right_surfaces);
-    }
+            uint32_t n = end - begin;
 
-    auto build_left = std::bind(build_node<method>, std::cref(left_surfaces), std::ref(progress), depth, std::ref(left_child));
-    auto build_right = std::bind(build_node<method>, std::cref(right_surfaces), std::ref(progress), depth, std::ref(right_child));
+            Box3f bbox;
+            for (uint32_t i = begin; i < end; ++i)
+                bbox.enclose(prims[i].bbox);
 
-    decltype(build_left) build_funcs[] = {build_left, build_right};
+            // only SAH may split nodes that are small enough to be leaves
+            if (n == 1 || (n <= max_leaf_size && split_method != BBH_SplitMethod::SAH))
+                return make_leaf(begin, end, bbox);
 
-#if USE_NANONTHREAD_BUILD_BBH
-    if (depth < parallel_depth_threshold || depth % 2 == 0)
-    {
-        dr::parallel_for(dr::blocked_range<uint32_t>(0, 2, 1),
-                         [build_funcs](dr::blocked_range<uint32_t> range)
-                         {
-                             for (uint32_t i = range.begin(); i != range.end(); ++i)
-                             {
-                                 build_funcs[i]();
-                             }
-                         });
-    }
-    else
-    {
-        build_funcs[0]();
-        build_funcs[1]();
-    }
-#else
-    build_funcs[0]();
-    build_funcs[1]();
-#endif
-}
+            int      axis = choose_bbox_max_axis(bbox);
+            uint32_t mid;
+            if (split_method == BBH_SplitMethod::SAH)
+            {
+                mid = split_sah(begin, end, bbox, axis);
+                if (mid == begin && n <= max_leaf_size)
+                    return make_leaf(begin, end, bbox);
+            }
+            else if (split_method == BBH_SplitMethod::Middle)
+                mid = split_middle(begin, end, bbox, axis);
+            else
+                mid = split_equal(begin, end, axis);
 
-template<>
-BBHNode_SplitMethodTemplated<BBH_SplitMethod::SAH>::BBHNode_SplitMethodTemplated(vector<shared_ptr<Surface>> surfaces,
-                                                                   Progress &progress, int depth)
-    : BBHNode(surfaces, progress, depth)
-{
-    if (surfaces.size() == 0)
-        return;
+            if (mid == begin || mid == end)
+                mid = split_equal(begin, end, axis);
 
-    if (surfaces.size() > 0)
-    {
-        bbox = surfaces[0]->bounds();
+            auto node   = make_unique<BuildNode>();
+            node->bbox  = bbox;
+            node->begin = begin;
+            node->end   = end;
+            node->axis  = axis;
+            ++interior_nodes;
 
-        for (uint32_t i = 1; i < surfaces.size(); ++i)
-        {
-            bbox.enclose(surfaces[i]->bounds());
+            if (n >= parallel_cutoff)
+            {
+                // build the left subtree in a separate task while this thread builds the right one
+                Task *left        = do_async([&] { node->children[0] = build(begin, mid); });
+                node->children[1] = build(mid, end);
+                task_wait_and_release(left);
+            }
+            else
+            {
+                node->children[0] = build(begin, mid);
+                node->children[1] = build(mid, end);
+            }
+            return node;
         }
-    }
+    };
 
-    int axis = choose_bbox_axis<BBH_SplitMethod::SAH>(bbox, depth);
-    auto comp = comparors[axis];
+    /// Surface area of \p b, or 0 if it is empty
+    float sah_area(const Box3f &b)
+    {
+        return b.is_empty() ? 0.f : b.area();
+    }
 
-    vector<shared_ptr<Surface>> left_surfaces;
-    vector<shared_ptr<Surface>> right_surfaces;
+    /**
+        Builds a spatial split BBH (SBVH) following Stich et al. [2009].
 
-    bool all_leaf_children = false;
+        Each node evaluates a binned SAH object split like #BBHBuilder, and if the children of that split overlap, also
+        a binned spatial split: the node's box is cut into equal bins along each axis, and every reference is clipped
+        into each bin it straddles. A reference that straddles the chosen plane is either duplicated into both
+        children, with its bounds clipped to each side, or kept whole in just one child if that is cheaper. The total
+        number of duplicates is limited by BBHSettings::sbvh_duplication.
 
-    if (surfaces.size() == 1)
+        Since references are duplicated, each node owns its list of references instead of a range of one shared array,
+        and leaves append their references to the output array as they are created.
+    */
+    struct SBVHBuilder
     {
-        left_surfaces = surfaces;
-        all_leaf_children = true;
-    }
-    else if (surfaces.size() == 2)
-    {
-        if (comp(surfaces[0], surfaces[1]))
-        {
-            left_surfaces.push_back(surfaces[0]);
-            right_surfaces.push_back(surfaces[1]);
-        }
-        else
-        {
-            left_surfaces.push_back(surfaces[1]);
-            right_surfaces.push_back(surfaces[0]);
-        }
+        static constexpr int max_buckets = BBHSettings::max_buckets;
 
-        all_leaf_children = true;
-    }
-    else if (surfaces.size() <= 4)
-    {
-        split_nodes<BBH_SplitMethod::Equal>(surfaces, bbox, axis, left_surfaces, right_surfaces);
-    }
-    else
-    {
-        const int num_buckets = 12;
-        struct BucketInfo
+        /// Deeper nodes only use object splits, so that the tree stays traversable with the fixed-size linear stack
+        static constexpr int max_spatial_split_depth = max_linear_bbh_depth - 16;
+
+        struct ObjectSplit
         {
-            int count = 0;
-            Box3f bbox;
+            float cost = std::numeric_limits<float>::infinity();
+            int   axis = -1;
+            int   bucket;
+            Box3f centroid_bounds;
+            Box3f left, right; ///< Bounds of the two children
         };
 
-        BucketInfo buckets[num_buckets];
+        struct SpatialSplit
+        {
+            float cost = std::numeric_limits<float>::infinity();
+            int   axis = -1;
+            float pos;
+        };
 
-        for (uint32_t i = 0; i < surfaces.size(); ++i)
+        vector<BBHPrimitive> &out;
+        Progress             &progress;
+        const BBHSplitFunc   &split;
+
+        uint32_t max_leaf_size;
+        int      num_buckets;
+        float    traversal_cost;
+        float    intersection_cost;
+        uint32_t parallel_cutoff;
+        float    min_overlap; ///< Smallest overlap area of an object split that triggers the spatial split search
+
+        std::atomic<int64_t> duplicates_left; ///< Remaining duplication budget
+        std::atomic<int64_t> spatial_splits{0};
+        std::mutex           out_mutex;
+
+        SBVHBuilder(vector<BBHPrimitive> &out, Progress &progress, const BBHSettings &settings,
+                    const BBHSplitFunc &split, uint32_t num_prims, const Box3f &root_bbox) :
+            out(out), progress(progress), split(split),
+            max_leaf_size(clamp(settings.max_leaf_size, 1, int(std::numeric_limits<uint16_t>::max()))),
+            num_buckets(clamp(settings.sah_buckets, 2, max_buckets)), traversal_cost(settings.traversal_cost),
+            intersection_cost(settings.intersection_cost), parallel_cutoff(std::max(settings.parallel_build_cutoff, 2)),
+            min_overlap(settings.sbvh_overlap * sah_area(root_bbox)),
+            duplicates_left(int64_t(std::max(settings.sbvh_duplication, 0.f) * num_prims))
         {
-            int b_i = (int)(num_buckets *
-                bbox.offset(surfaces[i]->bounds().center())[axis]);
-            if (b_i >= num_buckets)
-                b_i = num_buckets - 1;
-            buckets[b_i].count++;
-            buckets[b_i].bbox.enclose(surfaces[i]->bounds());
         }
 
-        float cost[num_buckets - 1];
-        for (int i = 0; i < num_buckets - 1; ++i)
+        unique_ptr<BuildNode> make_leaf(const vector<BBHPrimitive> &refs, const Box3f &bbox)
         {
-            Box3f bbox0, bbox1;
-            int count0 = 0, count1 = 0;
-            for (int j = 0; j <= i; ++j)
+            auto leaf  = make_unique<BuildNode>();
+            leaf->bbox = bbox;
             {
-                bbox0.enclose(buckets[j].bbox);
-                count0 += buckets[j].count;
+                std::lock_guard<std::mutex> lock(out_mutex);
+                leaf->begin = uint32_t(out.size());
+                out.insert(out.end(), refs.begin(), refs.end());
+                leaf->end = uint32_t(out.size());
             }
 
-            for (int j = i + 1; j < num_buckets; ++j)
-            {
-                bbox1.enclose(buckets[j].bbox);
-                count1 += buckets[j].count;
-            }
+            ++leaf_nodes;
+            ++total_leaf_nodes;
+            total_surfaces += refs.size();
+            progress.step(refs.size());
+            return leaf;
+        }
 
-            cost[i] = .125f + 
-                (count0 * bbox0.area() + count1 * bbox1.area()) / bbox.area();
+        /// Split \p ref by the plane \p axis = \p pos. Either side is empty if no part of the primitive lies there.
+        void split_reference(const BBHPrimitive &ref, int axis, float pos, BBHPrimitive &left,
+                             BBHPrimitive &right) const
+        {
+            left = right = ref;
+            if (split)
+                split(ref.index, ref.bbox, axis, pos, left.bbox, right.bbox);
+            else
+                left.bbox.max[axis] = right.bbox.min[axis] = pos;
+            left.centroid  = left.bbox.center();
+            right.centroid = right.bbox.center();
         }
 
-        float min_cost = cost[0];
-        int min_cost_split_bucket = 0;
-        for (int i = 1; i < num_buckets - 1; ++i)
+        int bucket_of(const BBHPrimitive &p, const Box3f &centroid_bounds, int axis) const
         {
-            if (cost[i] < min_cost)
-            {
-                min_cost = cost[i];
-                min_cost_split_bucket = i;
-            }
+            float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+            int   b      = int(num_buckets * ((p.centroid[axis] - centroid_bounds.min[axis]) / extent));
+            return clamp(b, 0, num_buckets - 1);
         }
 
-        float leaf_cost = surfaces.size();
-        if (surfaces.size() > g_max_leaf_size || min_cost < leaf_cost)
+        /// Find the cheapest SAH bucket boundary of the centroids over all three axes
+        ObjectSplit find_object_split(const vector<BBHPrimitive> &refs) const
         {
-            auto mid_iter = std::partition(surfaces.begin(), surfaces.end(),
-                [=, bbox = this->bbox](const shared_ptr<Surface>& surface)
+            ObjectSplit best;
+            for (auto &r : refs)
+                best.centroid_bounds.enclose(r.centroid);
+
+            for (int a = 0; a < 3; ++a)
+            {
+                if (best.centroid_bounds.max[a] <= best.centroid_bounds.min[a])
+                    continue;
+
+                int   counts[max_buckets] = {};
+                Box3f boxes[max_buckets];
+                for (auto &r : refs)
                 {
-                    int b_i = (int)(num_buckets * bbox.offset(surface->bounds().center())[axis]);
-                    if (b_i >= num_buckets)
-                        b_i = num_buckets - 1;
+                    int b = bucket_of(r, best.centroid_bounds, a);
+                    counts[b]++;
+                    boxes[b].enclose(r.bbox);
+                }
 
-                    return b_i <= min_cost_split_bucket;
+                float left_cost[max_buckets];
+                Box3f left_boxes[max_buckets];
+                Box3f left_box;
+                int   left_count = 0;
+                for (int b = 0; b < num_buckets - 1; ++b)
+                {
+                    left_box.enclose(boxes[b]);
+                    left_count += counts[b];
+                    left_cost[b]  = left_count * sah_area(left_box);
+                    left_boxes[b] = left_box;
                 }
-            );
 
-            if (mid_iter == surfaces.begin() || mid_iter == surfaces.end())
-            {
-                split_nodes<BBH_SplitMethod::Middle>(surfaces, bbox, axis, left_surfaces, right_surfaces);
-            }
-            else
-            {
-                left_surfaces.assign(surfaces.begin(), mid_iter);
-                right_surfaces.assign(mid_iter, surfaces.end());
+                Box3f right_box;
+                int   right_count = 0;
+                for (int b = num_buckets - 1; b > 0; --b)
+                {
+                    right_box.enclose(boxes[b]);
+                    right_count += counts[b];
+                    float cost = left_cost[b - 1] + right_count * sah_area(right_box);
+                    if (cost < best.cost)
+                    {
+                        best.cost   = cost;
+                        best.axis   = a;
+                        best.bucket = b - 1;
+                        best.left   = left_boxes[b - 1];
+                        best.right  = right_box;
+                    }
+                }
             }
+            return best;
         }
-        else
-        {
-            left_surfaces = surfaces;
-            all_leaf_children = true;
-        }
-    }
 
-    auto create_node_func = [](const vector<shared_ptr<Surface>>& surfaces, Progress& progress, int depth, bool force_leaf_node, shared_ptr<Surface>& out_node)
-    {
-        if (surfaces.size() > 0)
+        /**
+            Find the cheapest spatial split over equally sized bins of \p bbox along all three axes.
+
+            Each reference is counted as entering the bin of its lower bound and exiting the bin of its upper bound, and
+            contributes its clipped bounds to every bin in between.
+        */
+        SpatialSplit find_spatial_split(const vector<BBHPrimitive> &refs, const Box3f &bbox) const
         {
-            if (surfaces.size() <= g_max_leaf_size || force_leaf_node)
+            SpatialSplit best;
+            for (int a = 0; a < 3; ++a)
             {
-                auto leaf_node      = make_shared<BBHLeaf>();
-                leaf_node->surfaces = surfaces;
-                out_node          = leaf_node;
+                float lo     = bbox.min[a];
+                float extent = bbox.max[a] - lo;
+                if (!(extent > 0.f))
+                    continue;
 
-                progress.step(surfaces.size());
+                auto bin = [&](float x) { return clamp(int(num_buckets * ((x - lo) / extent)), 0, num_buckets - 1); };
+                auto pos = [&](int b) { return lo + extent * float(b) / float(num_buckets); };
+
+                int   entries[max_buckets] = {}, exits[max_buckets] = {};
+                Box3f boxes[max_buckets];
+                for (auto &ref : refs)
+                {
+                    int first = bin(ref.bbox.min[a]);
+                    int last  = bin(ref.bbox.max[a]);
+                    ++entries[first];
+                    ++exits[last];
+
+                    BBHPrimitive rest = ref, left, right;
+                    for (int b = first; b < last; ++b)
+                    {
+                        split_reference(rest, a, pos(b + 1), left, right);
+                        boxes[b].enclose(left.bbox);
+                        rest = right;
+                    }
+                    boxes[last].enclose(rest.bbox);
+                }
+
+                float left_cost[max_buckets];
+                Box3f left_box;
+                int   left_count = 0;
+                for (int b = 0; b < num_buckets - 1; ++b)
+                {
+                    left_box.enclose(boxes[b]);
+                    left_count += entries[b];
+                    left_cost[b] = left_count * sah_area(left_box);
+                }
+
+                Box3f right_box;
+                int   right_count = 0;
+                for (int b = num_buckets - 1; b > 0; --b)
+                {
+                    right_box.enclose(boxes[b]);
+                    right_count += exits[b];
+                    float cost = left_cost[b - 1] + right_count * sah_area(right_box);
+                    if (cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.axis = a;
+                        best.pos  = pos(b);
+                    }
+                }
+            }
+            return best;
+        }
+
+        /**
+            Distribute \p refs to the two sides of a spatial split.
+
+            A straddling reference is duplicated only if that is cheaper than moving it whole into either child, and
+            only while the duplication budget lasts.
+        */
+        void partition_spatial(const vector<BBHPrimitive> &refs, const SpatialSplit &s, vector<BBHPrimitive> &left,
+                               vector<BBHPrimitive> &right)
+        {
+            Box3f                left_box, right_box;
+            vector<BBHPrimitive> straddling;
+            for (auto &r : refs)
+            {
+                if (r.bbox.max[s.axis] <= s.pos)
+                {
+                    left.push_back(r);
+                    left_box.enclose(r.bbox);
+                }
+                else if (r.bbox.min[s.axis] >= s.pos)
+                {
+                    right.push_back(r);
+                    right_box.enclose(r.bbox);
+                }
+                else
+                    straddling.push_back(r);
+            }
+
+            for (auto &r : straddling)
+            {
+                BBHPrimitive l, rr;
+                split_reference(r, s.axis, s.pos, l, rr);
+
+                // the primitive itself may lie on just one side of the plane, even if its bounding box does not
+                if (l.bbox.is_empty() || rr.bbox.is_empty())
+                {
+                    auto &side = l.bbox.is_empty() ? rr : l;
+                    (l.bbox.is_empty() ? right : left).push_back(side);
+                    (l.bbox.is_empty() ? right_box : left_box).enclose(side.bbox);
+                    continue;
+                }
+
+                float nl = float(left.size()), nr = float(right.size());
+                Box3f left_with = left_box, right_with = right_box, left_split = left_box, right_split = right_box;
+                left_with.enclose(r.bbox);
+                right_with.enclose(r.bbox);
+                left_split.enclose(l.bbox);
+                right_split.enclose(rr.bbox);
+
+                float split_cost = sah_area(left_split) * (nl + 1) + sah_area(right_split) * (nr + 1);
+                float left_cost  = sah_area(left_with) * (nl + 1) + sah_area(right_box) * nr;
+                float right_cost = sah_area(left_box) * nl + sah_area(right_with) * (nr + 1);
+
+                if (split_cost < std::min(left_cost, right_cost) && duplicates_left.fetch_sub(1) > 0)
+                {
+                    left.push_back(l);
+                    right.push_back(rr);
+                    left_box = left_split;
+                    right_box = right_split;
+                }
+                else if (left_cost <= right_cost)
+                {
+                    left.push_back(r);
+                    left_box = left_with;
+                }
+                else
+                {
+                    right.push_back(r);
+                    right_box = right_with;
+                }
+            }
+        }
+
+        unique_ptr<BuildNode> build(vector<BBHPrimitive> refs, int depth)
+        {
+            uint32_t n = uint32_t(refs.size());
+
+            Box3f bbox;
+            for (auto &r : refs)
+                bbox.enclose(r.bbox);
+
+            if (n == 1)
+                return make_leaf(refs, bbox);
+
+            ObjectSplit  object = find_object_split(refs);
+            SpatialSplit spatial;
+            if (depth < max_spatial_split_depth && duplicates_left > 0)
+            {
+                Box3f overlap(la::max(object.left.min, object.right.min), la::min(object.left.max, object.right.max));
+                if (object.axis < 0 || sah_area(overlap) > min_overlap)
+                    spatial = find_spatial_split(refs, bbox);
+            }
+
+            // like the object-split builder, nodes above the leaf size are always split, so that leaves never exceed
+            // max_leaf_size, while smaller nodes become leaves unless SAH rates a split as cheaper. The best cost holds
+            // the area-weighted reference counts; normalize by the parent's area
+            if (n <= max_leaf_size)
+            {
+                float best_cost  = std::min(object.cost, spatial.cost);
+                float area       = sah_area(bbox);
+                float split_cost = traversal_cost +
+                                   intersection_cost * (area > 0.f && std::isfinite(best_cost) ? best_cost / area : n);
+                if (intersection_cost * n <= split_cost)
+                    return make_leaf(refs, bbox);
+            }
+
+            vector<BBHPrimitive> left, right;
+            int                  axis = choose_bbox_max_axis(bbox);
+            if (spatial.cost < object.cost)
+            {
+                partition_spatial(refs, spatial, left, right);
+                axis = spatial.axis;
+
+                // a split that keeps every reference on both sides would never terminate
+                if (left.empty() || right.empty() || (left.size() == n && right.size() == n))
+                {
+                    left.clear();
+                    right.clear();
+                }
+                else
+                    ++spatial_splits;
+            }
+
+            if (left.empty() && object.axis >= 0)
+            {
+                axis = object.axis;
+                for (auto &r : refs)
+                    (bucket_of(r, object.centroid_bounds, object.axis) <= object.bucket ? left : right).push_back(r);
+            }
+
+            if (left.empty() || right.empty())
+            {
+                // binning cannot separate the references, so split them into equal halves
+                left.clear();
+                right.clear();
+                auto mid = refs.begin() + n / 2;
+                std::nth_element(refs.begin(), mid, refs.end(), [axis](const BBHPrimitive &a, const BBHPrimitive &b)
+                                 { return a.centroid[axis] < b.centroid[axis]; });
+                left.assign(refs.begin(), mid);
+                right.assign(mid, refs.end());
+            }
+
+            // the children own their references now
+            refs = vector<BBHPrimitive>();
+
+            auto node  = make_unique<BuildNode>();
+            node->bbox = bbox;
+            node->axis = axis;
+            ++interior_nodes;
+
+            if (n >= parallel_cutoff)
+            {
+                // build the left subtree in a separate task while this thread builds the right one
+                Task *task = do_async([&] { node->children[0] = build(std::move(left), depth + 1); });
+                node->children[1] = build(std::move(right), depth + 1);
+                task_wait_and_release(task);
             }
             else
             {
-                out_node = make_shared<BBHNode_SplitMethodTemplated<BBH_SplitMethod::SAH>>(surfaces, progress, depth + 1);
+                node->children[0] = build(std::move(left), depth + 1);
+                node->children[1] = build(std::move(right), depth + 1);
             }
+            return node;
         }
     };
 
-    auto create_node_left = std::bind(create_node_func, std::cref(left_surfaces), std::ref(progress), depth, all_leaf_children, std::ref(left_child));
-    auto create_node_right = std::bind(create_node_func, std::cref(right_surfaces), std::ref(progress), depth, all_leaf_children, std::ref(right_child));
+    /// Spread the lowest 21 bits of \p x so that two zero bits separate each of them
+    uint64_t spread_bits(uint64_t x)
+    {
+        x &= 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffull;
+        x = (x | x << 16) & 0x1f0000ff0000ffull;
+        x = (x | x << 8) & 0x100f00f00f00f00full;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+        x = (x | x << 2) & 0x1249249249249249ull;
+        return x;
+    }
 
-    decltype(create_node_left) build_funcs[] = {create_node_left, create_node_right};
+    /// A primitive's Morton code and its position in the unsorted primitive array
+    struct MortonPrimitive
+    {
+        uint64_t code;
+        uint32_t index;
+    };
+
+    /**
+        Stable parallel LSD radix sort of \p v by the lowest \p key_bits bits of their Morton codes.
 
-#if USE_NANONTHREAD_BUILD_BBH
-    if (depth % 2 == 0)
+        Each pass splits the array into blocks that count their 8-bit digits in parallel. An exclusive scan over the
+        counts in digit-major order then gives every block its own output range for each digit, so the blocks can also
+        scatter in parallel.
+    */
+    void radix_sort(vector<MortonPrimitive> &v, int key_bits)
     {
-        dr::parallel_for(dr::blocked_range<uint32_t>(0, 2, 1),
-                         [build_funcs](dr::blocked_range<uint32_t> range)
+        constexpr int bits_per_pass = 8;
+        constexpr int num_digits    = 1 << bits_per_pass;
+
+        uint32_t n          = uint32_t(v.size());
+        uint32_t num_blocks = clamp(n / 65536u, 1u, uint32_t(4 * pool_size()));
+        uint32_t block_size = (n + num_blocks - 1) / num_blocks;
+
+        vector<MortonPrimitive> tmp(n);
+        vector<uint32_t>        offsets(num_blocks * num_digits);
+        for (int shift = 0; shift < key_bits; shift += bits_per_pass)
+        {
+            auto digit = [shift](const MortonPrimitive &p) { return uint32_t(p.code >> shift) & (num_digits - 1); };
+
+            std::fill(offsets.begin(), offsets.end(), 0u);
+            parallel_for(blocked_range<uint32_t>(0, num_blocks, 1),
+                         [&](blocked_range<uint32_t> range)
+                         {
+                             for (uint32_t b = range.begin(); b != range.end(); ++b)
+                                 for (uint32_t i = b * block_size; i < std::min(n, (b + 1) * block_size); ++i)
+                                     ++offsets[b * num_digits + digit(v[i])];
+                         });
+
+            uint32_t sum = 0;
+            for (int d = 0; d < num_digits; ++d)
+                for (uint32_t b = 0; b < num_blocks; ++b)
+                {
+                    uint32_t count              = offsets[b * num_digits + d];
+                    offsets[b * num_digits + d] = sum;
+                    sum += count;
+                }
+
+            parallel_for(blocked_range<uint32_t>(0, num_blocks, 1),
+                         [&](blocked_range<uint32_t> range)
+                         {
+                             for (uint32_t b = range.begin(); b != range.end(); ++b)
+                                 for (uint32_t i = b * block_size; i < std::min(n, (b + 1) * block_size); ++i)
+                                     tmp[offsets[b * num_digits + digit(v[i])]++] = v[i];
+                         });
+            v.swap(tmp);
+        }
+    }
+
+    /**
+        Builds a linear BBH (LBVH) from the Morton codes of the primitives' centroids [Lauterbach et al. 2009].
+
+        After sorting the primitives along the Morton curve, every node splits its range where the highest bit that
+        differs within the range flips, which is found by a binary search. This only looks at the codes, so the
+        hierarchy is emitted in time linear in the number of nodes, but since the splits ignore the primitives' sizes,
+        the tree is of lower quality than a SAH build.
+
+        To recover some of that quality, an optional pass then restructures small treelets of the tree bottom-up with
+        agglomerative clustering [Domingues and Pedrini 2015]: each treelet's leaves are repeatedly merged in the pair
+        with the smallest bounding box, and the new treelet is kept if its interior nodes have a smaller total area.
+    */
+    struct LBVHBuilder : public BBHBuilder
+    {
+        vector<uint64_t> codes; ///< Sorted Morton codes, parallel to prims
+        int              treelet_size;
+        int              treelet_passes;
+
+        LBVHBuilder(vector<BBHPrimitive> &prims, Progress &progress, const BBHSettings &settings) :
+            BBHBuilder(prims, progress, settings), treelet_size(clamp(settings.lbvh_treelet_size, 3, 16)),
+            treelet_passes(std::max(settings.lbvh_treelet_passes, 0))
+        {
+        }
+
+        unique_ptr<BuildNode> build()
+        {
+            uint32_t n = uint32_t(prims.size());
+
+            Box3f centroid_bounds;
+            for (auto &p : prims)
+                centroid_bounds.enclose(p.centroid);
+
+            // 10 bits per axis (4 radix passes) separate the centroids of up to a few million primitives well enough;
+            // beyond that, use 21 bits per axis
+            int bits_per_axis = n > (1u << 22) ? 21 : 10;
+            int scale         = (1 << bits_per_axis) - 1;
+
+            vector<MortonPrimitive> morton(n);
+            parallel_for(blocked_range<uint32_t>(0, n, 4096),
+                         [&](blocked_range<uint32_t> range)
                          {
                              for (uint32_t i = range.begin(); i != range.end(); ++i)
                              {
-                                 build_funcs[i]();
+                                 Vec3f o = centroid_bounds.offset(prims[i].centroid);
+                                 uint64_t c[3];
+                                 for (int a = 0; a < 3; ++a)
+                                     c[a] = uint64_t(clamp(int(o[a] * scale), 0, scale));
+                                 morton[i] = {spread_bits(c[0]) << 2 | spread_bits(c[1]) << 1 | spread_bits(c[2]), i};
                              }
                          });
-    }
-    else
+            radix_sort(morton, 3 * bits_per_axis);
+
+            vector<BBHPrimitive> sorted(n);
+            codes.resize(n);
+            parallel_for(blocked_range<uint32_t>(0, n, 4096),
+                         [&](blocked_range<uint32_t> range)
+                         {
+                             for (uint32_t i = range.begin(); i != range.end(); ++i)
+                             {
+                                 sorted[i] = prims[morton[i].index];
+                                 codes[i]  = morton[i].code;
+                             }
+                         });
+            prims.swap(sorted);
+
+            auto root = emit(0, n);
+            for (int pass = 0; pass < treelet_passes; ++pass)
+                optimize(*root);
+            return root;
+        }
+
+        unique_ptr<BuildNode> emit(uint32_t begin, uint32_t end)
+        {
+            uint32_t n = end - begin;
+            if (n <= max_leaf_size)
+            {
+                Box3f bbox;
+                for (uint32_t i = begin; i < end; ++i)
+                    bbox.enclose(prims[i].bbox);
+                return make_leaf(begin, end, bbox);
+            }
+
+            uint32_t mid;
+            int      axis;
+            if (uint64_t diff = codes[begin] ^ codes[end - 1])
+            {
+                // the codes are sorted, so the range splits where the highest differing bit flips from 0 to 1
+                int bit = 63;
+                while (!(diff >> bit))
+                    --bit;
+                // bits 3i + 2, 3i + 1, and 3i hold x, y, and z
+                axis = 2 - bit % 3;
+                mid  = uint32_t(std::partition_point(codes.begin() + begin, codes.begin() + end,
+                                                     [bit](uint64_t c) { return !((c >> bit) & 1); }) -
+                               codes.begin());
+            }
+            else
+            {
+                // all centroids fall in the same Morton cell, whose codes are all equal, so any order is sorted
+                Box3f bbox;
+                for (uint32_t i = begin; i < end; ++i)
+                    bbox.enclose(prims[i].bbox);
+                axis = choose_bbox_max_axis(bbox);
+                mid  = split_equal(begin, end, axis);
+            }
+
+            auto node   = make_unique<BuildNode>();
+            node->begin = begin;
+            node->end   = end;
+            node->axis  = axis;
+            ++interior_nodes;
+
+            if (n >= parallel_cutoff)
+            {
+                Task *left        = do_async([&] { node->children[0] = emit(begin, mid); });
+                node->children[1] = emit(mid, end);
+                task_wait_and_release(left);
+            }
+            else
+            {
+                node->children[0] = emit(begin, mid);
+                node->children[1] = emit(mid, end);
+            }
+
+            node->bbox = node->children[0]->bbox;
+            node->bbox.enclose(node->children[1]->bbox);
+            return node;
+        }
+
+        /// Make \p left and \p right the children of \p node, ordered along the axis that separates them best
+        static void set_children(BuildNode &node, unique_ptr<BuildNode> left, unique_ptr<BuildNode> right)
+        {
+            Vec3f d    = right->bbox.center() - left->bbox.center();
+            int   axis = 0;
+            for (int a = 1; a < 3; ++a)
+                if (std::abs(d[a]) > std::abs(d[axis]))
+                    axis = a;
+            if (d[axis] < 0.f)
+                std::swap(left, right);
+
+            node.axis  = axis;
+            node.begin = std::min(left->begin, right->begin);
+            node.end   = std::max(left->end, right->end);
+            node.bbox  = left->bbox;
+            node.bbox.enclose(right->bbox);
+            node.children[0] = std::move(left);
+            node.children[1] = std::move(right);
+        }
+
+        /// Restructure the treelets of the subtree rooted at \p node bottom-up
+        void optimize(BuildNode &node)
+        {
+            if (!node.children[0])
+                return;
+
+            if (node.end - node.begin >= parallel_cutoff)
+            {
+                Task *left = do_async([&] { optimize(*node.children[0]); });
+                optimize(*node.children[1]);
+                task_wait_and_release(left);
+            }
+            else
+            {
+                optimize(*node.children[0]);
+                optimize(*node.children[1]);
+            }
+
+            optimize_treelet(node);
+        }
+
+        /// Rebuild the treelet rooted at \p root with agglomerative clustering if that lowers its SAH cost
+        void optimize_treelet(BuildNode &root)
+        {
+            // grow the treelet by repeatedly opening the leaf with the largest area
+            vector<BuildNode *> leaves    = {root.children[0].get(), root.children[1].get()};
+            vector<BuildNode *> interiors = {&root};
+            float               old_area  = root.bbox.area();
+            while (int(leaves.size()) < treelet_size)
+            {
+                int best = -1;
+                for (int i = 0; i < int(leaves.size()); ++i)
+                    if (leaves[i]->children[0] && (best < 0 || leaves[i]->bbox.area() > leaves[best]->bbox.area()))
+                        best = i;
+                if (best < 0)
+                    break;
+
+                BuildNode *opened = leaves[best];
+                old_area += opened->bbox.area();
+                interiors.push_back(opened);
+                leaves[best] = opened->children[0].get();
+                leaves.push_back(opened->children[1].get());
+            }
+
+            int k = int(leaves.size());
+            if (k < 3)
+                return;
+
+            // the treelet's leaves keep their subtrees, so only the areas of its interior nodes change the SAH cost
+            vector<Box3f>               boxes(k);
+            vector<int>                 active(k);
+            vector<std::pair<int, int>> merges;
+            for (int i = 0; i < k; ++i)
+            {
+                boxes[i]  = leaves[i]->bbox;
+                active[i] = i;
+            }
+
+            float new_area = 0.f;
+            while (active.size() > 1)
+            {
+                int   best_i = 0, best_j = 1;
+                float best   = std::numeric_limits<float>::infinity();
+                for (int i = 0; i < int(active.size()); ++i)
+                    for (int j = i + 1; j < int(active.size()); ++j)
+                    {
+                        Box3f b = boxes[active[i]];
+                        b.enclose(boxes[active[j]]);
+                        if (b.area() < best)
+                        {
+                            best   = b.area();
+                            best_i = i;
+                            best_j = j;
+                        }
+                    }
+
+                Box3f b = boxes[active[best_i]];
+                b.enclose(boxes[active[best_j]]);
+                merges.emplace_back(active[best_i], active[best_j]);
+                boxes.push_back(b);
+                new_area += best;
+
+                active.erase(active.begin() + best_j);
+                active[best_i] = int(boxes.size()) - 1;
+            }
+
+            if (!(new_area < old_area * 0.999f))
+                return;
+
+            // detach the leaves before the old interior nodes (other than the root) are released
+            vector<unique_ptr<BuildNode>> nodes(k + merges.size());
+            for (BuildNode *interior : interiors)
+                for (auto &child : interior->children)
+                {
+                    auto it = std::find(leaves.begin(), leaves.end(), child.get());
+                    if (it != leaves.end())
+                        nodes[it - leaves.begin()] = std::move(child);
+                }
+
+            // the final merge becomes the root, so the parent's pointer to it stays valid
+            for (size_t m = 0; m + 1 < merges.size(); ++m)
+            {
+                nodes[k + m] = make_unique<BuildNode>();
+                set_children(*nodes[k + m], std::move(nodes[merges[m].first]), std::move(nodes[merges[m].second]));
+            }
+            set_children(root, std::move(nodes[merges.back().first]), std::move(nodes[merges.back().second]));
+        }
+    };
+
+    /// Copy the subtree rooted at \p node into \p nodes in depth-first order, returning the index of its root
+    uint32_t flatten(const BuildNode &node, int depth, int &max_depth, vector<LinearBBHNode> &nodes)
     {
-        build_funcs[0]();
-        build_funcs[1]();
-    }
-#else
-    build_funcs[0]();
-    build_funcs[1]();
-#endif
-}
+        max_depth = std::max(max_depth, depth);
 
-BBH::BBH(const json &j) : SurfaceGroup(j)
-{
-    // These values aren't used in the base code right now - but you can use these for when you want to extend the basic
-    // BBH functionality
+        uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        nodes[index].bbox = node.bbox;
+        nodes[index].axis = uint8_t(node.axis);
 
-    max_leaf_size = j.value("max_leaf_size", max_leaf_size);
+        if (!node.children[0])
+        {
+            nodes[index].primitives_offset = node.begin;
+            nodes[index].num_primitives    = uint16_t(node.end - node.begin);
+            return index;
+        }
+
+        nodes[index].num_primitives = 0;
+        flatten(*node.children[0], depth + 1, max_depth, nodes);
+        // nodes may have been reallocated by the recursive calls, so index it again
+        uint32_t second                  = flatten(*node.children[1], depth + 1, max_depth, nodes);
+        nodes[index].second_child_offset = second;
+        return index;
+    }
+} // namespace
 
-    g_max_leaf_size = max_leaf_size;
+BBHSettings::BBHSettings(const json &j)
+{
+    max_leaf_size         = j.value("max_leaf_size", max_leaf_size);
+    parallel_build_cutoff = j.value("parallel_build_cutoff", parallel_build_cutoff);
 
     string sm = j.value("split_method", "sah");
     if (sm == "sah")
@@ -585,51 +1261,936 @@ BBH::BBH(const json &j) : SurfaceGroup(j)
     else if (sm == "equal")
         // Split so that an equal number of objects are on either side
         split_method = BBH_SplitMethod::Equal;
+    else if (sm == "sbvh")
+        // Surface-area heuristic over both object splits and spatial splits
+        split_method = BBH_SplitMethod::SBVH;
+    else if (sm == "lbvh")
+        // Split along the Morton curve through the centroids, then restructure treelets
+        split_method = BBH_SplitMethod::LBVH;
     else
     {
         spdlog::error("Unrecognized split_method \"{}\". Using \"equal\" instead.", sm);
         split_method = BBH_SplitMethod::Equal;
     }
+
+    sah_buckets       = j.value("sah_buckets", sah_buckets);
+    traversal_cost    = j.value("traversal_cost", traversal_cost);
+    intersection_cost = j.value("intersection_cost", intersection_cost);
+    if (sah_buckets < 2 || sah_buckets > max_buckets)
+    {
+        spdlog::error("sah_buckets must be between 2 and {}, but is {}. Clamping.", max_buckets, sah_buckets);
+        sah_buckets = clamp(sah_buckets, 2, max_buckets);
+    }
+
+    rebuild_threshold = j.value("rebuild_threshold", rebuild_threshold);
+    sbvh_duplication  = j.value("sbvh_duplication", sbvh_duplication);
+    sbvh_overlap      = j.value("sbvh_overlap", sbvh_overlap);
+
+    lbvh_treelet_size   = j.value("lbvh_treelet_size", lbvh_treelet_size);
+    lbvh_treelet_passes = j.value("lbvh_treelet_passes", lbvh_treelet_passes);
+    if (lbvh_treelet_size < 3 || lbvh_treelet_size > 16)
+    {
+        spdlog::error("lbvh_treelet_size must be between 3 and 16, but is {}. Clamping.", lbvh_treelet_size);
+        lbvh_treelet_size = clamp(lbvh_treelet_size, 3, 16);
+    }
 }
 
-void BBH::build()
+void split_triangle_bounds(const Vec3f &p0, const Vec3f &p1, const Vec3f &p2, const Box3f &bbox, int axis, float pos,
+                           Box3f &left, Box3f &right)
 {
-    Progress progress("Building BBH", m_surfaces.size());
-    if (!m_surfaces.empty())
+    left = right = Box3f();
+
+    // enclose the vertices on each side, and the points where the edges cross the plane on both sides
+    const Vec3f *v[3] = {&p0, &p1, &p2};
+    for (int i = 0; i < 3; ++i)
     {
-        if (split_method == BBH_SplitMethod::SAH)
+        const Vec3f &a = *v[i];
+        const Vec3f &b = *v[(i + 1) % 3];
+        if (a[axis] <= pos)
+            left.enclose(a);
+        if (a[axis] >= pos)
+            right.enclose(a);
+        if ((a[axis] < pos && pos < b[axis]) || (b[axis] < pos && pos < a[axis]))
         {
-            root = make_shared<BBHNode_SplitMethodTemplated<BBH_SplitMethod::SAH>>(m_surfaces, progress);
+            Vec3f p = a + (b - a) * ((pos - a[axis]) / (b[axis] - a[axis]));
+            p[axis] = pos;
+            left.enclose(p);
+            right.enclose(p);
         }
-        else if (split_method == BBH_SplitMethod::Middle)
+    }
+
+    // clip to the corresponding half of bbox. Along axes where the triangle is flat, bbox may have been padded (see
+    // Mesh::face_bounds), so keep that padding instead of collapsing the box
+    Box3f halves[2] = {bbox, bbox};
+    halves[0].max[axis] = halves[1].min[axis] = pos;
+    Box3f *sides[2] = {&left, &right};
+    for (int s = 0; s < 2; ++s)
+    {
+        Box3f &b = *sides[s];
+        if (b.is_empty())
+            continue;
+        for (int k = 0; k < 3; ++k)
         {
-            root = make_shared<BBHNode_SplitMethodTemplated<BBH_SplitMethod::Middle>>(m_surfaces, progress);
+            if (b.min[k] == b.max[k])
+            {
+                b.min[k] = halves[s].min[k];
+                b.max[k] = halves[s].max[k];
+            }
+            else
+            {
+                b.min[k] = std::max(b.min[k], halves[s].min[k]);
+                b.max[k] = std::min(b.max[k], halves[s].max[k]);
+            }
         }
-        else if (split_method == BBH_SplitMethod::Equal)
+        if (b.is_empty())
+            b = Box3f();
+    }
+}
+
+int build_linear_bbh(vector<BBHPrimitive> &prims, const BBHSettings &settings, Progress &progress,
+                     vector<LinearBBHNode> &nodes, const BBHSplitFunc &split)
+{
+    nodes.clear();
+    if (prims.empty())
+        return 0;
+
+    unique_ptr<BuildNode> root;
+    if (settings.split_method == BBH_SplitMethod::SBVH)
+    {
+        // the leaves copy their references back into prims, which may end up larger than it started
+        uint32_t             num_prims = uint32_t(prims.size());
+        vector<BBHPrimitive> refs      = std::move(prims);
+        Box3f                bbox;
+        for (auto &r : refs)
+            bbox.enclose(r.bbox);
+
+        prims = vector<BBHPrimitive>();
+        prims.reserve(size_t(num_prims * (1.f + std::max(settings.sbvh_duplication, 0.f))) + 1);
+        SBVHBuilder builder(prims, progress, settings, split, num_prims, bbox);
+        root = builder.build(std::move(refs), 0);
+
+        spdlog::info("SBVH: {} spatial splits added {} references to {} primitives ({:.1f}% more).",
+                     builder.spatial_splits.load(), prims.size() - num_prims, num_prims,
+                     100.f * (prims.size() - num_prims) / num_prims);
+    }
+    else if (settings.split_method == BBH_SplitMethod::LBVH)
+        root = LBVHBuilder(prims, progress, settings).build();
+    else
+        root = BBHBuilder(prims, progress, settings).build(0, uint32_t(prims.size()));
+
+    int max_depth = 0;
+    nodes.reserve(2 * prims.size());
+    flatten(*root, 0, max_depth, nodes);
+    nodes.shrink_to_fit();
+    return max_depth;
+}
+
+namespace
+{
+    Box3f refit_node(vector<LinearBBHNode> &nodes, uint32_t index,
+                     const std::function<Box3f(uint32_t, uint32_t)> &leaf_bounds, uint32_t parallel_cutoff)
+    {
+        LinearBBHNode &node = nodes[index];
+        if (node.num_primitives > 0)
+            return node.bbox = leaf_bounds(node.primitives_offset, node.num_primitives);
+
+        // the first child's subtree occupies the nodes between this node and the second child
+        Box3f    left, right;
+        uint32_t second = node.second_child_offset;
+        if (second - index > parallel_cutoff)
+        {
+            Task *task = do_async([&] { left = refit_node(nodes, index + 1, leaf_bounds, parallel_cutoff); });
+            right      = refit_node(nodes, second, leaf_bounds, parallel_cutoff);
+            task_wait_and_release(task);
+        }
+        else
         {
-            root = make_shared<BBHNode_SplitMethodTemplated<BBH_SplitMethod::Equal>>(m_surfaces, progress);
+            left  = refit_node(nodes, index + 1, leaf_bounds, parallel_cutoff);
+            right = refit_node(nodes, second, leaf_bounds, parallel_cutoff);
         }
+
+        left.enclose(right);
+        return node.bbox = left;
+    }
+} // namespace
+
+void refit_linear_bbh(vector<LinearBBHNode> &nodes, const std::function<Box3f(uint32_t, uint32_t)> &leaf_bounds,
+                      int parallel_cutoff)
+{
+    if (!nodes.empty())
+        refit_node(nodes, 0, leaf_bounds, uint32_t(std::max(parallel_cutoff, 2)));
+}
+
+float linear_bbh_sah_cost(const vector<LinearBBHNode> &nodes, const BBHSettings &settings)
+{
+    if (nodes.empty())
+        return 0.f;
+
+    // weight each node by the probability that a ray hitting the root also hits it
+    double cost = 0.0;
+    for (auto &node : nodes)
+        cost += double(node.bbox.area()) *
+                (node.num_primitives > 0 ? settings.intersection_cost * node.num_primitives : settings.traversal_cost);
+
+    float root_area = nodes[0].bbox.area();
+    return root_area > 0.f ? float(cost / root_area) : 0.f;
+}
+
+namespace
+{
+    /// The exponent of the smallest power-of-two step such that 255 steps from \p lo reach \p hi
+    int8_t quantization_exponent(float lo, float hi)
+    {
+        int e;
+        std::frexp((hi - lo) / 255.f, &e);
+        e = clamp(e, -126, 127);
+        // the estimate can be off by one either way once lo + 255 steps is rounded
+        while (e < 127 && lo + 255.f * std::ldexp(1.f, e) < hi)
+            ++e;
+        while (e > -126 && lo + 255.f * std::ldexp(1.f, e - 1) >= hi)
+            --e;
+        return int8_t(e);
+    }
+
+    /// Quantize the interval [\p lo, \p hi] to steps of 2^\p exponent from \p origin, rounding outward
+    void quantize_interval(float origin, int8_t exponent, float lo, float hi, uint8_t &qlo, uint8_t &qhi)
+    {
+        // decode exactly like QuantizedBBHNode::child_box, so the rounded values are the ones traversal will see
+        float step   = std::ldexp(1.f, exponent);
+        auto  decode = [&](int q) { return origin + float(q) * step; };
+
+        int l = int(clamp(std::floor((lo - origin) / step), 0.f, 255.f));
+        while (l > 0 && decode(l) > lo)
+            --l;
+        while (l < 255 && decode(l + 1) <= lo)
+            ++l;
+
+        int h = int(clamp(std::ceil((hi - origin) / step), float(l), 255.f));
+        while (h < 255 && decode(h) < hi)
+            ++h;
+        while (h > l && decode(h - 1) >= hi)
+            --h;
+
+        qlo = uint8_t(l);
+        qhi = uint8_t(h);
+    }
+
+    /// Encode nodes[\p index], whose decoded box is \p box, as a child reference, appending interior nodes to \p out
+    bool quantize_child(const vector<LinearBBHNode> &nodes, uint32_t index, const Box3f &box,
+                        vector<QuantizedBBHNode> &out, uint32_t &child)
+    {
+        const LinearBBHNode &node = nodes[index];
+        if (node.num_primitives > 0)
+        {
+            if (node.num_primitives > QuantizedBBH::max_leaf_primitives ||
+                node.primitives_offset >= QuantizedBBH::max_leaf_offset)
+                return false;
+            child = QuantizedBBH::leaf(node.primitives_offset, node.num_primitives);
+            return true;
+        }
+
+        child = uint32_t(out.size());
+        out.emplace_back();
+
+        QuantizedBBHNode q{};
+        for (int a = 0; a < 3; ++a)
+            q.exponent[a] = quantization_exponent(box.min[a], box.max[a]);
+
+        uint32_t children[2] = {index + 1, node.second_child_offset};
+        for (int c = 0; c < 2; ++c)
+        {
+            const Box3f &exact = nodes[children[c]].bbox;
+            for (int a = 0; a < 3; ++a)
+                quantize_interval(box.min[a], q.exponent[a], exact.min[a], exact.max[a], q.lo[c][a], q.hi[c][a]);
+            if (!quantize_child(nodes, children[c], q.child_box(c, box.min), out, q.child[c]))
+                return false;
+        }
+
+        out[child] = q;
+        return true;
+    }
+
+    void unpack_child(const QuantizedBBH &quantized, uint32_t child, const Box3f &box, vector<LinearBBHNode> &nodes)
+    {
+        LinearBBHNode node{};
+        node.bbox = box;
+        if (QuantizedBBH::is_leaf(child))
+        {
+            node.primitives_offset = QuantizedBBH::leaf_first(child);
+            node.num_primitives    = uint16_t(QuantizedBBH::leaf_count(child));
+            nodes.push_back(node);
+            return;
+        }
+
+        uint32_t index = uint32_t(nodes.size());
+        nodes.push_back(node);
+        const QuantizedBBHNode &q = quantized.nodes[child];
+        unpack_child(quantized, q.child[0], q.child_box(0, box.min), nodes);
+        nodes[index].second_child_offset = uint32_t(nodes.size());
+        unpack_child(quantized, q.child[1], q.child_box(1, box.min), nodes);
+    }
+} // namespace
+
+bool quantize_linear_bbh(const vector<LinearBBHNode> &nodes, QuantizedBBH &quantized)
+{
+    quantized = QuantizedBBH();
+    if (nodes.empty())
+        return true;
+
+    const Box3f &root = nodes[0].bbox;
+    for (int a = 0; a < 3; ++a)
+        if (!std::isfinite(root.min[a]) || !std::isfinite(root.max[a]))
+            return false;
+    quantized.bbox = root;
+
+    bool ok;
+    if (nodes[0].num_primitives > 0)
+    {
+        // only interior nodes are stored, so a lone leaf becomes the first child of a root whose second child is an
+        // empty leaf with an empty box
+        QuantizedBBHNode q{};
+        for (int a = 0; a < 3; ++a)
+        {
+            q.exponent[a] = quantization_exponent(root.min[a], root.max[a]);
+            q.lo[0][a] = q.hi[1][a] = 0;
+            q.hi[0][a] = q.lo[1][a] = 255;
+        }
+        ok = quantize_child(nodes, 0, root, quantized.nodes, q.child[0]);
+        q.child[1] = QuantizedBBH::leaf(0, 0);
+        quantized.nodes.push_back(q);
     }
     else
     {
-        root = nullptr;
+        uint32_t child;
+        ok = quantize_child(nodes, 0, root, quantized.nodes, child);
     }
+
+    if (!ok)
+        quantized = QuantizedBBH();
+    quantized.nodes.shrink_to_fit();
+    return ok;
+}
+
+void unpack_quantized_bbh(const QuantizedBBH &quantized, vector<LinearBBHNode> &nodes)
+{
+    nodes.clear();
+    if (quantized.nodes.empty())
+        return;
+
+    const QuantizedBBHNode &root = quantized.nodes[0];
+    if (QuantizedBBH::is_leaf(root.child[1]) && QuantizedBBH::leaf_count(root.child[1]) == 0)
+        unpack_child(quantized, root.child[0], quantized.bbox, nodes);
+    else
+        unpack_child(quantized, 0, quantized.bbox, nodes);
+    nodes.shrink_to_fit();
+}
+
+BBH::BBH(const json &j) : SurfaceGroup(j), settings(j)
+{
+    string l = j.value("layout", "linear");
+    if (l == "linear")
+        // Traverse the flattened node array iteratively
+        layout = BBH_Layout::Linear;
+    else if (l == "tree")
+        // Convert the flattened nodes into a pointer tree and traverse it recursively
+        layout = BBH_Layout::Tree;
+    else
+    {
+        spdlog::error("Unrecognized layout \"{}\". Using \"linear\" instead.", l);
+        layout = BBH_Layout::Linear;
+    }
+}
+
+void BBH::build()
+{
+    Progress progress("Building BBH", m_surfaces.size());
+
+    vector<BBHPrimitive> prims(m_surfaces.size());
+    parallel_for(blocked_range<uint32_t>(0, uint32_t(m_surfaces.size()), 4096),
+                 [&](blocked_range<uint32_t> range)
+                 {
+                     for (uint32_t i = range.begin(); i != range.end(); ++i)
+                     {
+                         prims[i].bbox     = m_surfaces[i]->bounds();
+                         prims[i].centroid = prims[i].bbox.center();
+                         prims[i].index    = i;
+                     }
+                 });
+
+    // only consulted by the spatial splits of an SBVH
+    auto split = [this](uint32_t i, const Box3f &bbox, int axis, float pos, Box3f &left, Box3f &right)
+    { m_surfaces[i]->split_bounds(bbox, axis, pos, left, right); };
+
+    int max_depth = build_linear_bbh(prims, settings, progress, nodes, split);
     progress.set_done();
+
+    ordered_surfaces.resize(prims.size());
+    ordered_triangles.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); ++i)
+    {
+        ordered_surfaces[i]  = m_surfaces[prims[i].index].get();
+        ordered_triangles[i] = dynamic_cast<const Triangle *>(ordered_surfaces[i]);
+    }
+
+    if (layout == BBH_Layout::Linear && max_depth >= max_linear_depth)
+    {
+        spdlog::warn("BBH depth {} exceeds the linear traversal stack ({}); falling back to the tree layout.",
+                     max_depth, max_linear_depth);
+        layout = BBH_Layout::Tree;
+    }
+
+    root = nullptr;
+    if (layout == BBH_Layout::Tree)
+    {
+        if (!nodes.empty())
+            root = make_tree(0, prims);
+        nodes.clear();
+        ordered_surfaces.clear();
+        ordered_triangles.clear();
+    }
+
+    built_cost = linear_bbh_sah_cost(nodes, settings);
+
     spdlog::info("BBH contains {} surfaces.", m_surfaces.size());
+    if (layout == BBH_Layout::Linear)
+        spdlog::info("Flattened BBH into {} nodes ({} bytes).", nodes.size(), nodes.size() * sizeof(LinearBBHNode));
+}
+
+void BBH::refit()
+{
+    SurfaceGroup::refit();
+
+    if (layout != BBH_Layout::Linear)
+        return build();
+
+    refit_linear_bbh(
+        nodes,
+        [this](uint32_t first, uint32_t count)
+        {
+            Box3f b;
+            for (uint32_t i = first; i < first + count; ++i)
+                b.enclose(ordered_surfaces[i]->bounds());
+            return b;
+        },
+        settings.parallel_build_cutoff);
+
+    float cost = linear_bbh_sah_cost(nodes, settings);
+    if (cost > settings.rebuild_threshold * built_cost)
+    {
+        spdlog::info("Refitting raised the BBH's SAH cost from {:.2f} to {:.2f}; rebuilding.", built_cost, cost);
+        build();
+    }
+}
+
+shared_ptr<Surface> BBH::make_tree(uint32_t index, const vector<BBHPrimitive> &prims) const
+{
+    const LinearBBHNode &node = nodes[index];
+    if (node.num_primitives > 0)
+    {
+        auto leaf = make_shared<BBHLeaf>();
+        leaf->surfaces.reserve(node.num_primitives);
+        for (uint32_t i = node.primitives_offset; i < node.primitives_offset + node.num_primitives; ++i)
+            leaf->surfaces.push_back(m_surfaces[prims[i].index]);
+        return leaf;
+    }
+
+    auto interior         = make_shared<BBHNode>();
+    interior->bbox        = node.bbox;
+    interior->split_axis  = node.axis;
+    interior->left_child  = make_tree(index + 1, prims);
+    interior->right_child = make_tree(node.second_child_offset, prims);
+    return interior;
 }
 
 bool BBH::intersect(const Ray3f &ray_, HitInfo &hit) const
 {
     ++total_rays;
+    if (layout == BBH_Layout::Linear)
+        return intersect_linear(ray_, hit);
+
     if (!root)
         return false;
 
-    auto ray           =ray_;
-    bool hit_something = root->intersect(ray, hit);
+    // intersect the ray with the BBH
+    bool hit_something = root->intersect(ray_, hit);
 
     return hit_something;
 }
 
+bool BBH::intersect_linear(const Ray3f &ray_, HitInfo &hit) const
+{
+    // copy the ray so we can shrink maxt as closer hits are found
+    Ray3f               ray = ray_;
+    DeferredTriangleHit closest;
+    bool                hit_anything =
+        intersect_linear_bbh(nodes, ray, bbh_nodes_visited,
+                             [&](uint32_t first, uint32_t count, Ray3f &leaf_ray)
+                             {
+                                 bool hit_leaf = false;
+                                 for (uint32_t i = first; i < first + count; ++i)
+                                     hit_leaf |=
+                                         closest.intersect(ordered_surfaces[i], ordered_triangles[i], leaf_ray, hit);
+                                 return hit_leaf;
+                             });
+    closest.finish(ray_, hit);
+    return hit_anything;
+}
+
+bool BBH::occluded(const Ray3f &ray) const
+{
+    ++total_rays;
+    if (layout == BBH_Layout::Linear)
+        return occluded_linear(ray);
+
+    return root && root->occluded(ray);
+}
+
+uint32_t BBH::intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const
+{
+    if (layout != BBH_Layout::Linear)
+        return Surface::intersect_packet(rays, active, hits);
+
+    for (uint32_t m = active; m; m &= m - 1)
+        ++total_rays;
+
+    // as for single rays, triangles only record the closest hit of each ray, which is completed after traversal
+    DeferredTriangleHit closest[max_packet_size];
+    uint32_t            hit_mask = intersect_linear_bbh_packet(
+        nodes, rays, active, bbh_nodes_visited,
+        [&](uint32_t first, uint32_t count, Ray3f *leaf_rays, uint32_t mask)
+        {
+            uint32_t hit_leaf = 0;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                if (!ordered_triangles[i])
+                {
+                    uint32_t hit_surface = ordered_surfaces[i]->intersect_packet(leaf_rays, mask, hits);
+                    for (int l = 0; l < max_packet_size; ++l)
+                        if (hit_surface & (1u << l))
+                            closest[l].triangle = nullptr;
+                    hit_leaf |= hit_surface;
+                    continue;
+                }
+
+                for (int l = 0; l < max_packet_size; ++l)
+                    if ((mask & (1u << l)) &&
+                        closest[l].intersect(ordered_surfaces[i], ordered_triangles[i], leaf_rays[l], hits[l]))
+                        hit_leaf |= 1u << l;
+            }
+            return hit_leaf;
+        });
+
+    for (int l = 0; l < max_packet_size; ++l)
+        if (hit_mask & (1u << l))
+            closest[l].finish(rays[l], hits[l]);
+    return hit_mask;
+}
+
+bool BBH::occluded_linear(const Ray3f &ray) const
+{
+    return occluded_linear_bbh(nodes, ray, bbh_nodes_visited,
+                               [&](uint32_t first, uint32_t count, const Ray3f &leaf_ray)
+                               {
+                                   for (uint32_t i = first; i < first + count; ++i)
+                                       if (ordered_surfaces[i]->occluded(leaf_ray))
+                                           return true;
+                                   return false;
+                               });
+}
+
+namespace
+{
+    /**
+        Slab-test a ray against all children of a wide node.
+
+        Returns a bitmask with bit \p i set if the ray hits child \p i within [\p mint, \p maxt], and stores the
+        entry distance of each child in \p tnear. The near and far slabs are selected by the ray direction sign, so
+        no per-lane swapping is needed.
+    */
+    template <int W>
+    uint32_t intersect_children(const WideBBHNode<W> &node, const Vec3f &o, const Vec3f &inv_d,
+                                const int dir_is_neg[3], float mint, float maxt, float tnear[W])
+    {
+        float t0[W], t1[W];
+        for (int i = 0; i < W; ++i)
+        {
+            t0[i] = mint;
+            t1[i] = maxt;
+        }
+
+        for (int a = 0; a < 3; ++a)
+        {
+            const float *near_b = dir_is_neg[a] ? node.hi[a] : node.lo[a];
+            const float *far_b  = dir_is_neg[a] ? node.lo[a] : node.hi[a];
+            for (int i = 0; i < W; ++i)
+            {
+                float n = (near_b[i] - o[a]) * inv_d[a];
+                float f = (far_b[i] - o[a]) * inv_d[a];
+                t0[i]   = n > t0[i] ? n : t0[i];
+                t1[i]   = f < t1[i] ? f : t1[i];
+            }
+        }
+
+        uint32_t mask = 0;
+        for (int i = 0; i < W; ++i)
+        {
+            tnear[i] = t0[i];
+            if (t0[i] <= t1[i])
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+
+#if defined(__SSE2__) || defined(_M_X64)
+    template <>
+    uint32_t intersect_children<4>(const WideBBHNode<4> &node, const Vec3f &o, const Vec3f &inv_d,
+                                   const int dir_is_neg[3], float mint, float maxt, float tnear[4])
+    {
+        __m128 t0 = _mm_set1_ps(mint);
+        __m128 t1 = _mm_set1_ps(maxt);
+        for (int a = 0; a < 3; ++a)
+        {
+            __m128 org = _mm_set1_ps(o[a]);
+            __m128 inv = _mm_set1_ps(inv_d[a]);
+            __m128 n   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[a] ? node.hi[a] : node.lo[a]), org), inv);
+            __m128 f   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[a] ? node.lo[a] : node.hi[a]), org), inv);
+            // min/max return their second operand if either is NaN, so NaN slabs are ignored like in Box::intersect
+            t0 = _mm_max_ps(n, t0);
+            t1 = _mm_min_ps(f, t1);
+        }
+        _mm_storeu_ps(tnear, t0);
+        return uint32_t(_mm_movemask_ps(_mm_cmple_ps(t0, t1)));
+    }
+#endif
+
+#if defined(__AVX__)
+    template <>
+    uint32_t intersect_children<8>(const WideBBHNode<8> &node, const Vec3f &o, const Vec3f &inv_d,
+                                   const int dir_is_neg[3], float mint, float maxt, float tnear[8])
+    {
+        __m256 t0 = _mm256_set1_ps(mint);
+        __m256 t1 = _mm256_set1_ps(maxt);
+        for (int a = 0; a < 3; ++a)
+        {
+            __m256 org = _mm256_set1_ps(o[a]);
+            __m256 inv = _mm256_set1_ps(inv_d[a]);
+            __m256 n = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[a] ? node.hi[a] : node.lo[a]), org), inv);
+            __m256 f = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[a] ? node.lo[a] : node.hi[a]), org), inv);
+            t0       = _mm256_max_ps(n, t0);
+            t1       = _mm256_min_ps(f, t1);
+        }
+        _mm256_storeu_ps(tnear, t0);
+        return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)));
+    }
+#endif
+} // namespace
+
+template <int W>
+void WideBBH<W>::build()
+{
+    BBH::build();
+
+    wide_nodes.clear();
+    if (layout != BBH_Layout::Linear || nodes.empty())
+        return;
+
+    wide_nodes.reserve(nodes.size() / (W - 1) + 1);
+    collapse(0);
+
+    // only the wide nodes and the ordered surfaces are needed for traversal
+    nodes.clear();
+    nodes.shrink_to_fit();
+
+    built_cost = wide_sah_cost();
+
+    spdlog::info("Collapsed BBH into {} {}-wide nodes ({} bytes).", wide_nodes.size(), W,
+                 wide_nodes.size() * sizeof(WideBBHNode<W>));
+}
+
+template <int W>
+void WideBBH<W>::refit()
+{
+    SurfaceGroup::refit();
+
+    if (layout != BBH_Layout::Linear)
+        return build();
+
+    if (wide_nodes.empty())
+        return;
+
+    // each wide node replaces about W - 1 binary nodes, so scale the binary refit's task size accordingly
+    refit_wide(0, uint32_t(wide_nodes.size()), uint32_t(std::max(settings.parallel_build_cutoff / (W - 1), 2)));
+
+    float cost = wide_sah_cost();
+    if (cost > settings.rebuild_threshold * built_cost)
+    {
+        spdlog::info("Refitting raised the {}-wide BBH's SAH cost from {:.2f} to {:.2f}; rebuilding.", W, built_cost,
+                     cost);
+        build();
+    }
+}
+
+template <int W>
+Box3f WideBBH<W>::refit_wide(uint32_t index, uint32_t end, uint32_t parallel_cutoff)
+{
+    WideBBHNode<W> &node = wide_nodes[index];
+
+    Box3f boxes[W];
+    Task *tasks[W];
+    int   num_tasks = 0;
+    for (int i = 0; i < node.num_children; ++i)
+    {
+        if (node.num_primitives[i] > 0)
+        {
+            for (uint32_t s = node.offset[i]; s < node.offset[i] + node.num_primitives[i]; ++s)
+                boxes[i].enclose(ordered_surfaces[s]->bounds());
+            continue;
+        }
+
+        // the child's subtree ends where the next interior child's subtree starts
+        uint32_t child_end = end;
+        for (int j = i + 1; j < node.num_children; ++j)
+            if (node.num_primitives[j] == 0)
+            {
+                child_end = node.offset[j];
+                break;
+            }
+
+        if (child_end - node.offset[i] > parallel_cutoff)
+            tasks[num_tasks++] =
+                do_async([&, i, child_end] { boxes[i] = refit_wide(node.offset[i], child_end, parallel_cutoff); });
+        else
+            boxes[i] = refit_wide(node.offset[i], child_end, parallel_cutoff);
+    }
+    for (int t = 0; t < num_tasks; ++t)
+        task_wait_and_release(tasks[t]);
+
+    Box3f all;
+    for (int i = 0; i < node.num_children; ++i)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            node.lo[a][i] = boxes[i].min[a];
+            node.hi[a][i] = boxes[i].max[a];
+        }
+        all.enclose(boxes[i]);
+    }
+    return all;
+}
+
+template <int W>
+float WideBBH<W>::wide_sah_cost() const
+{
+    if (wide_nodes.empty())
+        return 0.f;
+
+    // the root is implicit, so its box is the union of its children
+    Box3f  root;
+    double cost = 0.0;
+    for (size_t n = 0; n < wide_nodes.size(); ++n)
+    {
+        const WideBBHNode<W> &node = wide_nodes[n];
+        for (int i = 0; i < node.num_children; ++i)
+        {
+            Box3f b(Vec3f(node.lo[0][i], node.lo[1][i], node.lo[2][i]),
+                    Vec3f(node.hi[0][i], node.hi[1][i], node.hi[2][i]));
+            if (n == 0)
+                root.enclose(b);
+            cost += double(b.area()) * (node.num_primitives[i] > 0 ? settings.intersection_cost * node.num_primitives[i]
+                                                                   : settings.traversal_cost);
+        }
+    }
+
+    float root_area = root.area();
+    return root_area > 0.f ? float(cost / root_area) : 0.f;
+}
+
+template <int W>
+uint32_t WideBBH<W>::collapse(uint32_t index)
+{
+    // gather up to W binary nodes, always opening the interior one with the largest surface area
+    uint32_t children[W];
+    int      num_children = 1;
+    children[0]           = index;
+    while (num_children < W)
+    {
+        int   best      = -1;
+        float best_area = -1.f;
+        for (int i = 0; i < num_children; ++i)
+        {
+            const LinearBBHNode &c = nodes[children[i]];
+            if (c.num_primitives == 0 && c.bbox.area() > best_area)
+            {
+                best      = i;
+                best_area = c.bbox.area();
+            }
+        }
+        if (best < 0)
+            break;
+
+        uint32_t opened          = children[best];
+        children[best]           = opened + 1;
+        children[num_children++] = nodes[opened].second_child_offset;
+    }
+
+    uint32_t wide_index = uint32_t(wide_nodes.size());
+    wide_nodes.emplace_back();
+
+    {
+        WideBBHNode<W> &node = wide_nodes[wide_index];
+        node.num_children    = uint8_t(num_children);
+        for (int i = 0; i < W; ++i)
+        {
+            Box3f b                = i < num_children ? nodes[children[i]].bbox : Box3f();
+            node.offset[i]         = 0;
+            node.num_primitives[i] = 0;
+            for (int a = 0; a < 3; ++a)
+            {
+                node.lo[a][i] = b.min[a];
+                node.hi[a][i] = b.max[a];
+            }
+        }
+    }
+
+    for (int i = 0; i < num_children; ++i)
+    {
+        const LinearBBHNode &c = nodes[children[i]];
+        if (c.num_primitives > 0)
+        {
+            wide_nodes[wide_index].offset[i]         = c.primitives_offset;
+            wide_nodes[wide_index].num_primitives[i] = c.num_primitives;
+        }
+        else
+        {
+            // wide_nodes may be reallocated by the recursive call, so index it again afterwards
+            uint32_t child                   = collapse(children[i]);
+            wide_nodes[wide_index].offset[i] = child;
+        }
+    }
+
+    return wide_index;
+}
+
+template <int W>
+bool WideBBH<W>::intersect(const Ray3f &ray_, HitInfo &hit) const
+{
+    if (layout != BBH_Layout::Linear)
+        return BBH::intersect(ray_, hit);
+
+    ++total_rays;
+    if (wide_nodes.empty())
+        return false;
+
+    // copy the ray so we can shrink maxt as closer hits are found
+    Ray3f               ray          = ray_;
+    bool                hit_anything = false;
+    DeferredTriangleHit closest;
+
+    int   dir_is_neg[3] = {ray.d.x < 0.f, ray.d.y < 0.f, ray.d.z < 0.f};
+    Vec3f inv_d(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+
+    struct StackEntry
+    {
+        uint32_t offset;
+        uint32_t num_primitives;
+        float    tnear;
+    };
+    StackEntry to_visit[max_wide_stack];
+    int        to_visit_offset = 0;
+    to_visit[to_visit_offset++] = {0, 0, ray.mint};
+
+    while (to_visit_offset > 0)
+    {
+        StackEntry entry = to_visit[--to_visit_offset];
+
+        // a closer hit may have been found since this entry was pushed
+        if (entry.tnear > ray.maxt)
+            continue;
+
+        ++bbh_nodes_visited;
+        if (entry.num_primitives > 0)
+        {
+            for (uint32_t i = entry.offset; i < entry.offset + entry.num_primitives; ++i)
+                hit_anything |= closest.intersect(ordered_surfaces[i], ordered_triangles[i], ray, hit);
+            continue;
+        }
+
+        const WideBBHNode<W> &node = wide_nodes[entry.offset];
+        float                 tnear[W];
+        uint32_t              mask = intersect_children<W>(node, ray.o, inv_d, dir_is_neg, ray.mint, ray.maxt, tnear);
+        mask &= (1u << node.num_children) - 1u;
+
+        // push the hit children sorted from far to near, so that the nearest one is visited first
+        int first = to_visit_offset;
+        for (int i = 0; i < W; ++i)
+        {
+            if (!(mask & (1u << i)))
+                continue;
+
+            StackEntry child{node.offset[i], node.num_primitives[i], tnear[i]};
+            int        j = to_visit_offset++;
+            for (; j > first && to_visit[j - 1].tnear < child.tnear; --j)
+                to_visit[j] = to_visit[j - 1];
+            to_visit[j] = child;
+        }
+    }
+
+    closest.finish(ray_, hit);
+    return hit_anything;
+}
+
+template <int W>
+bool WideBBH<W>::occluded(const Ray3f &ray) const
+{
+    if (layout != BBH_Layout::Linear)
+        return BBH::occluded(ray);
+
+    ++total_rays;
+    if (wide_nodes.empty())
+        return false;
+
+    int   dir_is_neg[3] = {ray.d.x < 0.f, ray.d.y < 0.f, ray.d.z < 0.f};
+    Vec3f inv_d(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+
+    // any hit will do, so children are pushed unsorted and maxt never shrinks
+    struct StackEntry
+    {
+        uint32_t offset;
+        uint32_t num_primitives;
+    };
+    StackEntry to_visit[max_wide_stack];
+    int        to_visit_offset = 0;
+    to_visit[to_visit_offset++] = {0, 0};
+
+    while (to_visit_offset > 0)
+    {
+        StackEntry entry = to_visit[--to_visit_offset];
+
+        ++bbh_nodes_visited;
+        if (entry.num_primitives > 0)
+        {
+            for (uint32_t i = 0; i < entry.num_primitives; ++i)
+                if (ordered_surfaces[entry.offset + i]->occluded(ray))
+                    return true;
+            continue;
+        }
+
+        const WideBBHNode<W> &node = wide_nodes[entry.offset];
+        float                 tnear[W];
+        uint32_t              mask = intersect_children<W>(node, ray.o, inv_d, dir_is_neg, ray.mint, ray.maxt, tnear);
+        mask &= (1u << node.num_children) - 1u;
+
+        for (int i = 0; i < W; ++i)
+            if (mask & (1u << i))
+                to_visit[to_visit_offset++] = {node.offset[i], node.num_primitives[i]};
+    }
+
+    return false;
+}
+
+using BBH4 = WideBBH<4>;
+using BBH8 = WideBBH<8>;
+
 DARTS_REGISTER_CLASS_IN_FACTORY(Surface, BBH, "bbh")
 // this clumsy notation with the extra namespace is needed since we want to register BBH in both the Surface and
 // SurfaceGroup factories, and the DARTS_REGISTER_CLASS_IN_FACTORY macros would create duplicate definitions otherwise
@@ -638,6 +2199,14 @@ namespace
 DARTS_REGISTER_CLASS_IN_FACTORY(SurfaceGroup, BBH, "bbh")
 }
 
+DARTS_REGISTER_CLASS_IN_FACTORY(Surface, BBH4, "bbh4")
+DARTS_REGISTER_CLASS_IN_FACTORY(Surface, BBH8, "bbh8")
+namespace
+{
+DARTS_REGISTER_CLASS_IN_FACTORY(SurfaceGroup, BBH4, "bbh4")
+DARTS_REGISTER_CLASS_IN_FACTORY(SurfaceGroup, BBH8, "bbh8")
+}
+
 /**
     \file
     \brief BBH SurfaceGroup
@@ -0,0 +1,438 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <cstring>
+#include <darts/factory.h>
+#include <darts/mapped_file.h>
+#include <darts/mesh.h>
+#include <filesystem>
+#include <functional>
+
+namespace
+{
+    /// A range of bytes in one of the buffers of a glTF file
+    struct Bytes
+    {
+        const uint8_t *data = nullptr;
+        size_t         size = 0;
+    };
+
+    /// The elements of a glTF accessor, which are \p stride bytes apart
+    struct Accessor
+    {
+        const uint8_t *data;
+        size_t         stride, count;
+        int            components, component_type;
+        bool           normalized;
+    };
+
+    enum ComponentType
+    {
+        Int8    = 5120,
+        UInt8   = 5121,
+        Int16   = 5122,
+        UInt16  = 5123,
+        UInt32  = 5125,
+        Float32 = 5126
+    };
+
+    size_t component_size(int component_type)
+    {
+        switch (component_type)
+        {
+        case Int8:
+        case UInt8: return 1;
+        case Int16:
+        case UInt16: return 2;
+        case UInt32:
+        case Float32: return 4;
+        default: throw DartsException("Unknown glTF component type {}.", component_type);
+        }
+    }
+
+    /// Read one component of type \p component_type at \p p, mapping normalized integers to [0,1] or [-1,1]
+    float read_component(const uint8_t *p, int component_type, bool normalized)
+    {
+        auto read = [p](auto value, float scale)
+        {
+            std::memcpy(&value, p, sizeof(value));
+            return scale > 0.f ? std::max(float(value) / scale, -1.f) : float(value);
+        };
+        switch (component_type)
+        {
+        case Int8: return read(int8_t(), normalized ? 127.f : 0.f);
+        case UInt8: return read(uint8_t(), normalized ? 255.f : 0.f);
+        case Int16: return read(int16_t(), normalized ? 32767.f : 0.f);
+        case UInt16: return read(uint16_t(), normalized ? 65535.f : 0.f);
+        case UInt32: return read(uint32_t(), 0.f);
+        default: return read(float(), 0.f);
+        }
+    }
+
+    /// Read element \p i of accessor \p a into \p v, which has at least as many components
+    template <typename V>
+    void read_element(const Accessor &a, size_t i, V &v)
+    {
+        const uint8_t *element = a.data + i * a.stride;
+        size_t         step    = component_size(a.component_type);
+        for (int c = 0; c < a.components; ++c)
+            v[c] = read_component(element + c * step, a.component_type, a.normalized);
+    }
+
+    uint32_t read_index(const uint8_t *p, int component_type)
+    {
+        auto read = [p](auto value)
+        {
+            std::memcpy(&value, p, sizeof(value));
+            return uint32_t(value);
+        };
+        switch (component_type)
+        {
+        case UInt8: return read(uint8_t());
+        case UInt16: return read(uint16_t());
+        case UInt32: return read(uint32_t());
+        default: throw DartsException("glTF indices should be unsigned integers.");
+        }
+    }
+
+    vector<uint8_t> decode_base64(const string &text)
+    {
+        auto value = [](char c) -> int
+        {
+            if (c >= 'A' && c <= 'Z')
+                return c - 'A';
+            if (c >= 'a' && c <= 'z')
+                return c - 'a' + 26;
+            if (c >= '0' && c <= '9')
+                return c - '0' + 52;
+            if (c == '+' || c == '-')
+                return 62;
+            if (c == '/' || c == '_')
+                return 63;
+            return -1;
+        };
+
+        vector<uint8_t> bytes;
+        bytes.reserve(text.size() / 4 * 3);
+        uint32_t bits = 0;
+        int      num_bits = 0;
+        for (char c : text)
+        {
+            int v = value(c);
+            if (v < 0)
+                continue;
+            bits = bits << 6 | uint32_t(v);
+            num_bits += 6;
+            if (num_bits >= 8)
+            {
+                num_bits -= 8;
+                bytes.push_back(uint8_t(bits >> num_bits));
+            }
+        }
+        return bytes;
+    }
+
+    /// The local transformation of a glTF node, given either as a matrix or as translation, rotation, and scale
+    Mat44f node_transform(const json &node)
+    {
+        if (node.contains("matrix"))
+        {
+            // glTF matrices are stored in column-major order, like Mat44f
+            Mat44f m;
+            for (int c = 0; c < 4; ++c)
+                for (int r = 0; r < 4; ++r)
+                    m[c][r] = node["matrix"].at(c * 4 + r).get<float>();
+            return m;
+        }
+
+        auto vec = [&node](const char *name, auto value, int n)
+        {
+            if (node.contains(name))
+                for (int i = 0; i < n && i < int(node[name].size()); ++i)
+                    value[i] = node[name][i].get<float>();
+            return value;
+        };
+        Vec3f translation = vec("translation", Vec3f(0.f), 3);
+        Vec4f rotation    = vec("rotation", Vec4f(0.f, 0.f, 0.f, 1.f), 4);
+        Vec3f scale       = vec("scale", Vec3f(1.f), 3);
+        return mul(translation_matrix(translation), mul(rotation_matrix(rotation), scaling_matrix(scale)));
+    }
+
+    /// Parse the JSON document of the glTF file \p filename, mapped by \p gltf, and find the binary chunk of a .glb
+    json parse_gltf(const string &filename, const MappedFile &gltf, Bytes &glb_buffer)
+    {
+        const uint8_t *begin = gltf.data();
+        size_t         size  = gltf.size();
+
+        // a .glb file wraps the JSON document and the first buffer in binary chunks
+        json doc;
+        try
+        {
+            if (size >= 12 && std::memcmp(begin, "glTF", 4) == 0)
+            {
+                for (size_t offset = 12; offset + 8 <= size;)
+                {
+                    uint32_t chunk_length, chunk_type;
+                    std::memcpy(&chunk_length, begin + offset, 4);
+                    std::memcpy(&chunk_type, begin + offset + 4, 4);
+                    offset += 8;
+                    if (chunk_length > size - offset)
+                        throw DartsException("glTF file '{}' is truncated.", filename);
+                    if (std::memcmp(&chunk_type, "JSON", 4) == 0)
+                        doc = json::parse(begin + offset, begin + offset + chunk_length);
+                    else if (std::memcmp(&chunk_type, "BIN\0", 4) == 0)
+                        glb_buffer = {begin + offset, chunk_length};
+                    offset += chunk_length;
+                }
+            }
+            else
+                doc = json::parse(begin, begin + size);
+        }
+        catch (const json::exception &e)
+        {
+            throw DartsException("Unable to parse glTF file '{}':\n\t{}", filename, e.what());
+        }
+        return doc;
+    }
+
+    /// The path of the external buffer \p uri of the glTF file \p filename
+    string external_buffer_path(const string &filename, const string &uri)
+    {
+        return (std::filesystem::path(filename).parent_path() / uri).string();
+    }
+} // namespace
+
+MeshData load_gltf(const string &filename, const MappedFile &gltf)
+{
+    Bytes glb_buffer;
+    json  doc = parse_gltf(filename, gltf, glb_buffer);
+
+    // resolve all buffers up front
+    vector<Bytes>                       buffers;
+    vector<std::unique_ptr<MappedFile>> external_files;
+    vector<vector<uint8_t>>             decoded;
+    for (auto &buffer : doc.value("buffers", json::array()))
+    {
+        Bytes  bytes;
+        string uri = buffer.value("uri", "");
+        if (uri.empty())
+            bytes = glb_buffer;
+        else if (uri.compare(0, 5, "data:") == 0)
+        {
+            decoded.push_back(decode_base64(uri.substr(uri.find(',') + 1)));
+            bytes = {decoded.back().data(), decoded.back().size()};
+        }
+        else
+        {
+            string path = external_buffer_path(filename, uri);
+            external_files.push_back(std::make_unique<MappedFile>(path));
+            if (!external_files.back()->valid())
+                throw DartsException("Unable to open glTF buffer '{}'!", path);
+            bytes = {external_files.back()->data(), external_files.back()->size()};
+        }
+        if (bytes.size < buffer.value("byteLength", size_t(0)))
+            throw DartsException("glTF file '{}' has a buffer that is missing or too short.", filename);
+        buffers.push_back(bytes);
+    }
+
+    auto accessor = [&](int index, int max_components)
+    {
+        const json &a = doc.at("accessors").at(index);
+        if (a.contains("sparse") || !a.contains("bufferView"))
+            throw DartsException("glTF file '{}' uses sparse or empty accessors, which are not supported.", filename);
+        const json  &view  = doc.at("bufferViews").at(a["bufferView"].get<int>());
+        const Bytes &bytes = buffers.at(view.at("buffer").get<int>());
+
+        static const map<string, int> types = {{"SCALAR", 1}, {"VEC2", 2}, {"VEC3", 3}, {"VEC4", 4}};
+        string                        type  = a.at("type");
+        Accessor                      result;
+        result.components     = types.count(type) ? types.at(type) : 0;
+        result.component_type = a.at("componentType");
+        result.normalized     = a.value("normalized", false);
+        result.count          = a.at("count");
+        if (result.components < 1 || result.components > max_components)
+            throw DartsException("glTF file '{}' has an accessor of unexpected type '{}'.", filename, type);
+
+        size_t element_size = result.components * component_size(result.component_type);
+        size_t view_offset  = view.value("byteOffset", size_t(0));
+        size_t view_length  = view.at("byteLength");
+        size_t offset       = a.value("byteOffset", size_t(0));
+        result.stride       = view.value("byteStride", element_size);
+        if (view_offset + view_length > bytes.size ||
+            (result.count && offset + result.stride * (result.count - 1) + element_size > view_length))
+            throw DartsException("glTF file '{}' has an accessor that exceeds its buffer.", filename);
+        result.data = bytes.data + view_offset + offset;
+        return result;
+    };
+
+    // collect the meshes to add, along with their transformations, by walking the node hierarchy of the scene
+    vector<pair<int, Mat44f>> instances;
+    json                      nodes = doc.value("nodes", json::array());
+    std::function<void(int, const Mat44f &, int)> visit = [&](int index, const Mat44f &parent, int depth)
+    {
+        if (depth > 256)
+            throw DartsException("glTF file '{}' has a cyclic node hierarchy.", filename);
+        const json &node  = nodes.at(index);
+        Mat44f      xform = mul(parent, node_transform(node));
+        if (node.contains("mesh"))
+            instances.emplace_back(node["mesh"].get<int>(), xform);
+        for (auto &child : node.value("children", json::array()))
+            visit(child.get<int>(), xform, depth + 1);
+    };
+    if (doc.contains("scenes") && !doc["scenes"].empty())
+    {
+        for (auto &root : doc["scenes"].at(doc.value("scene", 0)).value("nodes", json::array()))
+            visit(root.get<int>(), Mat44f(la::identity), 0);
+    }
+    else
+        // without a scene, just add every mesh as is
+        for (int m = 0; m < int(doc.value("meshes", json::array()).size()); ++m)
+            instances.emplace_back(m, Mat44f(la::identity));
+
+    MeshData data;
+    data.material_names.push_back("");
+    data.welded = true;
+
+    map<int, uint32_t> material_map;
+    bool               all_ns = true, all_uvs = true, any_ns = false, any_uvs = false, skipped = false;
+    for (auto &[mesh_index, xform] : instances)
+    {
+        Mat44f normal_xform = transpose(inverse(xform));
+        for (auto &primitive : doc.at("meshes").at(mesh_index).at("primitives"))
+        {
+            const json &attributes = primitive.at("attributes");
+            if (primitive.value("mode", 4) != 4 || !attributes.contains("POSITION"))
+            {
+                skipped = true;
+                continue;
+            }
+
+            // look up the material, naming unnamed ones by their index
+            uint32_t material = 0;
+            if (primitive.contains("material"))
+            {
+                int  index = primitive["material"].get<int>();
+                auto it    = material_map.find(index);
+                if (it == material_map.end())
+                {
+                    const json &m = doc.at("materials").at(index);
+                    it            = material_map.emplace(index, uint32_t(data.material_names.size())).first;
+                    data.material_names.push_back(m.value("name", fmt::format("material {}", index)));
+                }
+                material = it->second;
+            }
+
+            size_t   first     = data.vs.size();
+            Accessor positions = accessor(attributes["POSITION"].get<int>(), 3);
+            for (size_t i = 0; i < positions.count; ++i)
+            {
+                Vec3f p(0.f);
+                read_element(positions, i, p);
+                data.vs.push_back(mul(xform, Vec4f(p, 1.f)).xyz());
+            }
+
+            // keep the attributes aligned with the positions, even for primitives without them
+            data.ns.resize(first + positions.count, Vec3f(0.f, 0.f, 1.f));
+            if (attributes.contains("NORMAL"))
+            {
+                Accessor normals = accessor(attributes["NORMAL"].get<int>(), 3);
+                for (size_t i = 0; i < std::min(normals.count, positions.count); ++i)
+                {
+                    Vec3f n(0.f);
+                    read_element(normals, i, n);
+                    data.ns[first + i] = normalize(mul(normal_xform, Vec4f(n, 0.f)).xyz());
+                }
+                any_ns = true;
+            }
+            else
+                all_ns = false;
+
+            data.uvs.resize(first + positions.count, Vec2f(0.f));
+            if (attributes.contains("TEXCOORD_0"))
+            {
+                Accessor texcoords = accessor(attributes["TEXCOORD_0"].get<int>(), 2);
+                for (size_t i = 0; i < std::min(texcoords.count, positions.count); ++i)
+                {
+                    Vec2f uv(0.f);
+                    read_element(texcoords, i, uv);
+                    // glTF puts the origin of texture space at the top left, OBJ at the bottom left
+                    data.uvs[first + i] = Vec2f(uv.x, 1.f - uv.y);
+                }
+                any_uvs = true;
+            }
+            else
+                all_uvs = false;
+
+            // primitives without indices use each vertex once
+            bool     indexed = primitive.contains("indices");
+            Accessor indices = indexed ? accessor(primitive["indices"].get<int>(), 1) : positions;
+            auto     index   = [&](size_t i)
+            { return indexed ? read_index(indices.data + i * indices.stride, indices.component_type) : uint32_t(i); };
+
+            for (size_t i = 0; i + 2 < indices.count; i += 3)
+            {
+                uint32_t v[3] = {index(i), index(i + 1), index(i + 2)};
+                if (v[0] >= positions.count || v[1] >= positions.count || v[2] >= positions.count)
+                    throw DartsException("glTF file '{}' refers to a missing vertex.", filename);
+                data.Fv.push_back(Vec3i(int(first + v[0]), int(first + v[1]), int(first + v[2])));
+                data.Fm.push_back(material);
+            }
+        }
+    }
+
+    if (skipped)
+        spdlog::warn("Skipped glTF primitives in '{}' that are not triangle lists.", filename);
+
+    // attributes are indexed by the vertex indices, so they have to be given for all primitives or dropped
+    if (any_ns && !all_ns)
+        spdlog::warn("Only some primitives in '{}' have normals; ignoring all normals.", filename);
+    if (any_uvs && !all_uvs)
+        spdlog::warn("Only some primitives in '{}' have texture coordinates; ignoring all of them.", filename);
+    if (!all_ns)
+        data.ns.clear();
+    if (!all_uvs)
+        data.uvs.clear();
+
+    return data;
+}
+
+vector<string> gltf_external_buffers(const string &filename, const MappedFile &gltf)
+{
+    Bytes          glb_buffer;
+    json           doc = parse_gltf(filename, gltf, glb_buffer);
+    vector<string> paths;
+    for (auto &buffer : doc.value("buffers", json::array()))
+    {
+        string uri = buffer.value("uri", "");
+        if (!uri.empty() && uri.compare(0, 5, "data:") != 0)
+            paths.push_back(external_buffer_path(filename, uri));
+    }
+    return paths;
+}
+
+/**
+    A triangle mesh loaded from a glTF 2.0 file (.gltf or .glb).
+
+    It accepts the same fields as #Mesh, except that the "filename" is a glTF file read by #load_gltf. Materials are
+    looked up by the names of the glTF materials, prepended by the optional "material prefix". If "cache" is enabled,
+    the contents of the external buffers listed by #gltf_external_buffers are part of the cache key, along with the
+    .gltf file itself.
+
+    \ingroup Surfaces
+*/
+struct GltfMesh : public Mesh
+{
+    GltfMesh(const json &j) : Mesh(j, load_gltf, gltf_external_buffers)
+    {
+    }
+};
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Surface, GltfMesh, "gltf")
+
+/**
+    \file
+    \brief glTF mesh loading
+*/
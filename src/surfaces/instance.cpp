@@ -0,0 +1,120 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/material.h>
+#include <darts/stats.h>
+#include <darts/surface_group.h>
+
+STAT_COUNTER("Instancing/Instances", num_instances);
+STAT_COUNTER("Instancing/Unique prototypes", num_prototypes);
+
+/**
+    A transformed reference to a shared, separately accelerated group of surfaces. \ingroup Surfaces
+
+    The "prototype" field describes the referenced surface in its own object space. All instances whose prototypes have
+    identical descriptions, and whose named materials are the same objects, share a single bottom-level acceleration
+    structure, which is built only once, so memory scales with the number of unique prototypes instead of the number
+    of placements. The scene's accelerator then only needs to be built over the instances' bounds.
+
+    An optional "material" replaces the material of every surface hit through this instance, so that differently
+    colored placements of the same mesh can still share one prototype.
+*/
+class Instance : public XformedSurface
+{
+public:
+    Instance(const json &j = json::object());
+
+    bool  intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool  occluded(const Ray3f &ray) const override;
+    Box3f local_bounds() const override;
+
+protected:
+    /// Return the bottom-level accelerator for \p prototype, creating and building it on first use
+    static shared_ptr<const Surface> find_prototype(const json &prototype, const json &accelerator);
+
+    shared_ptr<const Surface>  m_prototype; ///< The shared bottom-level accelerator, in object space
+    shared_ptr<const Material> m_material;  ///< If set, overrides the material of the prototype's surfaces
+};
+
+Instance::Instance(const json &j) : XformedSurface(j)
+{
+    if (!j.contains("prototype") || !j["prototype"].is_object())
+        throw DartsException("Instance requires a \"prototype\" surface definition here:\n{}", j.dump(4));
+
+    m_prototype = find_prototype(j["prototype"], j.value("accelerator", json{{"type", "bbh"}}));
+
+    if (j.contains("material"))
+        m_material = DartsFactory<Material>::find(j);
+
+    ++num_instances;
+}
+
+shared_ptr<const Surface> Instance::find_prototype(const json &prototype, const json &accelerator)
+{
+    // Only weak references are kept, so a prototype is freed along with the last scene that instances it
+    static map<string, std::weak_ptr<const Surface>> prototypes;
+    for (auto it = prototypes.begin(); it != prototypes.end();)
+        it = it->second.expired() ? prototypes.erase(it) : std::next(it);
+
+    // the prototype's surfaces look up named materials when they are created, so the same description only yields
+    // the same prototype if the names still refer to the same materials, which differ between scenes
+    string key = accelerator.dump() + prototype.dump();
+    for (auto &[name, material] : DartsFactory<Material>::registered_instances())
+        key += fmt::format("\n{}: {}", name, (const void *)material.get());
+
+    auto found = prototypes.find(key);
+    if (found != prototypes.end())
+        if (auto existing = found->second.lock())
+            return existing;
+
+    auto blas    = DartsFactory<SurfaceGroup>::create(accelerator);
+    auto surface = DartsFactory<Surface>::create(prototype);
+    surface->add_to_parent(blas.get(), surface, prototype);
+    surface->build();
+    blas->build();
+
+    if (surface->is_emissive())
+        spdlog::warn("Emissive surfaces are not sampled as lights when they are instanced.");
+
+    ++num_prototypes;
+    prototypes[key] = blas;
+    return blas;
+}
+
+bool Instance::intersect(const Ray3f &ray_, HitInfo &hit) const
+{
+    // transform the ray into the prototype's object space; the direction is not renormalized, so t is unchanged
+    auto ray = m_xform.inverse().ray(ray_);
+    if (!m_prototype->intersect(ray, hit))
+        return false;
+
+    // transform the hit information back
+    hit.p  = m_xform.point(hit.p);
+    hit.gn = normalize(m_xform.normal(hit.gn));
+    hit.sn = normalize(m_xform.normal(hit.sn));
+    if (m_material)
+        hit.mat = m_material.get();
+
+    return true;
+}
+
+bool Instance::occluded(const Ray3f &ray) const
+{
+    return m_prototype->occluded(m_xform.inverse().ray(ray));
+}
+
+Box3f Instance::local_bounds() const
+{
+    return m_prototype->bounds();
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Surface, Instance, "instance")
+
+/**
+    \file
+    \brief Instance Surface
+*/
@@ -0,0 +1,389 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/stats.h>
+#include <darts/surface_group.h>
+
+STAT_COUNTER("Light tree/Emitters", num_tree_emitters);
+STAT_COUNTER("Light tree/Nodes", num_tree_nodes);
+
+namespace
+{
+    float safe_acos(float x)
+    {
+        return std::acos(clamp(x, -1.f, 1.f));
+    }
+
+    float safe_sqrt(float x)
+    {
+        return std::sqrt(std::max(0.f, x));
+    }
+
+    /// cos(max(0, a - b)), given the sines and cosines of the angles a and b in [0, pi]
+    float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        return cos_a > cos_b ? 1.f : cos_a * cos_b + sin_a * sin_b;
+    }
+
+    /// sin(max(0, a - b)), given the sines and cosines of the angles a and b in [0, pi]
+    float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        return cos_a > cos_b ? 0.f : sin_a * cos_b - cos_a * sin_b;
+    }
+
+    /// The smallest cone that contains both cones \p a and \p b
+    DirectionCone merge(const DirectionCone &a, const DirectionCone &b)
+    {
+        float theta_a = safe_acos(a.cos_theta), theta_b = safe_acos(b.cos_theta);
+        float theta_d = safe_acos(dot(a.axis, b.axis));
+        if (std::min(theta_d + theta_b, float(M_PI)) <= theta_a)
+            return a;
+        if (std::min(theta_d + theta_a, float(M_PI)) <= theta_b)
+            return b;
+
+        float theta_o = (theta_a + theta_d + theta_b) / 2;
+        Vec3f k       = cross(a.axis, b.axis);
+        if (theta_o >= float(M_PI) || length2(k) == 0.f)
+            return DirectionCone();
+
+        // rotate the axis of a towards b, using Rodrigues' formula
+        k             = normalize(k);
+        float theta_r = theta_o - theta_a;
+        Vec3f axis    = a.axis * std::cos(theta_r) + cross(k, a.axis) * std::sin(theta_r) +
+                     k * dot(k, a.axis) * (1 - std::cos(theta_r));
+        return {normalize(axis), std::cos(theta_o)};
+    }
+
+    /**
+        The spatial extent, orientation and power of a set of emitters.
+
+        All emitters are assumed to be diffuse, so they emit light within 90 degrees of the normals bounded by #cone.
+    */
+    struct LightBounds
+    {
+        Box3f         bounds;
+        DirectionCone cone;
+        float         power = 0.f;
+
+        LightBounds() = default;
+
+        explicit LightBounds(const Surface &emitter) :
+            bounds(emitter.bounds()), cone(emitter.normal_cone()), power(std::max(0.f, emitter.emitted_power()))
+        {
+            // degenerate emitters might not have a well-defined normal
+            if (!std::isfinite(length2(cone.axis)))
+                cone = DirectionCone();
+        }
+
+        void enclose(const LightBounds &other)
+        {
+            if (other.power == 0.f)
+                return;
+            if (power == 0.f)
+            {
+                *this = other;
+                return;
+            }
+            bounds.enclose(other.bounds);
+            cone = merge(cone, other.cone);
+            power += other.power;
+        }
+
+        /**
+            Conservatively estimate the light the emitters contribute at point \p p.
+
+            This bounds the cosine at the emitters using the smallest angle between a direction towards \p p from the
+            bounding box and the normal cone, and divides the power by the squared distance to the center of the box.
+        */
+        float importance(const Vec3f &p) const
+        {
+            if (power == 0.f)
+                return 0.f;
+
+            Vec3f center = bounds.center();
+            float dist2  = std::max(length2(p - center), length(bounds.diagonal()) / 2);
+
+            // the angle from the cone axis to the direction from the center towards p
+            Vec3f wi    = normalize(p - center);
+            float cos_w = std::isfinite(wi.x) ? dot(cone.axis, wi) : 1.f;
+            float sin_w = safe_sqrt(1 - cos_w * cos_w);
+            float sin_o = safe_sqrt(1 - cone.cos_theta * cone.cos_theta);
+            float cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, cone.cos_theta);
+            float sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, cone.cos_theta);
+
+            // the half-angle that the bounding sphere of the box subtends as seen from p
+            float radius2 = length2(bounds.diagonal()) / 4;
+            float cos_b   = length2(p - center) < radius2 ? -1.f : safe_sqrt(1 - radius2 / length2(p - center));
+            float sin_b   = safe_sqrt(1 - cos_b * cos_b);
+
+            float cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+            if (cos_p <= 0.f)
+                return 0.f;
+
+            return power * cos_p / dist2;
+        }
+    };
+
+    /// The solid angle measure of the directions that emitters with normals in \p cone emit light into
+    float cone_measure(const DirectionCone &cone)
+    {
+        float theta_o = safe_acos(cone.cos_theta);
+        float theta_w = std::min(theta_o + float(M_PI) / 2, float(M_PI));
+        float sin_o   = safe_sqrt(1 - cone.cos_theta * cone.cos_theta);
+        return 2 * float(M_PI) * (1 - cone.cos_theta) +
+               float(M_PI) / 2 *
+                   (2 * theta_w * sin_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_o + cone.cos_theta);
+    }
+
+    struct LightTreeNode
+    {
+        LightBounds bounds;
+        uint32_t    parent;
+        uint32_t    index; ///< Index of the second child for interior nodes, or of the emitter for leaves
+        bool        leaf;
+    };
+} // namespace
+
+/**
+    An emitter group that picks the emitter for each shading point by its estimated contribution.
+
+    The emitters are organized in a binary tree whose nodes bound the position, normals and power of the emitters
+    below them. Sampling walks down the tree, choosing each child in proportion to its #LightBounds::importance for the
+    shading point, so distant emitters and emitters facing away receive few or no samples. The probability of picking a
+    given emitter is computed by walking back up from its leaf, so #pdf and #emitter_pdf are exact.
+
+    Select it with the top-level "light sampler" field of the scene, e.g. "light sampler": {"type": "light tree"}.
+    Since the tree needs a shading point, #sample_child still picks emitters by their power alone.
+
+    \ingroup Surfaces
+*/
+class LightTree : public SurfaceGroup
+{
+public:
+    LightTree(const json &j = json::object()) : SurfaceGroup(j)
+    {
+    }
+
+    void build() override;
+    void refit() override;
+
+    Color3f sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const override;
+    float   pdf(const Vec3f &o, const Vec3f &v) const override;
+    float   emitter_prob(const Surface *emitter, const Vec3f &o) const override;
+
+protected:
+    /// Add the nodes over emitters \p begin to \p end to #m_nodes, and return the index of the subtree's root
+    uint32_t build_recursive(vector<pair<LightBounds, uint32_t>>::iterator begin,
+                             vector<pair<LightBounds, uint32_t>>::iterator end, uint32_t parent);
+
+    vector<LightTreeNode> m_nodes;  ///< The nodes in depth-first order, so the first child follows its parent
+    vector<uint32_t>      m_leaves; ///< Index into #m_nodes of the leaf of each child
+};
+
+void LightTree::build()
+{
+    // the power-weighted alias table and the index of the children serve #sample_child and #emitter_prob
+    SurfaceGroup::build();
+
+    m_nodes.clear();
+    m_leaves.assign(m_surfaces.size(), 0);
+    if (m_surfaces.empty())
+        return;
+
+    vector<pair<LightBounds, uint32_t>> emitters(m_surfaces.size());
+    for (uint32_t i = 0; i < m_surfaces.size(); ++i)
+        emitters[i] = {LightBounds(*m_surfaces[i]), i};
+
+    m_nodes.reserve(2 * emitters.size() - 1);
+    build_recursive(emitters.begin(), emitters.end(), 0);
+
+    num_tree_emitters += m_surfaces.size();
+    num_tree_nodes += m_nodes.size();
+}
+
+uint32_t LightTree::build_recursive(vector<pair<LightBounds, uint32_t>>::iterator begin,
+                                    vector<pair<LightBounds, uint32_t>>::iterator end, uint32_t parent)
+{
+    uint32_t index = uint32_t(m_nodes.size());
+    m_nodes.push_back(LightTreeNode{LightBounds(), parent, 0, false});
+
+    if (end - begin == 1)
+    {
+        m_nodes[index] = LightTreeNode{begin->first, parent, begin->second, true};
+        m_leaves[begin->second] = index;
+        return index;
+    }
+
+    LightBounds bounds;
+    Box3f       centroids;
+    for (auto it = begin; it != end; ++it)
+    {
+        bounds.enclose(it->first);
+        centroids.enclose(it->first.bounds.center());
+    }
+
+    // find the split with the lowest cost among a fixed number of buckets along each axis, weighting the power of each
+    // side by its orientation and surface area
+    constexpr int num_buckets = 12;
+    float         best_cost   = std::numeric_limits<float>::infinity();
+    int           best_axis = -1, best_bucket = -1;
+    Vec3f         extent = centroids.diagonal();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (extent[axis] <= 0.f)
+            continue;
+
+        auto bucket_of = [&](const LightBounds &b)
+        {
+            int bucket = int(num_buckets * (b.bounds.center()[axis] - centroids.min[axis]) / extent[axis]);
+            return clamp(bucket, 0, num_buckets - 1);
+        };
+
+        LightBounds buckets[num_buckets];
+        for (auto it = begin; it != end; ++it)
+            buckets[bucket_of(it->first)].enclose(it->first);
+
+        auto cost = [](const LightBounds &b)
+        { return b.power == 0.f ? 0.f : b.power * cone_measure(b.cone) * b.bounds.area(); };
+
+        // forward sweep: the cost of the buckets below (and including) each split
+        float       below_cost[num_buckets];
+        LightBounds below;
+        for (int split = 0; split < num_buckets - 1; ++split)
+        {
+            below.enclose(buckets[split]);
+            below_cost[split] = cost(below);
+        }
+
+        // backward sweep: add the cost of the buckets above each split. Elongated boxes are favored for splitting
+        // along their long axis
+        float       kr = maxelem(bounds.bounds.diagonal()) / bounds.bounds.diagonal()[axis];
+        LightBounds above;
+        for (int split = num_buckets - 2; split >= 0; --split)
+        {
+            above.enclose(buckets[split + 1]);
+            float split_cost = kr * (below_cost[split] + cost(above));
+            if (split_cost < best_cost)
+            {
+                best_cost   = split_cost;
+                best_axis   = axis;
+                best_bucket = split;
+            }
+        }
+    }
+
+    auto mid = begin + (end - begin) / 2;
+    if (best_axis >= 0)
+    {
+        int   axis = best_axis;
+        float pos  = centroids.min[axis] + extent[axis] * (best_bucket + 1) / num_buckets;
+        mid        = std::partition(begin, end, [&](const pair<LightBounds, uint32_t> &e)
+                                    { return e.first.bounds.center()[axis] < pos; });
+    }
+    if (mid == begin || mid == end)
+    {
+        // all emitters fell on one side of the split, so just split them in half
+        mid = begin + (end - begin) / 2;
+        std::nth_element(begin, mid, end,
+                         [axis = la::argmax(extent)](const auto &a, const auto &b)
+                         { return a.first.bounds.center()[axis] < b.first.bounds.center()[axis]; });
+    }
+
+    build_recursive(begin, mid, index);
+    uint32_t second = build_recursive(mid, end, index);
+    m_nodes[index]  = LightTreeNode{bounds, parent, second, false};
+    return index;
+}
+
+void LightTree::refit()
+{
+    SurfaceGroup::refit();
+    if (!m_nodes.empty())
+        build();
+}
+
+Color3f LightTree::sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const
+{
+    if (m_nodes.empty())
+        return SurfaceGroup::sample(rec, rv, rv1);
+
+    // walk down the tree, choosing each child in proportion to its importance and remapping rv1 for reuse
+    float    prob  = 1.f;
+    uint32_t index = 0;
+    while (!m_nodes[index].leaf)
+    {
+        float first  = m_nodes[index + 1].bounds.importance(rec.o);
+        float second = m_nodes[m_nodes[index].index].bounds.importance(rec.o);
+        if (first + second <= 0.f)
+        {
+            // no emitter can illuminate rec.o
+            rec.emitter = nullptr;
+            rec.wi      = Vec3f(0, 0, 1);
+            rec.pdf     = 0.f;
+            return Color3f(0.f);
+        }
+
+        // the probabilities are computed exactly like in #emitter_prob(), so the pdfs match
+        float p_first = first / (first + second), p_second = second / (first + second);
+        if (rv1 < p_first)
+        {
+            rv1 = std::min(rv1 / p_first, 1.f - std::numeric_limits<float>::epsilon());
+            prob *= p_first;
+            index = index + 1;
+        }
+        else
+        {
+            rv1 = std::min((rv1 - p_first) / p_second, 1.f - std::numeric_limits<float>::epsilon());
+            prob *= p_second;
+            index = m_nodes[index].index;
+        }
+    }
+
+    auto color = m_surfaces[m_nodes[index].index]->sample(rec, rv, rv1);
+    rec.pdf *= prob;
+    return color / prob;
+}
+
+float LightTree::emitter_prob(const Surface *emitter, const Vec3f &o) const
+{
+    if (m_nodes.empty())
+        return SurfaceGroup::emitter_prob(emitter, o);
+
+    auto it = m_child_index.find(emitter);
+    if (it == m_child_index.end())
+        return 0.f;
+
+    // walk up from the emitter's leaf, multiplying the probabilities of the choices #sample() makes on the way down
+    float    prob  = 1.f;
+    uint32_t index = m_leaves[it->second];
+    while (index != 0)
+    {
+        uint32_t parent  = m_nodes[index].parent;
+        uint32_t sibling = index == parent + 1 ? m_nodes[parent].index : parent + 1;
+        float    own = m_nodes[index].bounds.importance(o), other = m_nodes[sibling].bounds.importance(o);
+        if (own <= 0.f)
+            return 0.f;
+        prob *= own / (own + other);
+        index = parent;
+    }
+    return prob;
+}
+
+float LightTree::pdf(const Vec3f &o, const Vec3f &v) const
+{
+    float sum = 0.f;
+    for (auto &surface : m_surfaces)
+        sum += emitter_pdf(surface.get(), o, v);
+    return sum;
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(SurfaceGroup, LightTree, "light tree")
+
+/**
+    \file
+    \brief LightTree emitter group
+*/
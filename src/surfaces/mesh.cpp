@@ -5,179 +5,207 @@
 */
 
 #include <darts/factory.h>
+#include <darts/mapped_file.h>
 #include <darts/mesh.h>
+#include <darts/mesh_cache.h>
+#include <darts/mesh_loaders.h>
+#include <darts/packing.h>
+#include <darts/parallel.h>
 #include <darts/progress.h>
 #include <darts/stats.h>
 #include <darts/triangle.h>
 #include <filesystem/resolver.h>
+#include <filesystem>
 #include <fstream>
 #include <unordered_map>
 
-#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cpp file
-#include <tiny_obj_loader.h>
-
 STAT_RATIO("Geometry/Triangles per mesh", num_triangles, num_tri_meshes);
 STAT_MEMORY_COUNTER("Memory/Triangles", triangle_bytes);
+STAT_MEMORY_COUNTER("Memory/Mesh BBHs", mesh_bbh_bytes);
+STAT_MEMORY_COUNTER("Memory/Mesh BBH nodes", mesh_bbh_node_bytes);
+STAT_RATIO("BBH/Mesh nodes visited per ray", mesh_nodes_visited, mesh_rays);
+
+namespace
+{
+    /// Look up the scene's material called \p name, falling back to \p default_material if there is none
+    shared_ptr<const Material> find_material(const string &name, shared_ptr<const Material> default_material)
+    {
+        try
+        {
+            return DartsFactory<Material>::find(json::object({{"material", name}}));
+        }
+        catch (const std::exception &e)
+        {
+            spdlog::warn("When loading a mesh: {}\n\tUsing default material instead.\n", e.what());
+            return default_material;
+        }
+    }
+
+    /**
+        Transform the positions \p vs and normals \p ns by \p xform in place, computing the bounds of the positions
+        before (\p bbox_o) and after (\p bbox_w) the transformation.
+
+        The matrices are unpacked once and applied to blocks of elements in parallel, in plain loops that the compiler
+        can vectorize, instead of through a per-element call to Transform::point and Transform::normal.
+    */
+    void transform_geometry(const Transform &xform, vector<Vec3f> &vs, vector<Vec3f> &ns, Box3f &bbox_o, Box3f &bbox_w)
+    {
+        constexpr uint32_t block_size = 16384;
 
-Mesh::Mesh(const json &j)
+        // positions are transformed by the affine part of the matrix, normals by the transposed inverse
+        const Mat44f &m = xform.m;
+        const Mat44f &n = xform.m_inv;
+        float         a[3][4], b[3][3];
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 4; ++c)
+                a[r][c] = m[c][r];
+            for (int c = 0; c < 3; ++c)
+                b[r][c] = n[r][c];
+        }
+
+        uint32_t      num_blocks = uint32_t((vs.size() + block_size - 1) / block_size);
+        vector<Box3f> boxes_o(num_blocks), boxes_w(num_blocks);
+        parallel_for(blocked_range<uint32_t>(0, num_blocks, 1),
+                     [&](blocked_range<uint32_t> range)
+                     {
+                         for (uint32_t blk = range.begin(); blk != range.end(); ++blk)
+                         {
+                             size_t end = std::min(vs.size(), size_t(blk + 1) * block_size);
+                             for (size_t i = size_t(blk) * block_size; i < end; ++i)
+                             {
+                                 Vec3f p = vs[i];
+                                 boxes_o[blk].enclose(p);
+                                 for (int r = 0; r < 3; ++r)
+                                     vs[i][r] = a[r][0] * p.x + a[r][1] * p.y + a[r][2] * p.z + a[r][3];
+                                 boxes_w[blk].enclose(vs[i]);
+                             }
+                         }
+                     });
+        for (uint32_t blk = 0; blk < num_blocks; ++blk)
+        {
+            bbox_o.enclose(boxes_o[blk]);
+            bbox_w.enclose(boxes_w[blk]);
+        }
+
+        parallel_for(blocked_range<uint32_t>(0, uint32_t((ns.size() + block_size - 1) / block_size), 1),
+                     [&](blocked_range<uint32_t> range)
+                     {
+                         for (uint32_t blk = range.begin(); blk != range.end(); ++blk)
+                         {
+                             size_t end = std::min(ns.size(), size_t(blk + 1) * block_size);
+                             for (size_t i = size_t(blk) * block_size; i < end; ++i)
+                             {
+                                 Vec3f v = ns[i];
+                                 for (int r = 0; r < 3; ++r)
+                                     ns[i][r] = b[r][0] * v.x + b[r][1] * v.y + b[r][2] * v.z;
+                                 ns[i] = normalize(ns[i]);
+                             }
+                         }
+                     });
+    }
+} // namespace
+
+Mesh::Mesh(const json &j) : Mesh(j, load_obj)
+{
+}
+
+Mesh::Mesh(const json &j, MeshLoader load, MeshDependencies dependencies)
 {
     string filename = get_file_resolver().resolve(j.at("filename").get<string>()).str();
 
     std::ifstream is(filename);
     if (is.fail())
-        throw DartsException("Unable to open OBJ file '{}'!", filename);
+        throw DartsException("Unable to open mesh file '{}'!", filename);
 
     Progress progress(fmt ::format("Loading '{}'", filename));
 
-    xform = j.value("transform", xform);
-    string warn;
-    string err;
-
-    struct UserData
+    xform        = j.value("transform", xform);
+    accelerate   = j.value("accelerate", accelerate);
+    bbh_settings = BBHSettings(j.value("bbh", json::object()));
+    simd_width   = j.value("simd", simd_width);
+    quantize     = j.value("quantize", quantize);
+    if (simd_width != 0 && simd_width != 4 && simd_width != 8)
     {
-        Mesh            *mesh;
-        uint32_t         current_material_idx;
-        map<string, int> material_map;
-        string           material_prefix;
-    } data;
-
-    data.mesh                 = this;
-    data.current_material_idx = 0;
-
-    data.material_prefix = j.value("material prefix", "");
-    if (data.material_prefix != "")
-        spdlog::info("Prepending the string \"{}\" to all mesh material names", data.material_prefix);
+        spdlog::error("\"simd\" should be 0, 4, or 8, but is {}. Using {} instead.", simd_width,
+                      native_triangle_block_width);
+        simd_width = native_triangle_block_width;
+    }
+    // a whole block is tested at about the cost of a single triangle, so let the leaves fill up a block
+    if (simd_width > 0 && !j.value("bbh", json::object()).contains("max_leaf_size"))
+        bbh_settings.max_leaf_size = simd_width;
+
+    weld_vertices = j.value("weld", weld_vertices);
+    pack_normals  = j.value("pack normals", pack_normals);
+    half_uvs      = j.value("half uvs", half_uvs);
+
+    string material_prefix = j.value("material prefix", "");
+    if (material_prefix != "")
+        spdlog::info("Prepending the string \"{}\" to all mesh material names", material_prefix);
 
     // create a default material used for any faces that don't have a material set
     // this will be the material with index 0
     auto default_material = DartsFactory<Material>::find(j);
     materials.push_back(default_material);
+    material_names.push_back("");
 
-    tinyobj::callback_t cb;
-
-    cb.vertex_cb = [](void *user_data, float x, float y, float z, float w)
-    {
-        UserData *data = reinterpret_cast<UserData *>(user_data);
-        Mesh     *mesh = data->mesh;
-        Vec3f     v{x, y, z};
-        mesh->bbox_o.enclose(v);
-        mesh->vs.push_back(mesh->xform.point(v));
-        mesh->bbox_w.enclose(mesh->vs.back());
-    };
-
-    cb.normal_cb = [](void *user_data, float x, float y, float z)
-    {
-        UserData *data = reinterpret_cast<UserData *>(user_data);
-        Mesh     *mesh = data->mesh;
-        // printf("vn[%ld] = %f, %f, %f\n", mesh->ns.size(), x, y, z);
-
-        mesh->ns.push_back(normalize(mesh->xform.normal(Vec3f(x, y, z))));
-    };
-
-    cb.texcoord_cb = [](void *user_data, float x, float y, float z)
-    {
-        UserData *data = reinterpret_cast<UserData *>(user_data);
-        Mesh     *mesh = data->mesh;
-        // spdlog::info("vt[{}] = {}, {}, {}", mesh->uvs.size(), x, y, z);
-
-        mesh->uvs.push_back(Vec2f(x, y));
-    };
+    MappedFile file(filename);
 
-    cb.index_cb = [](void *user_data, tinyobj::index_t *indices, int num_indices)
+    json cache = j.value("cache", json(false));
+    if (cache.is_string() || cache == true)
     {
-        // NOTE: the value of each index is the raw value. For example, the application must manually adjust the index
-        // with offset (e.g. v_indices.size()) when the value is negative (which means relative index). Also, the first
-        // index starts with 1, not 0. See fixIndex() function in tiny_obj_loader.h for details. Also, 0 is set for the
-        // index value which does not exist in the .obj file
-        UserData *data = reinterpret_cast<UserData *>(user_data);
-        Mesh     *mesh = data->mesh;
-
-        if (num_indices < 3)
-            throw DartsException("Polygons must have at least 3 indices");
-
-        tinyobj::index_t idx0 = indices[0], idx1 = indices[1], idx2;
-
-        // compute the indices for the first two vertices outside the loop
-        tinyobj::fixIndex(idx0.vertex_index, int(mesh->vs.size()), &idx0.vertex_index);
-        tinyobj::fixIndex(idx0.normal_index, int(mesh->ns.size()), &idx0.normal_index);
-        tinyobj::fixIndex(idx0.texcoord_index, int(mesh->uvs.size()), &idx0.texcoord_index);
-
-        tinyobj::fixIndex(idx1.vertex_index, int(mesh->vs.size()), &idx1.vertex_index);
-        tinyobj::fixIndex(idx1.normal_index, int(mesh->ns.size()), &idx1.normal_index);
-        tinyobj::fixIndex(idx1.texcoord_index, int(mesh->uvs.size()), &idx1.texcoord_index);
-
-        // just create a naive triangle fan from the first vertex
-        // each iteration just computes the indices for the one additional vertex
-        for (int i = 2; i < num_indices; i++)
+        namespace fs = std::filesystem;
+        fs::path dir = cache.is_string() ? fs::path(get_file_resolver().resolve(cache.get<string>()).str())
+                                         : fs::path(filename).parent_path();
+        cache_key    = mesh_cache_key(file, dependencies ? dependencies(filename, file) : vector<string>(), *this);
+        cache_file   = (dir / fmt::format("{}-{:016x}.dmesh", fs::path(filename).stem().string(), cache_key)).string();
+
+        cached_geometry = read_mesh_cache(cache_file, cache_key, *this);
+        cached_bbh      = cached_geometry && (!bbh_nodes.empty() || !quantized_bbh.nodes.empty());
+        if (cached_geometry)
         {
-            if (!mesh->vs.size() || indices[0].vertex_index == 0 || indices[i - 1].vertex_index == 0 ||
-                indices[i].vertex_index == 0)
-                throw DartsException("Missing vertex index for triangle");
-
-            idx2 = indices[i];
-
-            // add the vertex and material indices
-            tinyobj::fixIndex(idx2.vertex_index, int(mesh->vs.size()), &idx2.vertex_index);
-            mesh->Fv.push_back({idx0.vertex_index, idx1.vertex_index, idx2.vertex_index});
-            mesh->Fm.push_back(data->current_material_idx);
-
-            // now optionally add the normal and texture indices
-
-            // if we have normals and three valid normal indices
-            if (mesh->ns.size() && indices[0].normal_index != 0 && indices[i - 1].normal_index != 0 &&
-                indices[i].normal_index != 0)
-            {
-                tinyobj::fixIndex(idx2.normal_index, int(mesh->ns.size()), &idx2.normal_index);
-                mesh->Fn.push_back({idx0.normal_index, idx1.normal_index, idx2.normal_index});
-            }
-
-            // if we have texture coordinates and three valid texture indices
-            if (mesh->uvs.size() && indices[0].texcoord_index != 0 && indices[i - 1].texcoord_index != 0 &&
-                indices[i].texcoord_index != 0)
-            {
-                tinyobj::fixIndex(idx2.texcoord_index, int(mesh->uvs.size()), &idx2.texcoord_index);
-                mesh->Ft.push_back({idx0.texcoord_index, idx1.texcoord_index, idx2.texcoord_index});
-            }
-
-            idx1 = idx2;
+            spdlog::info("Read mesh cache file '{}'.", cache_file);
+            for (size_t i = 1; i < material_names.size(); ++i)
+                materials.push_back(find_material(material_prefix + material_names[i], default_material));
         }
-    };
+    }
 
-    cb.usemtl_cb = [](void *user_data, const char *name, int material_idx)
+    // a cached mesh skips parsing altogether
+    if (!cached_geometry)
     {
-        UserData *data = reinterpret_cast<UserData *>(user_data);
-        Mesh     *mesh = data->mesh;
+        MeshData data = load(filename, file);
 
-        string full_name = data->material_prefix + name;
-
-        // check if we've already added a material with this name to the mesh
-        auto it = data->material_map.find(full_name);
-        if (it != data->material_map.end())
-            data->current_material_idx = it->second;
-        else
+        // look up the materials in the scene description, in order of first use; keep an index for missing materials
+        // as well, so that a cached mesh can look them up again later
+        vector<uint16_t> material_map(data.material_names.size(), 0);
+        for (size_t i = 1; i < data.material_names.size(); ++i)
         {
-            // try to find a material with the given name in the scene description and add it to the mesh's materials
-            try
+            string full_name = material_prefix + data.material_names[i];
+            if (materials.size() > std::numeric_limits<uint16_t>::max())
             {
-                data->mesh->materials.push_back(
-                    DartsFactory<Material>::find(json::object({{"material", string(full_name)}})));
-                data->material_map[full_name] = data->current_material_idx = data->mesh->materials.size() - 1;
-            }
-            catch (const std::exception &e)
-            {
-                spdlog::warn("When parsing OBJ file: {}\n\tUsing default material instead.\n", e.what());
-                data->material_map[full_name] = data->current_material_idx = 0;
+                spdlog::warn("When loading '{}': more than {} materials.\n\tUsing default material for \"{}\".\n",
+                             filename, materials.size(), full_name);
+                continue;
             }
+            material_map[i] = uint16_t(materials.size());
+            materials.push_back(find_material(full_name, default_material));
+            material_names.push_back(data.material_names[i]);
         }
-    };
 
-    cb.mtllib_cb = [](void *user_data, const tinyobj::material_t *materials, int num_materials)
-    {
-        UserData *data = reinterpret_cast<UserData *>(user_data);
-        Mesh     *mesh = data->mesh;
-    };
-
-    bool ret = tinyobj::LoadObjWithCallback(is, cb, &data, nullptr, &warn, &err);
+        Fm.resize(data.Fm.size());
+        for (size_t f = 0; f < Fm.size(); ++f)
+            Fm[f] = material_map[data.Fm[f]];
+        data.Fm = vector<uint32_t>();
+
+        vs  = std::move(data.vs);
+        ns  = std::move(data.ns);
+        uvs = std::move(data.uvs);
+        Fv  = std::move(data.Fv);
+        Fn  = std::move(data.Fn);
+        Ft  = std::move(data.Ft);
+        welded = data.welded;
+        transform_geometry(xform, vs, ns, bbox_o, bbox_w);
+    }
 
     progress.set_done();
 
@@ -186,11 +214,13 @@ Mesh::Mesh(const json &j)
     auto m           = mul(scaling_matrix(la::select(equal(d, 0.f), 1.f, 1.f / d)), translation_matrix(-bbox_o.min));
     object_to_texture = Transform(m);
 
-    if (!warn.empty())
-        spdlog::warn("{}\n", warn);
-
-    if (!err.empty() || !ret)
-        throw DartsException("Unable to open OBJ file '{}'!\n\t{}", filename, err);
+    // a cached mesh is already in its compact form
+    if (!cached_geometry)
+    {
+        if (weld_vertices)
+            weld();
+        pack_attributes();
+    }
 
     spdlog::debug(
         R"(
@@ -219,21 +249,618 @@ Mesh::Mesh(const json &j)
 size_t Mesh::size() const
 {
     return vs.capacity() * sizeof(Vec3f) + ns.capacity() * sizeof(Vec3f) + uvs.capacity() * sizeof(Vec2f) +
+           packed_ns.capacity() * sizeof(uint32_t) + packed_uvs.capacity() * sizeof(uint32_t) +
            Fv.capacity() * sizeof(Vec3i) + Fn.capacity() * sizeof(Vec3i) + Ft.capacity() * sizeof(Vec3i) +
-           Fm.capacity() * sizeof(uint32_t);
+           Fm.capacity() * sizeof(uint16_t);
+}
+
+void Mesh::weld()
+{
+    bool has_ns  = !Fn.empty();
+    bool has_uvs = !Ft.empty();
+    if (welded || (has_ns && Fn.size() != Fv.size()) || (has_uvs && Ft.size() != Fv.size()))
+    {
+        if (!welded)
+            spdlog::info("Only some faces of the mesh have normals or texture coordinates; not welding its vertices.");
+        return;
+    }
+
+    // chain together the welded vertices that share a position, so that each corner is only compared with those
+    constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+    vector<uint32_t>   first(vs.size(), none), next;
+    vector<Vec2i>      source; // the normal and texture coordinate index of each welded vertex
+    vector<Vec3f>      welded_vs, welded_ns;
+    vector<Vec2f>      welded_uvs;
+    for (size_t f = 0; f < Fv.size(); ++f)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            int      v = Fv[f][k];
+            Vec2i    key(has_ns ? Fn[f][k] : -1, has_uvs ? Ft[f][k] : -1);
+            uint32_t w = first[v];
+            while (w != none && (source[w].x != key.x || source[w].y != key.y))
+                w = next[w];
+
+            if (w == none)
+            {
+                w = uint32_t(welded_vs.size());
+                welded_vs.push_back(vs[v]);
+                if (has_ns)
+                    welded_ns.push_back(ns[key.x]);
+                if (has_uvs)
+                    welded_uvs.push_back(uvs[key.y]);
+                source.push_back(key);
+                next.push_back(first[v]);
+                first[v] = w;
+            }
+            Fv[f][k] = int(w);
+        }
+    }
+
+    spdlog::debug("Welded {} positions, {} normals and {} texture coordinates into {} vertices.", vs.size(), ns.size(),
+                  uvs.size(), welded_vs.size());
+
+    vs  = std::move(welded_vs);
+    ns  = std::move(welded_ns);
+    uvs = std::move(welded_uvs);
+    vs.shrink_to_fit();
+    ns.shrink_to_fit();
+    uvs.shrink_to_fit();
+    Fn     = vector<Vec3i>();
+    Ft     = vector<Vec3i>();
+    welded = true;
+}
+
+void Mesh::pack_attributes()
+{
+    if (pack_normals && !ns.empty())
+    {
+        packed_ns.resize(ns.size());
+        for (size_t i = 0; i < ns.size(); ++i)
+            packed_ns[i] = encode_octahedral(ns[i]);
+        ns = vector<Vec3f>();
+    }
+
+    if (half_uvs && !uvs.empty())
+    {
+        packed_uvs.resize(uvs.size());
+        for (size_t i = 0; i < uvs.size(); ++i)
+            packed_uvs[i] = pack_half2(uvs[i]);
+        uvs = vector<Vec2f>();
+    }
 }
 
 void Mesh::add_to_parent(Surface *parent, shared_ptr<Surface> self, const json &j)
 {
     auto mesh = std::dynamic_pointer_cast<Mesh>(self);
 
-    if (!mesh && mesh->empty())
+    if (!mesh || mesh->empty())
+        return;
+
+    if (mesh->accelerate)
+    {
+        mesh->use_bbh = true;
+
+        // emitters are sampled one triangle at a time, so emissive faces are added individually and left out of the BBH
+        size_t num_emissive = 0;
+        for (uint32_t f = 0; f < mesh->Fv.size(); ++f)
+        {
+            if (mesh->face_emissive(f))
+            {
+                parent->add_child(make_shared<Triangle>(j, mesh, int(f)));
+                ++num_emissive;
+            }
+        }
+
+        if (num_emissive > 0)
+        {
+            spdlog::info("Mesh has {} emissive triangles; adding them individually.", num_emissive);
+            mesh->skip_emissive = true;
+            // whether faces are emissive depends on the scene's materials, so a cached BBH may include them
+            mesh->cached_bbh = false;
+            mesh->cache_file.clear();
+        }
+
+        if (num_emissive < mesh->Fv.size())
+            parent->add_child(self);
+        else
+            mesh->use_bbh = false;
         return;
+    }
 
     for (auto index : range(mesh->Fv.size()))
         parent->add_child(make_shared<Triangle>(j, mesh, int(index)));
 }
 
+Box3f Mesh::face_bounds(uint32_t f) const
+{
+    // all mesh vertices have already been transformed to world space,
+    // so just bound the triangle vertices
+    Box3f result;
+    result.enclose(vs[Fv[f][0]]);
+    result.enclose(vs[Fv[f][1]]);
+    result.enclose(vs[Fv[f][2]]);
+
+    // if the triangle lies in an axis-aligned plane, expand the box a bit
+    auto diag = result.diagonal();
+    for (int i = 0; i < 3; ++i)
+    {
+        if (diag[i] < 1e-4f)
+        {
+            result.min[i] -= 5e-5f;
+            result.max[i] += 5e-5f;
+        }
+    }
+    return result;
+}
+
+namespace
+{
+    /// Add the memory used by the BBH of a mesh to the stats, both with and without its leaf data
+    void count_bbh_bytes(const Mesh &mesh)
+    {
+        size_t node_bytes = mesh.bbh_nodes.capacity() * sizeof(LinearBBHNode) +
+                            mesh.quantized_bbh.nodes.capacity() * sizeof(QuantizedBBHNode);
+        mesh_bbh_node_bytes += node_bytes;
+        mesh_bbh_bytes += node_bytes + mesh.leaf_vs.capacity() * sizeof(Vec3f) +
+                          mesh.leaf_faces.capacity() * sizeof(uint32_t) +
+                          mesh.blocks4.capacity() * sizeof(TriangleBlock<4>) +
+                          mesh.blocks8.capacity() * sizeof(TriangleBlock<8>);
+    }
+
+    /// Pack the faces of each leaf into blocks, and make the leaves reference ranges of blocks instead of faces
+    template <int W>
+    void pack_leaves(const Mesh &mesh, const vector<uint32_t> &leaf_faces, vector<LinearBBHNode> &nodes,
+                     vector<TriangleBlock<W>> &blocks)
+    {
+        blocks.clear();
+        for (auto &node : nodes)
+        {
+            if (node.num_primitives == 0)
+                continue;
+
+            uint32_t first = uint32_t(blocks.size());
+            pack_triangle_blocks<W>(&leaf_faces[node.primitives_offset], node.num_primitives, blocks,
+                                    [&](uint32_t f, int i) { return mesh.vs[mesh.Fv[f][i]]; });
+            node.primitives_offset = first;
+            node.num_primitives    = uint16_t(blocks.size() - first);
+        }
+        blocks.shrink_to_fit();
+    }
+
+    /// Copy the moved vertices into the blocks, and refit the BBH whose leaves reference them
+    template <int W>
+    void refit_blocks(const Mesh &mesh, vector<TriangleBlock<W>> &blocks, vector<LinearBBHNode> &nodes)
+    {
+        parallel_for(blocked_range<uint32_t>(0, uint32_t(blocks.size()), 1024),
+                     [&](blocked_range<uint32_t> range)
+                     {
+                         for (uint32_t b = range.begin(); b != range.end(); ++b)
+                             for (uint32_t lane = 0; lane < blocks[b].num_triangles; ++lane)
+                                 for (int i = 0; i < 3; ++i)
+                                 {
+                                     Vec3f p = mesh.vs[mesh.Fv[blocks[b].face[lane]][i]];
+                                     for (int a = 0; a < 3; ++a)
+                                         blocks[b].p[i][a][lane] = p[a];
+                                 }
+                     });
+
+        refit_linear_bbh(
+            nodes,
+            [&](uint32_t first, uint32_t count)
+            {
+                Box3f bbox;
+                for (uint32_t b = first; b < first + count; ++b)
+                    for (uint32_t lane = 0; lane < blocks[b].num_triangles; ++lane)
+                        bbox.enclose(mesh.face_bounds(blocks[b].face[lane]));
+                return bbox;
+            },
+            mesh.bbh_settings.parallel_build_cutoff);
+    }
+
+    /// Closest-hit traversal of a mesh BBH in either layout
+    template <typename LeafFunc>
+    bool intersect_bbh(const vector<LinearBBHNode> &nodes, Ray3f &ray, LeafFunc &&intersect_leaf)
+    {
+        return intersect_linear_bbh(nodes, ray, mesh_nodes_visited, std::forward<LeafFunc>(intersect_leaf));
+    }
+    template <typename LeafFunc>
+    bool intersect_bbh(const QuantizedBBH &bbh, Ray3f &ray, LeafFunc &&intersect_leaf)
+    {
+        return intersect_quantized_bbh(bbh, ray, mesh_nodes_visited, std::forward<LeafFunc>(intersect_leaf));
+    }
+
+    /// Any-hit traversal of a mesh BBH in either layout
+    template <typename LeafFunc>
+    bool occluded_bbh(const vector<LinearBBHNode> &nodes, const Ray3f &ray, LeafFunc &&occluded_leaf)
+    {
+        return occluded_linear_bbh(nodes, ray, mesh_nodes_visited, std::forward<LeafFunc>(occluded_leaf));
+    }
+    template <typename LeafFunc>
+    bool occluded_bbh(const QuantizedBBH &bbh, const Ray3f &ray, LeafFunc &&occluded_leaf)
+    {
+        return occluded_quantized_bbh(bbh, ray, mesh_nodes_visited, std::forward<LeafFunc>(occluded_leaf));
+    }
+
+    /// Closest-hit traversal of a BBH whose leaves reference faces in Mesh::leaf_vs
+    template <typename Tree>
+    bool intersect_faces(const Tree &tree, const Mesh &mesh, Ray3f &ray, uint32_t &face, float &u, float &v)
+    {
+        return intersect_bbh(tree, ray,
+                             [&](uint32_t first, uint32_t count, Ray3f &leaf_ray)
+                             {
+                                 bool hit_leaf = false;
+                                 for (uint32_t i = first; i < first + count; ++i)
+                                 {
+                                     float t, bu, bv;
+                                     if (single_triangle_hit(leaf_ray, mesh.leaf_vs[3 * i], mesh.leaf_vs[3 * i + 1],
+                                                             mesh.leaf_vs[3 * i + 2], t, bu, bv))
+                                     {
+                                         hit_leaf      = true;
+                                         leaf_ray.maxt = t;
+                                         face          = mesh.leaf_faces[i];
+                                         u             = bu;
+                                         v             = bv;
+                                     }
+                                 }
+                                 return hit_leaf;
+                             });
+    }
+
+    /// Any-hit traversal of a BBH whose leaves reference faces in Mesh::leaf_vs
+    template <typename Tree>
+    bool occluded_faces(const Tree &tree, const Mesh &mesh, const Ray3f &ray)
+    {
+        return occluded_bbh(tree, ray,
+                            [&](uint32_t first, uint32_t count, const Ray3f &leaf_ray)
+                            {
+                                for (uint32_t i = first; i < first + count; ++i)
+                                    if (single_triangle_occluded(leaf_ray, mesh.leaf_vs[3 * i],
+                                                                 mesh.leaf_vs[3 * i + 1], mesh.leaf_vs[3 * i + 2]))
+                                        return true;
+                                return false;
+                            });
+    }
+
+    /// Closest-hit traversal of a BBH whose leaves reference blocks of triangles
+    template <int W, typename Tree>
+    bool intersect_blocks(const Tree &tree, const vector<TriangleBlock<W>> &blocks, Ray3f &ray, uint32_t &face,
+                          float &u, float &v)
+    {
+        WatertightRay wray(ray);
+        return intersect_bbh(tree, ray,
+                             [&](uint32_t first, uint32_t count, Ray3f &leaf_ray)
+                             {
+                                 bool hit_leaf = false;
+                                 for (uint32_t b = first; b < first + count; ++b)
+                                 {
+                                     float t, bu, bv;
+                                     int   lane = intersect_triangle_block(blocks[b], wray, leaf_ray.maxt, t, bu, bv);
+                                     if (lane >= 0)
+                                     {
+                                         hit_leaf      = true;
+                                         leaf_ray.maxt = t;
+                                         face          = blocks[b].face[lane];
+                                         u             = bu;
+                                         v             = bv;
+                                     }
+                                 }
+                                 return hit_leaf;
+                             });
+    }
+
+    /// Closest-hit packet traversal of a BBH whose leaves reference blocks of triangles
+    template <int W>
+    uint32_t intersect_blocks_packet(const vector<LinearBBHNode> &nodes, const vector<TriangleBlock<W>> &blocks,
+                                     Ray3f *rays, uint32_t active, uint32_t *face, float *u, float *v)
+    {
+        WatertightRay wrays[max_packet_size];
+        for (int l = 0; l < max_packet_size; ++l)
+            if (active & (1u << l))
+                wrays[l] = WatertightRay(rays[l]);
+
+        return intersect_linear_bbh_packet(
+            nodes, rays, active, mesh_nodes_visited,
+            [&](uint32_t first, uint32_t count, Ray3f *leaf_rays, uint32_t mask)
+            {
+                uint32_t hit_leaf = 0;
+                for (int l = 0; l < max_packet_size; ++l)
+                {
+                    if (!(mask & (1u << l)))
+                        continue;
+                    for (uint32_t b = first; b < first + count; ++b)
+                    {
+                        float t, bu, bv;
+                        int   lane = intersect_triangle_block(blocks[b], wrays[l], leaf_rays[l].maxt, t, bu, bv);
+                        if (lane >= 0)
+                        {
+                            hit_leaf |= 1u << l;
+                            leaf_rays[l].maxt = t;
+                            face[l]           = blocks[b].face[lane];
+                            u[l]              = bu;
+                            v[l]              = bv;
+                        }
+                    }
+                }
+                return hit_leaf;
+            });
+    }
+
+    /// Any-hit traversal of a BBH whose leaves reference blocks of triangles
+    template <int W, typename Tree>
+    bool occluded_blocks(const Tree &tree, const vector<TriangleBlock<W>> &blocks, const Ray3f &ray)
+    {
+        WatertightRay wray(ray);
+        return occluded_bbh(tree, ray,
+                            [&](uint32_t first, uint32_t count, const Ray3f &leaf_ray)
+                            {
+                                float t, u, v;
+                                for (uint32_t b = first; b < first + count; ++b)
+                                    if (intersect_triangle_block(blocks[b], wray, leaf_ray.maxt, t, u, v) >= 0)
+                                        return true;
+                                return false;
+                            });
+    }
+} // namespace
+
+void Mesh::build()
+{
+    if (!use_bbh)
+    {
+        // without a BBH, the cache file read in the constructor is already complete
+        if (!cache_file.empty() && !cached_geometry)
+            write_mesh_cache(cache_file, cache_key, *this);
+        cache_file.clear();
+        return;
+    }
+
+    if (cached_bbh)
+    {
+        // later builds, e.g. after a refit degraded the BBH, build it from scratch
+        cached_bbh = false;
+        cache_file.clear();
+        count_bbh_bytes(*this);
+        return;
+    }
+
+    blocks4.clear();
+    blocks8.clear();
+    quantized_bbh = QuantizedBBH();
+
+    Progress progress("Building mesh BBH", Fv.size());
+
+    vector<BBHPrimitive> prims;
+    auto                 bound_faces = [&]
+    {
+        prims.resize(Fv.size());
+        parallel_for(blocked_range<uint32_t>(0, uint32_t(Fv.size()), 4096),
+                     [&](blocked_range<uint32_t> range)
+                     {
+                         for (uint32_t f = range.begin(); f != range.end(); ++f)
+                         {
+                             prims[f].bbox     = face_bounds(f);
+                             prims[f].centroid = prims[f].bbox.center();
+                             prims[f].index    = f;
+                         }
+                     });
+
+        // the emissive faces are separate triangles in the parent
+        if (skip_emissive)
+            prims.erase(std::remove_if(prims.begin(), prims.end(),
+                                       [this](const BBHPrimitive &p) { return face_emissive(p.index); }),
+                        prims.end());
+    };
+
+    bound_faces();
+    int depth = build_linear_bbh(prims, bbh_settings, progress, bbh_nodes,
+                                 [this](uint32_t f, const Box3f &bbox, int axis, float pos, Box3f &left, Box3f &right)
+                                 { split_triangle_bounds(vs[Fv[f][0]], vs[Fv[f][1]], vs[Fv[f][2]], bbox, axis, pos,
+                                                         left, right); });
+    if (depth >= max_linear_bbh_depth)
+    {
+        // an equal split is balanced, so its depth is logarithmic in the number of faces
+        spdlog::warn("Mesh BBH depth {} exceeds the traversal stack ({}); rebuilding with equal splits.", depth,
+                     max_linear_bbh_depth);
+        BBHSettings equal  = bbh_settings;
+        equal.split_method = BBH_SplitMethod::Equal;
+        // start over from one reference per face, since an SBVH may have duplicated and clipped them
+        bound_faces();
+        build_linear_bbh(prims, equal, progress, bbh_nodes);
+    }
+    progress.set_done();
+
+    // copy the vertex positions into leaf order so each leaf reads one contiguous block of memory
+    leaf_vs.resize(3 * prims.size());
+    leaf_faces.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); ++i)
+    {
+        uint32_t f         = prims[i].index;
+        leaf_faces[i]      = f;
+        leaf_vs[3 * i + 0] = vs[Fv[f][0]];
+        leaf_vs[3 * i + 1] = vs[Fv[f][1]];
+        leaf_vs[3 * i + 2] = vs[Fv[f][2]];
+    }
+
+    if (simd_width == 8)
+        pack_leaves(*this, leaf_faces, bbh_nodes, blocks8);
+    else if (simd_width == 4)
+        pack_leaves(*this, leaf_faces, bbh_nodes, blocks4);
+
+    if (simd_width > 0)
+    {
+        // the blocks hold their own copy of the positions and face indices
+        leaf_vs    = vector<Vec3f>();
+        leaf_faces = vector<uint32_t>();
+    }
+
+    bbh_cost = linear_bbh_sah_cost(bbh_nodes, bbh_settings);
+
+    if (quantize)
+    {
+        if (quantize_linear_bbh(bbh_nodes, quantized_bbh))
+            bbh_nodes = vector<LinearBBHNode>();
+        else
+            spdlog::warn("Mesh BBH leaves have more than {} primitives or start beyond primitive {}; keeping "
+                         "full-precision nodes.",
+                         QuantizedBBH::max_leaf_primitives, QuantizedBBH::max_leaf_offset);
+    }
+
+    count_bbh_bytes(*this);
+
+    if (!cache_file.empty())
+    {
+        write_mesh_cache(cache_file, cache_key, *this);
+        cache_file.clear();
+    }
+}
+
+void Mesh::refit()
+{
+    bbox_w = Box3f();
+    for (auto &v : vs)
+        bbox_w.enclose(v);
+
+    if (!use_bbh)
+        return;
+
+    // refit the full-precision nodes, and quantize them again afterwards
+    bool quantized = !quantized_bbh.nodes.empty();
+    if (quantized)
+        unpack_quantized_bbh(quantized_bbh, bbh_nodes);
+
+    if (simd_width == 8)
+        refit_blocks(*this, blocks8, bbh_nodes);
+    else if (simd_width == 4)
+        refit_blocks(*this, blocks4, bbh_nodes);
+    else
+    {
+        parallel_for(blocked_range<uint32_t>(0, uint32_t(leaf_faces.size()), 4096),
+                     [&](blocked_range<uint32_t> range)
+                     {
+                         for (uint32_t i = range.begin(); i != range.end(); ++i)
+                             for (int k = 0; k < 3; ++k)
+                                 leaf_vs[3 * i + k] = vs[Fv[leaf_faces[i]][k]];
+                     });
+
+        refit_linear_bbh(
+            bbh_nodes,
+            [this](uint32_t first, uint32_t count)
+            {
+                Box3f bbox;
+                for (uint32_t i = first; i < first + count; ++i)
+                    bbox.enclose(face_bounds(leaf_faces[i]));
+                return bbox;
+            },
+            bbh_settings.parallel_build_cutoff);
+    }
+
+    float cost = linear_bbh_sah_cost(bbh_nodes, bbh_settings);
+    if (cost > bbh_settings.rebuild_threshold * bbh_cost)
+    {
+        spdlog::info("Refitting raised the mesh BBH's SAH cost from {:.2f} to {:.2f}; rebuilding.", bbh_cost, cost);
+        build();
+    }
+    else if (quantized)
+    {
+        quantize_linear_bbh(bbh_nodes, quantized_bbh);
+        bbh_nodes = vector<LinearBBHNode>();
+    }
+}
+
+bool Mesh::intersect(const Ray3f &ray_, HitInfo &hit) const
+{
+    ++mesh_rays;
+
+    // only the closest face and its barycentric coordinates are tracked during traversal
+    uint32_t face = 0;
+    float    u = 0.f, v = 0.f;
+
+    // copy the ray so we can shrink maxt as closer hits are found
+    Ray3f ray    = ray_;
+    auto  search = [&](const auto &tree)
+    {
+        if (simd_width == 8)
+            return intersect_blocks(tree, blocks8, ray, face, u, v);
+        else if (simd_width == 4)
+            return intersect_blocks(tree, blocks4, ray, face, u, v);
+        else
+            return intersect_faces(tree, *this, ray, face, u, v);
+    };
+    bool hit_anything = quantized_bbh.nodes.empty() ? search(bbh_nodes) : search(quantized_bbh);
+
+    if (hit_anything)
+        compute_hit_info(ray_, face, ray.maxt, u, v, hit);
+
+    return hit_anything;
+}
+
+uint32_t Mesh::intersect_packet(Ray3f *rays, uint32_t active, HitInfo *hits) const
+{
+    if (!quantized_bbh.nodes.empty())
+        return Surface::intersect_packet(rays, active, hits);
+
+    for (uint32_t m = active; m; m &= m - 1)
+        ++mesh_rays;
+
+    // as for single rays, only the closest face and its barycentric coordinates are tracked during traversal
+    uint32_t face[max_packet_size];
+    float    u[max_packet_size], v[max_packet_size];
+
+    uint32_t hit_mask;
+    if (simd_width == 8)
+        hit_mask = intersect_blocks_packet(bbh_nodes, blocks8, rays, active, face, u, v);
+    else if (simd_width == 4)
+        hit_mask = intersect_blocks_packet(bbh_nodes, blocks4, rays, active, face, u, v);
+    else
+        hit_mask = intersect_linear_bbh_packet(
+            bbh_nodes, rays, active, mesh_nodes_visited,
+            [&](uint32_t first, uint32_t count, Ray3f *leaf_rays, uint32_t mask)
+            {
+                uint32_t hit_leaf = 0;
+                for (int l = 0; l < max_packet_size; ++l)
+                {
+                    if (!(mask & (1u << l)))
+                        continue;
+                    for (uint32_t i = first; i < first + count; ++i)
+                    {
+                        float t, bu, bv;
+                        if (single_triangle_hit(leaf_rays[l], leaf_vs[3 * i], leaf_vs[3 * i + 1], leaf_vs[3 * i + 2],
+                                                t, bu, bv))
+                        {
+                            hit_leaf |= 1u << l;
+                            leaf_rays[l].maxt = t;
+                            face[l]           = leaf_faces[i];
+                            u[l]              = bu;
+                            v[l]              = bv;
+                        }
+                    }
+                }
+                return hit_leaf;
+            });
+
+    for (int l = 0; l < max_packet_size; ++l)
+        if (hit_mask & (1u << l))
+            compute_hit_info(rays[l], face[l], rays[l].maxt, u[l], v[l], hits[l]);
+
+    return hit_mask;
+}
+
+bool Mesh::occluded(const Ray3f &ray) const
+{
+    ++mesh_rays;
+
+    auto search = [&](const auto &tree)
+    {
+        if (simd_width == 8)
+            return occluded_blocks(tree, blocks8, ray);
+        else if (simd_width == 4)
+            return occluded_blocks(tree, blocks4, ray);
+        else
+            return occluded_faces(tree, *this, ray);
+    };
+    return quantized_bbh.nodes.empty() ? search(bbh_nodes) : search(quantized_bbh);
+}
+
 DARTS_REGISTER_CLASS_IN_FACTORY(Surface, Mesh, "mesh")
 
 /**
@@ -0,0 +1,359 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <darts/mapped_file.h>
+#include <darts/mesh.h>
+#include <darts/mesh_cache.h>
+#include <darts/parallel.h>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    constexpr char     cache_magic[8] = {'D', 'A', 'R', 'T', 'S', 'M', 'S', 'H'};
+    constexpr uint32_t cache_version  = 3; ///< Increment whenever the layout of the file or of its arrays changes
+
+    /// Arrays start at multiples of this many bytes, so they are aligned for SIMD loads straight from the mapping
+    constexpr uint64_t cache_alignment = 64;
+
+    /// The arrays stored in a cache file, in file order
+    enum CacheSection : uint32_t
+    {
+        Vertices = 0,
+        Normals,
+        TexCoords,
+        FaceVertices,
+        FaceNormals,
+        FaceTexCoords,
+        FaceMaterials,
+        MaterialNames, ///< Material names, each terminated by a '\0'
+        BBHNodes,
+        LeafVertices,
+        LeafFaces,
+        Blocks4,
+        Blocks8,
+        QuantizedNodes,
+        PackedNormals,
+        PackedTexCoords,
+        NumSections
+    };
+
+    struct CacheHeader
+    {
+        char     magic[8];
+        uint32_t version;      ///< Also tells apart files written on a machine with a different byte order
+        uint32_t num_sections; ///< Equal to #NumSections
+        uint64_t key;          ///< The #mesh_cache_key() of the mesh
+        float    bbox_o[2][3]; ///< Object-space bounds
+        float    bbox_w[2][3]; ///< World-space bounds
+        float    bbh_cost;     ///< Mesh::bbh_cost
+        float    qbbox[2][3];  ///< QuantizedBBH::bbox
+        uint32_t has_bbh;      ///< Whether the BBH sections are stored
+        uint32_t welded;       ///< Mesh::welded
+        struct
+        {
+            uint64_t offset; ///< Byte offset from the start of the file
+            uint64_t size;   ///< Size in bytes
+        } sections[NumSections];
+    };
+
+    /// 64-bit FNV-1a hash of \p size bytes, continuing from \p hash
+    uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        auto bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        return hash;
+    }
+
+    template <typename T>
+    uint64_t fnv1a(const T &value, uint64_t hash)
+    {
+        return fnv1a(&value, sizeof(T), hash);
+    }
+
+    /// Mix the 64-bit word \p word into the running hash \p lane, like a round of xxHash64
+    inline uint64_t hash_round(uint64_t lane, uint64_t word)
+    {
+        lane += word * 0xc2b2ae3d27d4eb4full;
+        lane = (lane << 31) | (lane >> 33);
+        return lane * 0x9e3779b185ebca87ull;
+    }
+
+    /**
+        64-bit hash of \p size bytes that reads 32 bytes per step.
+
+        Unlike #fnv1a, which needs a multiply per byte that depends on the previous one, the four lanes consume one
+        64-bit word each per step independently of each other, so the hash is not limited by the multiply latency.
+    */
+    uint64_t wide_hash(const uint8_t *data, size_t size)
+    {
+        uint64_t lanes[4] = {0x60ea27eeadc0b5d6ull, 0xc2b2ae3d27d4eb4full, 0ull, 0x61c8864e7a143579ull};
+        size_t   i        = 0;
+        for (; i + 32 <= size; i += 32)
+            for (int l = 0; l < 4; ++l)
+            {
+                uint64_t word;
+                std::memcpy(&word, data + i + 8 * l, sizeof(word));
+                lanes[l] = hash_round(lanes[l], word);
+            }
+        uint64_t hash = size;
+        for (int l = 0; l < 4; ++l)
+            hash = hash_round(hash, lanes[l]);
+        return fnv1a(data + i, size - i, hash);
+    }
+
+    /// Hash \p size bytes by hashing chunks of them in parallel with #wide_hash and then hashing the chunk hashes
+    uint64_t parallel_hash(const uint8_t *data, size_t size)
+    {
+        constexpr size_t chunk_size = 1 << 20;
+        uint32_t         num_chunks = uint32_t((size + chunk_size - 1) / chunk_size);
+        vector<uint64_t> hashes(num_chunks);
+        parallel_for(blocked_range<uint32_t>(0, num_chunks, 1),
+                     [&](blocked_range<uint32_t> range)
+                     {
+                         for (uint32_t c = range.begin(); c != range.end(); ++c)
+                         {
+                             size_t begin = size_t(c) * chunk_size;
+                             hashes[c]    = wide_hash(data + begin, std::min(size - begin, chunk_size));
+                         }
+                     });
+        uint64_t hash = size;
+        for (uint64_t h : hashes)
+            hash = hash_round(hash, h);
+        return hash;
+    }
+
+    void write_box(float out[2][3], const Box3f &box)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            out[0][a] = box.min[a];
+            out[1][a] = box.max[a];
+        }
+    }
+
+    Box3f read_box(const float in[2][3])
+    {
+        Box3f box;
+        for (int a = 0; a < 3; ++a)
+        {
+            box.min[a] = in[0][a];
+            box.max[a] = in[1][a];
+        }
+        return box;
+    }
+} // namespace
+
+uint64_t mesh_cache_key(const MappedFile &file, const vector<string> &dependencies, const Mesh &mesh)
+{
+    // the mesh file can be hundreds of MB, so hash its chunks in parallel instead of byte by byte
+    uint64_t hash = parallel_hash(file.data(), file.size());
+
+    // a missing dependency gives a key that no cache file was written for, so loading the mesh reports the error
+    for (auto &filename : dependencies)
+    {
+        MappedFile dependency(filename);
+        hash = hash_round(hash, dependency.valid() ? parallel_hash(dependency.data(), dependency.size()) : ~0ull);
+    }
+
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r)
+            hash = fnv1a(mesh.xform.m[c][r], hash);
+
+    const BBHSettings &s = mesh.bbh_settings;
+    hash                 = fnv1a(s.split_method, hash);
+    hash                 = fnv1a(s.max_leaf_size, hash);
+    hash                 = fnv1a(s.sah_buckets, hash);
+    hash                 = fnv1a(s.traversal_cost, hash);
+    hash                 = fnv1a(s.intersection_cost, hash);
+    hash                 = fnv1a(s.sbvh_duplication, hash);
+    hash                 = fnv1a(s.sbvh_overlap, hash);
+    hash                 = fnv1a(s.lbvh_treelet_size, hash);
+    hash                 = fnv1a(s.lbvh_treelet_passes, hash);
+    hash                 = fnv1a(mesh.simd_width, hash);
+    hash                 = fnv1a(mesh.quantize, hash);
+    hash                 = fnv1a(mesh.weld_vertices, hash);
+    hash                 = fnv1a(mesh.pack_normals, hash);
+    hash                 = fnv1a(mesh.half_uvs, hash);
+    return hash;
+}
+
+bool read_mesh_cache(const string &filename, uint64_t key, Mesh &mesh)
+{
+    MappedFile file(filename);
+    if (!file.valid() || file.size() < sizeof(CacheHeader))
+        return false;
+
+    CacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(CacheHeader));
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version ||
+        header.num_sections != NumSections)
+    {
+        spdlog::warn("Ignoring mesh cache file '{}' written by an incompatible version.", filename);
+        return false;
+    }
+    if (header.key != key)
+        return false;
+
+    // validate all sections before touching the mesh
+    auto valid_section = [&](CacheSection s, size_t element_size)
+    {
+        auto &section = header.sections[s];
+        return section.offset <= file.size() && section.size <= file.size() - section.offset &&
+               section.size % element_size == 0;
+    };
+    if (!valid_section(Vertices, sizeof(Vec3f)) || !valid_section(Normals, sizeof(Vec3f)) ||
+        !valid_section(TexCoords, sizeof(Vec2f)) || !valid_section(FaceVertices, sizeof(Vec3i)) ||
+        !valid_section(FaceNormals, sizeof(Vec3i)) || !valid_section(FaceTexCoords, sizeof(Vec3i)) ||
+        !valid_section(FaceMaterials, sizeof(uint16_t)) || !valid_section(MaterialNames, 1) ||
+        !valid_section(BBHNodes, sizeof(LinearBBHNode)) || !valid_section(LeafVertices, sizeof(Vec3f)) ||
+        !valid_section(LeafFaces, sizeof(uint32_t)) || !valid_section(Blocks4, sizeof(TriangleBlock<4>)) ||
+        !valid_section(Blocks8, sizeof(TriangleBlock<8>)) || !valid_section(QuantizedNodes, sizeof(QuantizedBBHNode)) ||
+        !valid_section(PackedNormals, sizeof(uint32_t)) || !valid_section(PackedTexCoords, sizeof(uint32_t)))
+    {
+        spdlog::warn("Ignoring corrupt mesh cache file '{}'.", filename);
+        return false;
+    }
+
+    // the sections are aligned for their element types, so they can be copied straight out of the mapping without
+    // zero-filling the arrays first
+    auto read = [&](CacheSection s, auto &array)
+    {
+        using T       = typename std::decay_t<decltype(array)>::value_type;
+        auto &section = header.sections[s];
+        auto  first   = reinterpret_cast<const T *>(file.data() + section.offset);
+        array.assign(first, first + section.size / sizeof(T));
+    };
+
+    read(Vertices, mesh.vs);
+    read(Normals, mesh.ns);
+    read(TexCoords, mesh.uvs);
+    read(FaceVertices, mesh.Fv);
+    read(FaceNormals, mesh.Fn);
+    read(FaceTexCoords, mesh.Ft);
+    read(FaceMaterials, mesh.Fm);
+    read(PackedNormals, mesh.packed_ns);
+    read(PackedTexCoords, mesh.packed_uvs);
+    mesh.welded = header.welded;
+    if (header.has_bbh)
+    {
+        read(BBHNodes, mesh.bbh_nodes);
+        read(LeafVertices, mesh.leaf_vs);
+        read(LeafFaces, mesh.leaf_faces);
+        read(Blocks4, mesh.blocks4);
+        read(Blocks8, mesh.blocks8);
+        read(QuantizedNodes, mesh.quantized_bbh.nodes);
+        mesh.quantized_bbh.bbox = read_box(header.qbbox);
+        mesh.bbh_cost           = header.bbh_cost;
+    }
+    mesh.bbox_o = read_box(header.bbox_o);
+    mesh.bbox_w = read_box(header.bbox_w);
+
+    mesh.material_names.clear();
+    auto       &names = header.sections[MaterialNames];
+    const char *begin = reinterpret_cast<const char *>(file.data() + names.offset);
+    const char *end   = begin + names.size;
+    for (const char *name = begin; name < end;)
+    {
+        const char *terminator = std::find(name, end, '\0');
+        mesh.material_names.emplace_back(name, terminator);
+        name = terminator + 1;
+    }
+
+    return true;
+}
+
+void write_mesh_cache(const string &filename, uint64_t key, const Mesh &mesh)
+{
+    string names;
+    for (auto &name : mesh.material_names)
+        names.append(name.c_str(), name.size() + 1);
+
+    CacheHeader header{};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version      = cache_version;
+    header.num_sections = NumSections;
+    header.key          = key;
+    write_box(header.bbox_o, mesh.bbox_o);
+    write_box(header.bbox_w, mesh.bbox_w);
+    write_box(header.qbbox, mesh.quantized_bbh.bbox);
+    header.bbh_cost = mesh.bbh_cost;
+    header.has_bbh  = !mesh.bbh_nodes.empty() || !mesh.quantized_bbh.nodes.empty();
+    header.welded   = mesh.welded;
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(filename).parent_path(), error);
+
+    string        temp_filename = fmt::format("{}.{:x}.tmp", filename, key);
+    std::ofstream os(temp_filename, std::ios::binary);
+    if (!os)
+    {
+        spdlog::warn("Unable to write mesh cache file '{}'.", filename);
+        return;
+    }
+
+    // write a placeholder header, and fill in the section table once all offsets are known
+    os.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+    uint64_t offset = sizeof(CacheHeader);
+    auto     write  = [&](CacheSection s, const void *data, size_t size)
+    {
+        static const char zeros[cache_alignment] = {};
+        uint64_t          aligned = (offset + cache_alignment - 1) / cache_alignment * cache_alignment;
+        os.write(zeros, std::streamsize(aligned - offset));
+        os.write(static_cast<const char *>(data), std::streamsize(size));
+        header.sections[s] = {aligned, size};
+        offset             = aligned + size;
+    };
+    auto write_array = [&](CacheSection s, const auto &array)
+    { write(s, array.data(), array.size() * sizeof(array[0])); };
+
+    write_array(Vertices, mesh.vs);
+    write_array(Normals, mesh.ns);
+    write_array(TexCoords, mesh.uvs);
+    write_array(FaceVertices, mesh.Fv);
+    write_array(FaceNormals, mesh.Fn);
+    write_array(FaceTexCoords, mesh.Ft);
+    write_array(FaceMaterials, mesh.Fm);
+    write(MaterialNames, names.data(), names.size());
+    write_array(PackedNormals, mesh.packed_ns);
+    write_array(PackedTexCoords, mesh.packed_uvs);
+    if (header.has_bbh)
+    {
+        write_array(BBHNodes, mesh.bbh_nodes);
+        write_array(LeafVertices, mesh.leaf_vs);
+        write_array(LeafFaces, mesh.leaf_faces);
+        write_array(Blocks4, mesh.blocks4);
+        write_array(Blocks8, mesh.blocks8);
+        write_array(QuantizedNodes, mesh.quantized_bbh.nodes);
+    }
+
+    os.seekp(0);
+    os.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+    os.close();
+    if (!os)
+    {
+        spdlog::warn("Unable to write mesh cache file '{}'.", filename);
+        std::filesystem::remove(temp_filename, error);
+        return;
+    }
+
+    std::filesystem::rename(temp_filename, filename, error);
+    if (error)
+    {
+        spdlog::warn("Unable to write mesh cache file '{}': {}", filename, error.message());
+        std::filesystem::remove(temp_filename, error);
+        return;
+    }
+    spdlog::info("Wrote mesh cache file '{}' ({:.2f} MB).", filename, offset / (1024.0 * 1024.0));
+}
+
+/**
+    \file
+    \brief Implementation of the mesh cache
+*/
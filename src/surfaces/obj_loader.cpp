@@ -0,0 +1,422 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <darts/mapped_file.h>
+#include <darts/mesh_loaders.h>
+#include <darts/parallel.h>
+#include <limits>
+#include <unordered_map>
+
+namespace
+{
+    /// Chunks are large enough to amortize the per-chunk overhead, and small enough to balance the load across threads
+    constexpr size_t obj_chunk_size = size_t(8) << 20;
+
+    /// The geometry of one chunk of an OBJ file
+    struct ObjChunk
+    {
+        const char *begin, *end;
+
+        vector<Vec3f> vs, ns;
+        vector<Vec2f> uvs;
+        vector<Vec3i> Fv, Fn, Ft;
+        vector<int>   Fm;    ///< Index into #names, or -1 for the material in effect at the start of the chunk
+        vector<string> names; ///< The "usemtl" names of the chunk, in order
+
+        /// The indices in #Fv, #Fn, and #Ft (flattened to 3 per triangle) that are still relative to the chunk start
+        vector<uint32_t> relative_v, relative_n, relative_t;
+
+        const char *error_position = nullptr;
+        string      error;
+    };
+
+    inline bool is_space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    inline const char *skip_space(const char *p, const char *end)
+    {
+        while (p != end && is_space(*p))
+            ++p;
+        return p;
+    }
+
+    /**
+        Parse a decimal floating-point number at \p p, advancing \p p past it.
+
+        Up to 19 significant digits are accumulated in an integer and scaled once by an exactly representable power of
+        ten, which is correctly rounded for all but pathologically long inputs. Anything else, like "inf" or "nan", is
+        handed to std::strtof.
+    */
+    bool parse_float(const char *&p, const char *end, float &out)
+    {
+        static const double powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+        p             = skip_space(p, end);
+        const char *s = p;
+        bool        negative = false;
+        if (s != end && (*s == '-' || *s == '+'))
+            negative = *s++ == '-';
+
+        uint64_t mantissa = 0;
+        int      exponent = 0, significant = 0;
+        bool     any_digits = false;
+        for (; s != end && is_digit(*s); ++s, any_digits = true)
+            if (significant < 19)
+            {
+                mantissa = mantissa * 10 + uint64_t(*s - '0');
+                significant += mantissa != 0;
+            }
+            else
+                ++exponent;
+        if (s != end && *s == '.')
+            for (++s; s != end && is_digit(*s); ++s, any_digits = true)
+                if (significant < 19)
+                {
+                    mantissa = mantissa * 10 + uint64_t(*s - '0');
+                    significant += mantissa != 0;
+                    --exponent;
+                }
+
+        if (!any_digits)
+        {
+            // copy the token, since the mapped file is not null-terminated
+            const char *token_end = p;
+            while (token_end != end && !is_space(*token_end) && *token_end != '\n')
+                ++token_end;
+            string token(p, token_end);
+            char  *parsed_end;
+            out = std::strtof(token.c_str(), &parsed_end);
+            if (parsed_end == token.c_str())
+                return false;
+            p = token_end;
+            return true;
+        }
+
+        if (s != end && (*s == 'e' || *s == 'E'))
+        {
+            const char *e            = s + 1;
+            bool        negative_exp = false;
+            if (e != end && (*e == '-' || *e == '+'))
+                negative_exp = *e++ == '-';
+            if (e != end && is_digit(*e))
+            {
+                int value = 0;
+                for (; e != end && is_digit(*e); ++e)
+                    value = std::min(value * 10 + (*e - '0'), 100000);
+                exponent += negative_exp ? -value : value;
+                s = e;
+            }
+        }
+
+        double value = double(mantissa);
+        if (mantissa != 0 && exponent != 0)
+        {
+            if (exponent > 0 && exponent <= 22)
+                value *= powers_of_ten[exponent];
+            else if (exponent < 0 && exponent >= -22)
+                value /= powers_of_ten[-exponent];
+            else
+                value *= std::pow(10.0, double(exponent));
+        }
+        out = float(negative ? -value : value);
+        p   = s;
+        return true;
+    }
+
+    /// Parse a (possibly negative) integer at \p p, advancing \p p past it, or return 0 if there is none
+    int parse_index(const char *&p, const char *end)
+    {
+        bool negative = false;
+        if (p != end && *p == '-')
+        {
+            negative = true;
+            ++p;
+        }
+        int value = 0;
+        for (; p != end && is_digit(*p); ++p)
+            value = value * 10 + (*p - '0');
+        return negative ? -value : value;
+    }
+
+    /// The indices of one polygon corner, each either zero-based, relative to the start of the chunk, or -1 if absent
+    struct Corner
+    {
+        int  index[3];    ///< Vertex, texture, and normal index
+        bool relative[3]; ///< Whether the index is still relative to the start of the chunk
+    };
+
+    /// Convert a raw OBJ index, given \p count elements in the chunk so far, as described in #Corner
+    inline void fix_index(int raw, int count, int &index, bool &relative)
+    {
+        relative = raw < 0;
+        index    = raw > 0 ? raw - 1 : (raw < 0 ? count + raw : -1);
+    }
+
+    bool parse_face(ObjChunk &chunk, const char *p, const char *end, vector<Corner> &corners)
+    {
+        corners.clear();
+        int counts[3] = {int(chunk.vs.size()), int(chunk.uvs.size()), int(chunk.ns.size())};
+        while ((p = skip_space(p, end)) != end)
+        {
+            int raw[3] = {parse_index(p, end), 0, 0};
+            if (p != end && *p == '/')
+            {
+                ++p;
+                if (p != end && *p != '/')
+                    raw[1] = parse_index(p, end);
+                if (p != end && *p == '/')
+                {
+                    ++p;
+                    raw[2] = parse_index(p, end);
+                }
+            }
+            if (raw[0] == 0 || (p != end && !is_space(*p)))
+            {
+                chunk.error = "Missing or malformed vertex index";
+                return false;
+            }
+
+            Corner corner;
+            for (int k = 0; k < 3; ++k)
+                fix_index(raw[k], counts[k], corner.index[k], corner.relative[k]);
+            corners.push_back(corner);
+        }
+
+        if (corners.size() < 3)
+        {
+            chunk.error = "Polygons must have at least 3 indices";
+            return false;
+        }
+
+        // just create a naive triangle fan from the first vertex
+        int material = chunk.names.empty() ? -1 : int(chunk.names.size()) - 1;
+        for (size_t i = 2; i < corners.size(); ++i)
+        {
+            const Corner *c[3] = {&corners[0], &corners[i - 1], &corners[i]};
+
+            auto add = [&](int k, vector<Vec3i> &F, vector<uint32_t> &relative)
+            {
+                if (c[0]->index[k] < 0 && !c[0]->relative[k])
+                    return;
+                if (c[1]->index[k] < 0 && !c[1]->relative[k])
+                    return;
+                if (c[2]->index[k] < 0 && !c[2]->relative[k])
+                    return;
+                for (int j = 0; j < 3; ++j)
+                    if (c[j]->relative[k])
+                        relative.push_back(uint32_t(F.size() * 3 + j));
+                F.push_back({c[0]->index[k], c[1]->index[k], c[2]->index[k]});
+            };
+
+            add(0, chunk.Fv, chunk.relative_v);
+            add(1, chunk.Ft, chunk.relative_t);
+            add(2, chunk.Fn, chunk.relative_n);
+            chunk.Fm.push_back(material);
+        }
+        return true;
+    }
+
+    void parse_chunk(ObjChunk &chunk)
+    {
+        vector<Corner> corners;
+        for (const char *line = chunk.begin; line < chunk.end;)
+        {
+            const char *eol = std::find(line, chunk.end, '\n');
+            const char *p   = skip_space(line, eol);
+
+            const char *keyword = p;
+            while (p != eol && !is_space(*p))
+                ++p;
+            size_t length = size_t(p - keyword);
+
+            bool ok = true;
+            if (length == 1 && keyword[0] == 'v')
+            {
+                Vec3f v;
+                ok = parse_float(p, eol, v.x) && parse_float(p, eol, v.y) && parse_float(p, eol, v.z);
+                chunk.vs.push_back(v);
+            }
+            else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+            {
+                Vec3f n;
+                ok = parse_float(p, eol, n.x) && parse_float(p, eol, n.y) && parse_float(p, eol, n.z);
+                chunk.ns.push_back(n);
+            }
+            else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't')
+            {
+                // the second coordinate is optional
+                Vec2f uv(0.f);
+                ok = parse_float(p, eol, uv.x);
+                if (ok && skip_space(p, eol) != eol)
+                    ok = parse_float(p, eol, uv.y);
+                chunk.uvs.push_back(uv);
+            }
+            else if (length == 1 && keyword[0] == 'f')
+            {
+                if (!parse_face(chunk, p, eol, corners))
+                {
+                    chunk.error_position = line;
+                    return;
+                }
+            }
+            else if (length == 6 && std::equal(keyword, p, "usemtl"))
+            {
+                const char *name = skip_space(p, eol);
+                const char *name_end = name;
+                while (name_end != eol && !is_space(*name_end))
+                    ++name_end;
+                chunk.names.emplace_back(name, name_end);
+            }
+
+            if (!ok)
+            {
+                chunk.error          = "Malformed number";
+                chunk.error_position = line;
+                return;
+            }
+            line = eol + 1;
+        }
+    }
+} // namespace
+
+MeshData load_obj(const string &filename, const MappedFile &obj)
+{
+    MeshData data;
+    data.material_names.push_back("");
+    if (!obj.valid() || obj.size() == 0)
+        return data;
+
+    // split the file into chunks that end right after a line break
+    const char      *file_begin = reinterpret_cast<const char *>(obj.data());
+    const char      *file_end   = file_begin + obj.size();
+    vector<ObjChunk> chunks;
+    for (const char *begin = file_begin; begin < file_end;)
+    {
+        const char *end = begin + std::min(obj_chunk_size, size_t(file_end - begin));
+        end             = end == file_end ? end : std::find(end, file_end, '\n');
+        end             = end == file_end ? end : end + 1;
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().end   = end;
+        begin               = end;
+    }
+
+    parallel_for(blocked_range<uint32_t>(0, uint32_t(chunks.size()), 1),
+                 [&](blocked_range<uint32_t> range)
+                 {
+                     for (uint32_t c = range.begin(); c != range.end(); ++c)
+                         parse_chunk(chunks[c]);
+                 });
+
+    for (auto &chunk : chunks)
+        if (chunk.error_position)
+            throw DartsException("Error parsing OBJ file '{}' on line {}: {}", filename,
+                                 std::count(file_begin, chunk.error_position, '\n') + 1, chunk.error);
+
+    // assign the materials sequentially, so they are numbered in order of first use, as a single pass would
+    struct Offsets
+    {
+        size_t v = 0, n = 0, t = 0, Fv = 0, Fn = 0, Ft = 0, Fm = 0;
+        int    material = 0;        ///< The material in effect at the start of the chunk
+        vector<uint32_t> materials; ///< The material of each of the chunk's "usemtl" statements
+    };
+    vector<Offsets>                 offsets(chunks.size() + 1);
+    std::unordered_map<string, int> material_map;
+    for (size_t c = 0; c < chunks.size(); ++c)
+    {
+        const ObjChunk &chunk = chunks[c];
+        Offsets        &o     = offsets[c];
+        int             material = o.material;
+        for (auto &name : chunk.names)
+        {
+            auto it = material_map.emplace(name, int(data.material_names.size())).first;
+            if (it->second == int(data.material_names.size()))
+                data.material_names.push_back(name);
+            o.materials.push_back(uint32_t(material = it->second));
+        }
+
+        Offsets &next = offsets[c + 1];
+        next.v        = o.v + chunk.vs.size();
+        next.n        = o.n + chunk.ns.size();
+        next.t        = o.t + chunk.uvs.size();
+        next.Fv       = o.Fv + chunk.Fv.size();
+        next.Fn       = o.Fn + chunk.Fn.size();
+        next.Ft       = o.Ft + chunk.Ft.size();
+        next.Fm       = o.Fm + chunk.Fm.size();
+        next.material = material;
+    }
+
+    const Offsets &total = offsets.back();
+    if (std::max({total.v, total.n, total.t}) > size_t(std::numeric_limits<int>::max()))
+        throw DartsException("OBJ file '{}' has too many vertices.", filename);
+    data.vs.resize(total.v);
+    data.ns.resize(total.n);
+    data.uvs.resize(total.t);
+    data.Fv.resize(total.Fv);
+    // ignore the normal and texture indices of files without any normals or texture coordinates, as tinyobj used to
+    data.Fn.resize(total.n ? total.Fn : 0);
+    data.Ft.resize(total.t ? total.Ft : 0);
+    data.Fm.resize(total.Fm);
+
+    // copy the chunks into place, making relative indices absolute and checking all indices
+    std::atomic<bool> out_of_range(false);
+    parallel_for(blocked_range<uint32_t>(0, uint32_t(chunks.size()), 1),
+                 [&](blocked_range<uint32_t> range)
+                 {
+                     for (uint32_t c = range.begin(); c != range.end(); ++c)
+                     {
+                         ObjChunk      &chunk = chunks[c];
+                         const Offsets &o     = offsets[c];
+
+                         auto stitch = [&](vector<Vec3i> &src, vector<uint32_t> &relative, size_t first, size_t offset,
+                                           size_t count, vector<Vec3i> &dst)
+                         {
+                             if (dst.empty())
+                                 return;
+                             for (uint32_t i : relative)
+                                 src[i / 3][i % 3] += int(offset);
+                             for (auto &f : src)
+                                 if (uint32_t(f.x) >= count || uint32_t(f.y) >= count || uint32_t(f.z) >= count)
+                                     out_of_range = true;
+                             std::copy(src.begin(), src.end(), dst.begin() + first);
+                             src      = vector<Vec3i>();
+                             relative = vector<uint32_t>();
+                         };
+                         stitch(chunk.Fv, chunk.relative_v, o.Fv, o.v, total.v, data.Fv);
+                         stitch(chunk.Fn, chunk.relative_n, o.Fn, o.n, total.n, data.Fn);
+                         stitch(chunk.Ft, chunk.relative_t, o.Ft, o.t, total.t, data.Ft);
+
+                         std::copy(chunk.vs.begin(), chunk.vs.end(), data.vs.begin() + o.v);
+                         std::copy(chunk.ns.begin(), chunk.ns.end(), data.ns.begin() + o.n);
+                         std::copy(chunk.uvs.begin(), chunk.uvs.end(), data.uvs.begin() + o.t);
+                         for (size_t i = 0; i < chunk.Fm.size(); ++i)
+                             data.Fm[o.Fm + i] = chunk.Fm[i] < 0 ? uint32_t(o.material) : o.materials[chunk.Fm[i]];
+                         chunk = ObjChunk();
+                     }
+                 });
+
+    if (out_of_range)
+        throw DartsException("OBJ file '{}' refers to a missing vertex, normal, or texture coordinate.", filename);
+
+    return data;
+}
+
+/**
+    \file
+    \brief Implementation of #load_obj
+*/
@@ -0,0 +1,318 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <darts/factory.h>
+#include <darts/mapped_file.h>
+#include <darts/mesh.h>
+#include <darts/parallel.h>
+#include <sstream>
+
+namespace
+{
+    enum class PlyType
+    {
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Float32,
+        Float64
+    };
+
+    struct PlyProperty
+    {
+        string  name;
+        PlyType type;
+        bool    list = false;
+        PlyType count_type; ///< The type of the length of a list property
+        size_t  offset = 0; ///< Byte offset within the element, if it has no list properties
+    };
+
+    struct PlyElement
+    {
+        string              name;
+        size_t              count = 0;
+        vector<PlyProperty> properties;
+        size_t              stride = 0; ///< Size in bytes of each element, or 0 if it has list properties
+    };
+
+    PlyType parse_type(const string &name)
+    {
+        static const map<string, PlyType> types = {
+            {"char", PlyType::Int8},      {"int8", PlyType::Int8},       {"uchar", PlyType::UInt8},
+            {"uint8", PlyType::UInt8},    {"short", PlyType::Int16},     {"int16", PlyType::Int16},
+            {"ushort", PlyType::UInt16},  {"uint16", PlyType::UInt16},   {"int", PlyType::Int32},
+            {"int32", PlyType::Int32},    {"uint", PlyType::UInt32},     {"uint32", PlyType::UInt32},
+            {"float", PlyType::Float32},  {"float32", PlyType::Float32}, {"double", PlyType::Float64},
+            {"float64", PlyType::Float64}};
+        auto it = types.find(name);
+        if (it == types.end())
+            throw DartsException("Unknown PLY property type '{}'.", name);
+        return it->second;
+    }
+
+    size_t type_size(PlyType type)
+    {
+        static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+        return sizes[int(type)];
+    }
+
+    /// Read a value of type \p type at \p p, converted to \p T. PLY data is little endian, like every supported host.
+    template <typename T>
+    T read_as(const uint8_t *p, PlyType type)
+    {
+        auto read = [p](auto value)
+        {
+            std::memcpy(&value, p, sizeof(value));
+            return T(value);
+        };
+        switch (type)
+        {
+        case PlyType::Int8: return read(int8_t());
+        case PlyType::UInt8: return read(uint8_t());
+        case PlyType::Int16: return read(int16_t());
+        case PlyType::UInt16: return read(uint16_t());
+        case PlyType::Int32: return read(int32_t());
+        case PlyType::UInt32: return read(uint32_t());
+        case PlyType::Float32: return read(float());
+        default: return read(double());
+        }
+    }
+
+    /// The property of \p element with one of the given \p names, or nullptr if there is none
+    const PlyProperty *find_property(const PlyElement &element, std::initializer_list<const char *> names)
+    {
+        for (auto name : names)
+            for (auto &property : element.properties)
+                if (property.name == name && !property.list)
+                    return &property;
+        return nullptr;
+    }
+} // namespace
+
+MeshData load_ply(const string &filename, const MappedFile &ply)
+{
+    const char *begin = reinterpret_cast<const char *>(ply.data());
+    const char *end   = begin + ply.size();
+
+    // the header is plain text, terminated by an "end_header" line
+    static const char end_header[] = "end_header";
+    const char       *header_end   = std::search(begin, end, end_header, end_header + sizeof(end_header) - 1);
+    header_end                     = std::find(header_end, end, '\n');
+    if (ply.size() < 4 || std::strncmp(begin, "ply", 3) != 0 || header_end == end)
+        throw DartsException("'{}' is not a PLY file.", filename);
+
+    vector<PlyElement> elements;
+    string             format;
+    std::istringstream header(string(begin, header_end));
+    string             line;
+    while (std::getline(header, line))
+    {
+        std::istringstream tokens(line);
+        string             keyword;
+        tokens >> keyword;
+        if (keyword == "format")
+            tokens >> format;
+        else if (keyword == "element")
+        {
+            elements.emplace_back();
+            tokens >> elements.back().name >> elements.back().count;
+        }
+        else if (keyword == "property")
+        {
+            if (elements.empty())
+                throw DartsException("PLY file '{}' has a property outside of any element.", filename);
+            PlyProperty property;
+            string      type;
+            tokens >> type;
+            if (type == "list")
+            {
+                string count_type;
+                tokens >> count_type >> type;
+                property.list       = true;
+                property.count_type = parse_type(count_type);
+            }
+            property.type = parse_type(type);
+            tokens >> property.name;
+            elements.back().properties.push_back(property);
+        }
+    }
+
+    if (format != "binary_little_endian")
+        throw DartsException("PLY file '{}' is stored as '{}', but only 'binary_little_endian' is supported.", filename,
+                             format);
+
+    // lay out the properties of the elements without lists
+    for (auto &element : elements)
+    {
+        size_t offset = 0;
+        for (auto &property : element.properties)
+        {
+            if (property.list)
+            {
+                offset = 0;
+                break;
+            }
+            property.offset = offset;
+            offset += type_size(property.type);
+        }
+        element.stride = offset;
+    }
+
+    MeshData data;
+    data.material_names.push_back("");
+    data.welded = true;
+
+    const uint8_t *p        = reinterpret_cast<const uint8_t *>(header_end + 1);
+    const uint8_t *data_end = ply.data() + ply.size();
+    auto           check    = [&](size_t size)
+    {
+        if (size_t(data_end - p) < size)
+            throw DartsException("PLY file '{}' is truncated.", filename);
+    };
+
+    for (auto &element : elements)
+    {
+        if (element.name == "vertex")
+        {
+            const PlyProperty *x = find_property(element, {"x"}), *y = find_property(element, {"y"}),
+                              *z = find_property(element, {"z"});
+            if (!x || !y || !z || !element.stride)
+                throw DartsException("PLY file '{}' has no vertex positions.", filename);
+            const PlyProperty *nx = find_property(element, {"nx"}), *ny = find_property(element, {"ny"}),
+                              *nz = find_property(element, {"nz"});
+            const PlyProperty *u  = find_property(element, {"u", "s", "texture_u", "texture_s"}),
+                              *v  = find_property(element, {"v", "t", "texture_v", "texture_t"});
+
+            check(element.count * element.stride);
+            data.vs.resize(element.count);
+            if (nx && ny && nz)
+                data.ns.resize(element.count);
+            if (u && v)
+                data.uvs.resize(element.count);
+
+            const uint8_t *vertices = p;
+            size_t         stride   = element.stride;
+            parallel_for(blocked_range<uint32_t>(0, uint32_t(element.count), 16384),
+                         [&](blocked_range<uint32_t> range)
+                         {
+                             for (uint32_t i = range.begin(); i != range.end(); ++i)
+                             {
+                                 const uint8_t *vertex = vertices + i * stride;
+                                 data.vs[i]            = {read_as<float>(vertex + x->offset, x->type),
+                                                          read_as<float>(vertex + y->offset, y->type),
+                                                          read_as<float>(vertex + z->offset, z->type)};
+                                 if (!data.ns.empty())
+                                     data.ns[i] = {read_as<float>(vertex + nx->offset, nx->type),
+                                                   read_as<float>(vertex + ny->offset, ny->type),
+                                                   read_as<float>(vertex + nz->offset, nz->type)};
+                                 if (!data.uvs.empty())
+                                     data.uvs[i] = {read_as<float>(vertex + u->offset, u->type),
+                                                    read_as<float>(vertex + v->offset, v->type)};
+                             }
+                         });
+            p += element.count * element.stride;
+        }
+        else if (element.name == "face")
+        {
+            // faces have variable length, so they are read sequentially
+            data.Fv.reserve(element.count);
+            bool found = false;
+            for (size_t f = 0; f < element.count; ++f)
+            {
+                for (auto &property : element.properties)
+                {
+                    if (!property.list)
+                    {
+                        check(type_size(property.type));
+                        p += type_size(property.type);
+                        continue;
+                    }
+
+                    check(type_size(property.count_type));
+                    uint32_t count = read_as<uint32_t>(p, property.count_type);
+                    p += type_size(property.count_type);
+                    size_t index_size = type_size(property.type);
+                    check(count * index_size);
+                    if (property.name == "vertex_indices" || property.name == "vertex_index")
+                    {
+                        found = true;
+                        if (count < 3)
+                            throw DartsException("Polygons must have at least 3 indices");
+
+                        // just create a naive triangle fan from the first vertex
+                        int first = read_as<int>(p, property.type);
+                        int last  = read_as<int>(p + index_size, property.type);
+                        for (uint32_t i = 2; i < count; ++i)
+                        {
+                            int next = read_as<int>(p + i * index_size, property.type);
+                            data.Fv.push_back({first, last, next});
+                            last = next;
+                        }
+                    }
+                    p += count * index_size;
+                }
+            }
+            if (!found && element.count)
+                throw DartsException("PLY file '{}' has no vertex indices.", filename);
+        }
+        else if (element.stride)
+        {
+            check(element.count * element.stride);
+            p += element.count * element.stride;
+        }
+        else
+        {
+            // skip other elements with lists property by property
+            for (size_t i = 0; i < element.count; ++i)
+                for (auto &property : element.properties)
+                {
+                    size_t count = 1;
+                    if (property.list)
+                    {
+                        check(type_size(property.count_type));
+                        count = read_as<size_t>(p, property.count_type);
+                        p += type_size(property.count_type);
+                    }
+                    check(count * type_size(property.type));
+                    p += count * type_size(property.type);
+                }
+        }
+    }
+
+    for (auto &f : data.Fv)
+        if (uint32_t(f.x) >= data.vs.size() || uint32_t(f.y) >= data.vs.size() || uint32_t(f.z) >= data.vs.size())
+            throw DartsException("PLY file '{}' refers to a missing vertex.", filename);
+    data.Fm.assign(data.Fv.size(), 0);
+
+    return data;
+}
+
+/**
+    A triangle mesh loaded from a binary little-endian PLY file.
+
+    It accepts the same fields as #Mesh, except that the "filename" is a PLY file read by #load_ply. Since PLY files
+    store indexed vertices, the mesh does not need to be welded.
+
+    \ingroup Surfaces
+*/
+struct PlyMesh : public Mesh
+{
+    PlyMesh(const json &j) : Mesh(j, load_ply)
+    {
+    }
+};
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Surface, PlyMesh, "ply")
+
+/**
+    \file
+    \brief Binary PLY mesh loading
+*/
@@ -13,9 +13,13 @@ public:
     Quad(const json &j = json::object());
 
     bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
     Box3f local_bounds() const override;
     Color3f sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const override;
     float   pdf(const Vec3f &o, const Vec3f &v) const override;
+    float   emitted_power() const override;
+
+    DirectionCone normal_cone() const override;
 
 protected:
     Vec2f m_size = Vec2f(1.f); ///< The extent of the quad in the (x,y) plane
@@ -65,6 +69,26 @@ bool Quad::intersect(const Ray3f &ray, HitInfo &hit) const
     return true;
 }
 
+bool Quad::occluded(const Ray3f &ray) const
+{
+    ++g_num_total_intersection_tests;
+    ++num_quad_tests;
+
+    auto tray = m_xform.inverse().ray(ray);
+    if (tray.d.z == 0)
+        return false;
+    auto t = -tray.o.z / tray.d.z;
+    if (t < tray.mint || t > tray.maxt)
+        return false;
+
+    auto p = tray(t);
+    if (m_size.x < std::abs(p.x) || m_size.y < std::abs(p.y))
+        return false;
+
+    ++num_quad_hits;
+    return true;
+}
+
 Box3f Quad::local_bounds() const
 {
     return Box3f{-Vec3f{m_size.x, m_size.y, 0} - Vec3f{Ray3f::epsilon},
@@ -105,6 +129,16 @@ float Quad::pdf(const Vec3f &o, const Vec3f &v) const
         return 0;
 }
 
+float Quad::emitted_power() const
+{
+    float area = 4 * length(cross(m_xform.vector({m_size.x, 0, 0}), m_xform.vector({0, m_size.y, 0})));
+    return m_material ? luminance(m_material->average_emitted()) * area : 0.f;
+}
+
+DirectionCone Quad::normal_cone() const
+{
+    return {normalize(m_xform.normal({0, 0, 1})), 1.f};
+}
 
 DARTS_REGISTER_CLASS_IN_FACTORY(Surface, Quad, "quad")
 
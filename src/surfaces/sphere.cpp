@@ -104,6 +104,29 @@ bool Sphere::intersect(const Ray3f &ray, HitInfo &hit) const
     return true;
 }
 
+bool Sphere::occluded(const Ray3f &ray) const
+{
+    ++g_num_total_intersection_tests;
+    ++num_sphere_tests;
+
+    // same root selection as Sphere::intersect, but without computing the hit point, normal or uvs
+    auto  tray = m_xform.inverse().ray(ray);
+    auto  a    = dot(tray.d, tray.d);
+    auto  b    = 2.f * dot(tray.o, tray.d);
+    auto  c    = dot(tray.o, tray.o) - m_radius * m_radius;
+    float t0, t1;
+    if (!solve_quadratic(a, b, c, &t0, &t1))
+        return false;
+
+    if (t0 > ray.maxt || t1 <= ray.mint)
+        return false;
+    if (t0 <= 0 && t1 > ray.maxt)
+        return false;
+
+    ++num_sphere_hits;
+    return true;
+}
+
 Box3f Sphere::local_bounds() const
 {
     return Box3f{Vec3f{-m_radius}, Vec3f{m_radius}};
@@ -168,6 +191,12 @@ float Sphere::pdf(const Vec3f &o, const Vec3f &v) const
     }
 }
 
+float Sphere::emitted_power() const
+{
+    auto radius = length(m_xform.m.x.xyz()) * m_radius;
+    return m_material ? luminance(m_material->average_emitted()) * 4.f * float(M_PI) * radius * radius : 0.f;
+}
+
 DARTS_REGISTER_CLASS_IN_FACTORY(Surface, Sphere, "sphere")
 
 /**
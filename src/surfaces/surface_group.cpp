@@ -30,6 +30,33 @@ void SurfaceGroup::add_child(shared_ptr<Surface> surface)
     m_bounds.enclose(m_surfaces.back()->bounds());
 }
 
+void SurfaceGroup::build()
+{
+    vector<float> powers(m_surfaces.size());
+    m_child_index.clear();
+    m_child_index.reserve(m_surfaces.size());
+    for (size_t i = 0; i < m_surfaces.size(); ++i)
+    {
+        powers[i] = m_surfaces[i]->emitted_power();
+        m_child_index.emplace(m_surfaces[i].get(), uint32_t(i));
+    }
+    m_sampling_weights.build(powers);
+}
+
+void SurfaceGroup::refit()
+{
+    m_bounds = Box3f();
+    for (auto &surface : m_surfaces)
+    {
+        surface->refit();
+        m_bounds.enclose(surface->bounds());
+    }
+
+    // moving the children may have scaled them
+    if (!m_sampling_weights.empty())
+        SurfaceGroup::build();
+}
+
 bool SurfaceGroup::intersect(const Ray3f &ray_, HitInfo &hit) const
 {
     // transform the ray into local object space
@@ -57,6 +84,18 @@ bool SurfaceGroup::intersect(const Ray3f &ray_, HitInfo &hit) const
     return hit_anything;
 }
 
+bool SurfaceGroup::occluded(const Ray3f &ray_) const
+{
+    // transform the ray into local object space
+    auto ray = m_xform.inverse().ray(ray_);
+
+    for (auto surface : m_surfaces)
+        if (surface->occluded(ray))
+            return true;
+
+    return false;
+}
+
 Box3f SurfaceGroup::local_bounds() const
 {
     return m_bounds;
@@ -77,6 +116,13 @@ pair<const Surface *, float> SurfaceGroup::sample_child(float &rv1) const
     if (m_surfaces.size() == 0)
         throw DartsException("SurfaceGroup::sample_child(): No children were defined!");
 
+    if (m_sampling_weights.size() == m_surfaces.size())
+    {
+        // choose a surface in proportion to its power; the alias table remaps the random number for reuse
+        uint32_t index = m_sampling_weights.sample(rv1);
+        return {m_surfaces[index].get(), m_sampling_weights.prob(index)};
+    }
+
     // choose a surface uniformly, and reuse the random number
     float sx    = rv1 * m_surfaces.size();
     int   index = clamp((int)sx, 0, (int)m_surfaces.size() - 1);
@@ -85,17 +131,34 @@ pair<const Surface *, float> SurfaceGroup::sample_child(float &rv1) const
     return {m_surfaces[index].get(), 1.f / m_surfaces.size()};
 }
 
-float SurfaceGroup::child_prob() const
+float SurfaceGroup::child_prob(const Surface *child) const
 {
-    return 1.f / m_surfaces.size();
+    if (m_child_index.size() == m_surfaces.size())
+    {
+        auto it = m_child_index.find(child);
+        return it == m_child_index.end() ? 0.f : child_prob(it->second);
+    }
+
+    // the group was not built, so search for the child
+    for (size_t i = 0; i < m_surfaces.size(); ++i)
+        if (m_surfaces[i].get() == child)
+            return child_prob(uint32_t(i));
+    return 0.f;
 }
 
 float SurfaceGroup::pdf(const Vec3f &o, const Vec3f &v) const
 {
-    float weight = 1.0f / m_surfaces.size();
-    float sum    = 0.f;
-    for (auto surface : m_surfaces)
-        sum += weight * surface->pdf(o, v);
+    float sum = 0.f;
+    for (size_t i = 0; i < m_surfaces.size(); ++i)
+        sum += child_prob(uint32_t(i)) * m_surfaces[i]->pdf(o, v);
+    return sum;
+}
+
+float SurfaceGroup::emitted_power() const
+{
+    float sum = 0.f;
+    for (auto &surface : m_surfaces)
+        sum += surface->emitted_power();
     return sum;
 }
 
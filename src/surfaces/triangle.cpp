@@ -6,6 +6,7 @@
 
 #include <darts/factory.h>
 #include <darts/mesh.h>
+#include <darts/packing.h>
 #include <darts/stats.h>
 #include <darts/triangle.h>
 #include <darts/sampling.h>
@@ -61,37 +62,81 @@ Triangle::Triangle(const json &j, shared_ptr<const Mesh> mesh, uint32_t tri_numb
 STAT_RATIO("Intersections/Triangle intersection tests per hit", num_tri_tests, num_tri_hits);
 
 bool Triangle::intersect(const Ray3f &ray, HitInfo &hit) const
+{
+    float t, u, v;
+    if (!find_hit(ray, t, u, v))
+        return false;
+
+    hit_info(ray, t, u, v, hit);
+    return true;
+}
+
+bool Triangle::find_hit(const Ray3f &ray, float &t, float &u, float &v) const
 {
     ++num_tri_tests;
 
-    auto iv0 = m_mesh->Fv[m_face_idx].x, iv1 = m_mesh->Fv[m_face_idx].y, iv2 = m_mesh->Fv[m_face_idx].z;
-    auto p0 = m_mesh->vs[iv0], p1 = m_mesh->vs[iv1], p2 = m_mesh->vs[iv2];
+    if (!single_triangle_hit(ray, vertex(0), vertex(1), vertex(2), t, u, v))
+        return false;
+
+    ++num_tri_hits;
+    return true;
+}
+
+bool Triangle::occluded(const Ray3f &ray) const
+{
+    ++num_tri_tests;
+
+    if (!single_triangle_occluded(ray, vertex(0), vertex(1), vertex(2)))
+        return false;
 
+    ++num_tri_hits;
+    return true;
+}
+
+bool Mesh::face_normals(uint32_t f, Vec3f n[3]) const
+{
+    // normals are decoded on demand, since they may be stored in a packed form, and welded meshes index them with
+    // the vertex indices
+    bool         has_ns = !ns.empty() || !packed_ns.empty();
+    const Vec3i *fn     = welded ? (has_ns ? &Fv[f] : nullptr) : (Fn.size() > f ? &Fn[f] : nullptr);
+    if (!fn || fn->x < 0 || fn->y < 0 || fn->z < 0)
+        return false;
+
+    for (int k = 0; k < 3; ++k)
+        n[k] = packed_ns.empty() ? ns[(*fn)[k]] : decode_octahedral(packed_ns[(*fn)[k]]);
+    return true;
+}
+
+void Mesh::compute_hit_info(const Ray3f &ray, uint32_t f, float t, float u, float v, HitInfo &hit) const
+{
+    // attributes are decoded on demand, since they may be stored in a packed form
+    auto texcoord = [this](int i) { return packed_uvs.empty() ? uvs[i] : unpack_half2(packed_uvs[i]); };
+    bool has_uvs  = !uvs.empty() || !packed_uvs.empty();
+
+    // welded meshes index all attributes with the vertex indices
+    const Vec3i *ft = welded ? (has_uvs ? &Fv[f] : nullptr) : (Ft.size() > f ? &Ft[f] : nullptr);
+
+    Vec3f        n[3];
     const Vec3f *n0 = nullptr, *n1 = nullptr, *n2 = nullptr;
-    if (m_mesh->Fn.size() > m_face_idx)
+    if (face_normals(f, n))
     {
-        auto in0 = m_mesh->Fn[m_face_idx].x, in1 = m_mesh->Fn[m_face_idx].y, in2 = m_mesh->Fn[m_face_idx].z;
-        if (in0 >= 0 && in1 >= 0 && in2 >= 0)
-        {
-            n0 = &m_mesh->ns[in0];
-            n1 = &m_mesh->ns[in1];
-            n2 = &m_mesh->ns[in2];
-        }
+        n0 = &n[0];
+        n1 = &n[1];
+        n2 = &n[2];
     }
+    Vec2f        uv[3];
     const Vec2f *t0 = nullptr, *t1 = nullptr, *t2 = nullptr;
-    if (m_mesh->Ft.size() > m_face_idx)
+    if (ft && ft->x >= 0 && ft->y >= 0 && ft->z >= 0)
     {
-        auto it0 = m_mesh->Ft[m_face_idx].x, it1 = m_mesh->Ft[m_face_idx].y, it2 = m_mesh->Ft[m_face_idx].z;
-        if (it0 >= 0 && it1 >= 0 && it2 >= 0)
-        {
-            t0 = &m_mesh->uvs[it0];
-            t1 = &m_mesh->uvs[it1];
-            t2 = &m_mesh->uvs[it2];
-        }
+        for (int k = 0; k < 3; ++k)
+            uv[k] = texcoord((*ft)[k]);
+        t0 = &uv[0];
+        t1 = &uv[1];
+        t2 = &uv[2];
     }
 
-    return single_triangle_intersect(ray, p0, p1, p2, n0, n1, n2, t0, t1, t2, hit,
-                                     m_mesh->materials[m_mesh->Fm[m_face_idx]].get(), this, m_mesh.get());
+    single_triangle_hit_info(ray, vs[Fv[f].x], vs[Fv[f].y], vs[Fv[f].z], n0, n1, n2, t0, t1, t2, t, u, v, hit,
+                             materials[Fm[f]].get());
 }
 
 // Ray-Triangle intersection
@@ -101,115 +146,99 @@ bool Triangle::intersect(const Ray3f &ray, HitInfo &hit) const
 bool single_triangle_intersect(const Ray3f &ray, const Vec3f &p0, const Vec3f &p1, const Vec3f &p2, const Vec3f *n0,
                                const Vec3f *n1, const Vec3f *n2, const Vec2f *t0, const Vec2f *t1, const Vec2f *t2,
                                HitInfo &hit, const Material *material, const Surface *surface, const Mesh *mesh)
+{
+    float t, u, v;
+    if (!single_triangle_hit(ray, p0, p1, p2, t, u, v))
+        return false;
+
+    single_triangle_hit_info(ray, p0, p1, p2, n0, n1, n2, t0, t1, t2, t, u, v, hit, material);
+    return true;
+}
+
+// Moller-Trumbore ray-triangle intersection. Only the hit distance and the barycentric coordinates are computed here;
+// everything else is left to single_triangle_hit_info, which only needs to run for the closest hit.
+bool single_triangle_hit(const Ray3f &ray, const Vec3f &p0, const Vec3f &p1, const Vec3f &p2, float &t, float &u,
+                         float &v)
 {
     ++g_num_total_intersection_tests;
-    // TODO: Implement ray-triangle intersection
-    // TODO: If the ray misses the triangle, you should return false
-    //       You can pick any ray triangle intersection routine you like.
-    //       I recommend you follow "Approach 3" from lecture, which is the
-    //       Moller-Trumbore algorithm
     const float EPSILON = 0.0000001;
 
     Vec3f edge1 = p1 - p0;
     Vec3f edge2 = p2 - p0;
-    Vec3f pvec = la::cross(ray.d, edge2);
-    float det = dot(edge1, pvec);
+    Vec3f pvec  = la::cross(ray.d, edge2);
+    float det   = dot(edge1, pvec);
     if (det > -EPSILON && det < EPSILON)
         return false;
     float inv_det = 1.f / det;
 
     Vec3f tvec = ray.o - p0;
-    float mt_u = dot(tvec, pvec) * inv_det;
-    if (mt_u < 0.f || mt_u > 1.f)
+    u          = dot(tvec, pvec) * inv_det;
+    if (u < 0.f || u > 1.f)
         return false;
 
     Vec3f qvec = la::cross(tvec, edge1);
-
-    float mt_v = dot(ray.d, qvec) * inv_det;
-    if (mt_v < 0.f || (mt_u + mt_v) > 1.f)
+    v          = dot(ray.d, qvec) * inv_det;
+    if (v < 0.f || (u + v) > 1.f)
         return false;
 
-    // First, check for intersection and fill in the hit distance t
-    float t = dot(edge2, qvec) * inv_det;
-    if (t < ray.mint || t > ray.maxt)
-        return false;
+    t = dot(edge2, qvec) * inv_det;
+    return t >= ray.mint && t <= ray.maxt;
+}
 
-    // You should also compute the u/v (i.e. the alpha/beta barycentric coordinates) of the hit point
-    // (Moller-Trumbore gives you this for free)
+bool single_triangle_occluded(const Ray3f &ray, const Vec3f &p0, const Vec3f &p1, const Vec3f &p2)
+{
+    float t, u, v;
+    return single_triangle_hit(ray, p0, p1, p2, t, u, v);
+}
+
+void single_triangle_hit_info(const Ray3f &ray, const Vec3f &p0, const Vec3f &p1, const Vec3f &p2, const Vec3f *n0,
+                              const Vec3f *n1, const Vec3f *n2, const Vec2f *t0, const Vec2f *t1, const Vec2f *t2,
+                              float t, float bary_u, float bary_v, HitInfo &hit, const Material *material)
+{
+    float bary_w = 1.f - bary_u - bary_v;
+
+    // interpolate the texture coordinates if we have them, otherwise use the barycentric coordinates
     float u, v;
     if (t0 != nullptr && t1 != nullptr && t2 != nullptr)
     {
-        Vec2f tex0 = *t0;
-        Vec2f tex1 = *t1;
-        Vec2f tex2 = *t2;
-        Vec2f tex = (1 - mt_u - mt_v) * tex0 + mt_u * tex1 + mt_v * tex2;
-        u = tex.x;
-        v = tex.y;
+        Vec2f tex = bary_w * *t0 + bary_u * *t1 + bary_v * *t2;
+        u         = tex.x;
+        v         = tex.y;
     }
     else
     {
-        u = mt_u;
-        v = mt_v;
+        u = bary_u;
+        v = bary_v;
     }
 
-    // TODO: If you successfully hit the triangle, you should check if the distance t lies
-    //       within the ray's mint/maxt, and return false if it does not
-
-    // TODO: Fill in the gn with the geometric normal of the triangle (i.e. normalized cross product of
-    // two edges)
-    Vec3f gn = normalize(la::cross(edge1, edge2));
+    // the geometric normal is the normalized cross product of two edges
+    Vec3f gn = normalize(la::cross(p1 - p0, p2 - p0));
 
     // Compute the shading normal
     Vec3f sn;
     if (n0 != nullptr && n1 != nullptr && n2 != nullptr)
-    { // Do we have per-vertex normals available?
-        // We do -> dereference the pointers
-        Vec3f normal0 = *n0;
-        Vec3f normal1 = *n1;
-        Vec3f normal2 = *n2;
-
-        // TODO: You should compute the shading normal by
-        //       doing barycentric interpolation of the per-vertex normals (normal0/1/2)
-        //       Make sure to normalize the result
-        sn = normalize((1 - mt_u - mt_v) * normal0 + mt_u * normal1 + mt_v * normal2);
-    }
+        // We have per-vertex normals -> interpolate them barycentrically
+        sn = normalize(bary_w * *n0 + bary_u * *n1 + bary_v * *n2);
     else
-    {
         // We don't have per-vertex normals - just use the geometric normal
         sn = gn;
-    }
 
-    // Because we've hit the triangle, fill in the intersection data
     hit.t   = t;
     hit.p   = ray(t);
     hit.gn  = gn;
     hit.sn  = sn;
     hit.uv  = Vec2f(u, 1.f - v);
     hit.mat = material;
-    ++num_tri_hits;
-    return true;
 }
 
 Box3f Triangle::bounds() const
 {
-    // all mesh vertices have already been transformed to world space,
-    // so just bound the triangle vertices
-    Box3f result;
-    result.enclose(vertex(0));
-    result.enclose(vertex(1));
-    result.enclose(vertex(2));
-
-    // if the triangle lies in an axis-aligned plane, expand the box a bit
-    auto diag = result.diagonal();
-    for (int i = 0; i < 3; ++i)
-    {
-        if (diag[i] < 1e-4f)
-        {
-            result.min[i] -= 5e-5f;
-            result.max[i] += 5e-5f;
-        }
-    }
-    return result;
+    return m_mesh->face_bounds(m_face_idx);
+}
+
+void Triangle::split_bounds(const Box3f &bbox, int axis, float pos, Box3f &left, Box3f &right) const
+{
+    split_triangle_bounds(vertex(0), vertex(1), vertex(2), bbox, axis, pos, left, right);
 }
 
 Color3f Triangle::sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const
@@ -223,6 +252,11 @@ Color3f Triangle::sample(EmitterRecord &rec, const Vec2f &rv, float rv1) const
     rec.hit.t = std::sqrt(dist2);
     rec.hit.mat = m_mesh->materials[m_mesh->Fm[m_face_idx]].get();
     rec.hit.gn = rec.hit.sn = normalize(cross(p1 - p0, p2 - p0));
+
+    // emission depends on the side the shading normals face, which need not agree with the winding
+    Vec3f n[3];
+    if (m_mesh->face_normals(m_face_idx, n) && dot(n[0] + n[1] + n[2], rec.hit.gn) < 0.f)
+        rec.hit.sn = -rec.hit.gn;
     rec.wi /= rec.hit.t; // normalize rec.wi
 
     rec.emitter = this;
@@ -253,6 +287,30 @@ float Triangle::pdf(const Vec3f &o, const Vec3f &v) const
     }
 }
 
+float Triangle::emitted_power() const
+{
+    auto &material = m_mesh->materials[m_mesh->Fm[m_face_idx]];
+    float area     = length(cross(vertex(1) - vertex(0), vertex(2) - vertex(0))) / 2.f;
+    return material ? luminance(material->average_emitted()) * area : 0.f;
+}
+
+DirectionCone Triangle::normal_cone() const
+{
+    Vec3f gn = normalize(cross(vertex(1) - vertex(0), vertex(2) - vertex(0)));
+    Vec3f n[3];
+    if (!m_mesh->face_normals(m_face_idx, n))
+        return {gn, 1.f};
+
+    // emitters decide which side emits from the interpolated shading normal, which stays within the cone around the
+    // vertex normals as long as that cone is at most a hemisphere; otherwise fall back to all directions
+    Vec3f axis = n[0] + n[1] + n[2];
+    if (length2(axis) == 0.f)
+        return {gn, -1.f};
+    axis            = normalize(axis);
+    float cos_theta = std::min({dot(axis, normalize(n[0])), dot(axis, normalize(n[1])), dot(axis, normalize(n[2]))});
+    return cos_theta >= 0.f ? DirectionCone{axis, cos_theta} : DirectionCone{gn, -1.f};
+}
+
 DARTS_REGISTER_CLASS_IN_FACTORY(Surface, Triangle, "triangle")
 
 /**
@@ -0,0 +1,267 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/stats.h>
+#include <darts/surface.h>
+#include <darts/triangle_block.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+WatertightRay::WatertightRay(const Ray3f &ray) : o(ray.o), mint(ray.mint)
+{
+    // permute the axes so that the largest component of the direction becomes z
+    Vec3f ad = abs(ray.d);
+    kz       = ad.x > ad.y ? (ad.x > ad.z ? 0 : 2) : (ad.y > ad.z ? 1 : 2);
+    kx       = (kz + 1) % 3;
+    ky       = (kx + 1) % 3;
+
+    // shear the x and y axes so that the permuted direction becomes (0, 0, 1)
+    sx = -ray.d[kx] / ray.d[kz];
+    sy = -ray.d[ky] / ray.d[kz];
+    sz = 1.f / ray.d[kz];
+}
+
+namespace
+{
+    /// Recompute edge functions that evaluated to exactly zero in double precision, so that rays passing exactly
+    /// through an edge or vertex are assigned consistently to the triangles sharing it
+    inline void refine_edge_functions(float ax, float ay, float bx, float by, float cx, float cy, float &e0,
+                                      float &e1, float &e2)
+    {
+        e0 = float(double(bx) * double(cy) - double(by) * double(cx));
+        e1 = float(double(cx) * double(ay) - double(cy) * double(ax));
+        e2 = float(double(ax) * double(by) - double(ay) * double(bx));
+    }
+
+    /// The watertight test for a single lane of a block
+    template <int W>
+    bool intersect_lane(const TriangleBlock<W> &b, int lane, const WatertightRay &r, float maxt, float &t, float &u,
+                        float &v)
+    {
+        // translate the vertices to the ray origin and permute the axes
+        float ax = b.p[0][r.kx][lane] - r.o[r.kx], ay = b.p[0][r.ky][lane] - r.o[r.ky],
+              az = b.p[0][r.kz][lane] - r.o[r.kz];
+        float bx = b.p[1][r.kx][lane] - r.o[r.kx], by = b.p[1][r.ky][lane] - r.o[r.ky],
+              bz = b.p[1][r.kz][lane] - r.o[r.kz];
+        float cx = b.p[2][r.kx][lane] - r.o[r.kx], cy = b.p[2][r.ky][lane] - r.o[r.ky],
+              cz = b.p[2][r.kz][lane] - r.o[r.kz];
+
+        // shear so that the ray points along +z
+        ax += r.sx * az;
+        ay += r.sy * az;
+        bx += r.sx * bz;
+        by += r.sy * bz;
+        cx += r.sx * cz;
+        cy += r.sy * cz;
+
+        float e0 = bx * cy - by * cx;
+        float e1 = cx * ay - cy * ax;
+        float e2 = ax * by - ay * bx;
+        if (e0 == 0.f || e1 == 0.f || e2 == 0.f)
+            refine_edge_functions(ax, ay, bx, by, cx, cy, e0, e1, e2);
+
+        // the origin must be on the same side of all three edges
+        if ((e0 < 0.f || e1 < 0.f || e2 < 0.f) && (e0 > 0.f || e1 > 0.f || e2 > 0.f))
+            return false;
+        float det = e0 + e1 + e2;
+        if (det == 0.f)
+            return false;
+
+        float inv_det = 1.f / det;
+        float tt      = (e0 * az + e1 * bz + e2 * cz) * r.sz * inv_det;
+        if (!(tt >= r.mint && tt <= maxt))
+            return false;
+
+        t = tt;
+        u = e1 * inv_det;
+        v = e2 * inv_det;
+        return true;
+    }
+
+    /// Portable version of the block test, one lane at a time
+    template <int W>
+    int intersect_block_scalar(const TriangleBlock<W> &b, const WatertightRay &r, float maxt, float &t, float &u,
+                               float &v)
+    {
+        int closest = -1;
+        for (uint32_t lane = 0; lane < b.num_triangles; ++lane)
+            if (intersect_lane(b, lane, r, maxt, t, u, v))
+            {
+                closest = int(lane);
+                maxt    = t;
+            }
+        return closest;
+    }
+
+#if defined(__SSE2__) || defined(_M_X64)
+    /// The SSE operations used by #intersect_block_simd
+    struct SSEOps
+    {
+        using V = __m128;
+        static V   load(const float *p) { return _mm_load_ps(p); }
+        static V   set1(float f) { return _mm_set1_ps(f); }
+        static V   zero() { return _mm_setzero_ps(); }
+        static V   add(V a, V b) { return _mm_add_ps(a, b); }
+        static V   sub(V a, V b) { return _mm_sub_ps(a, b); }
+        static V   mul(V a, V b) { return _mm_mul_ps(a, b); }
+        static V   div(V a, V b) { return _mm_div_ps(a, b); }
+        static V   lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+        static V   gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+        static V   le(V a, V b) { return _mm_cmple_ps(a, b); }
+        static V   ge(V a, V b) { return _mm_cmpge_ps(a, b); }
+        static V   eq(V a, V b) { return _mm_cmpeq_ps(a, b); }
+        static V   neq(V a, V b) { return _mm_cmpneq_ps(a, b); }
+        static V   bit_and(V a, V b) { return _mm_and_ps(a, b); }
+        static V   bit_or(V a, V b) { return _mm_or_ps(a, b); }
+        static V   and_not(V a, V b) { return _mm_andnot_ps(a, b); }
+        static int movemask(V a) { return _mm_movemask_ps(a); }
+        static void store(float *p, V a) { _mm_store_ps(p, a); }
+    };
+#endif
+
+#if defined(__AVX__)
+    /// The AVX operations used by #intersect_block_simd
+    struct AVXOps
+    {
+        using V = __m256;
+        static V   load(const float *p) { return _mm256_load_ps(p); }
+        static V   set1(float f) { return _mm256_set1_ps(f); }
+        static V   zero() { return _mm256_setzero_ps(); }
+        static V   add(V a, V b) { return _mm256_add_ps(a, b); }
+        static V   sub(V a, V b) { return _mm256_sub_ps(a, b); }
+        static V   mul(V a, V b) { return _mm256_mul_ps(a, b); }
+        static V   div(V a, V b) { return _mm256_div_ps(a, b); }
+        static V   lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static V   gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static V   le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        static V   ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        static V   eq(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+        static V   neq(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+        static V   bit_and(V a, V b) { return _mm256_and_ps(a, b); }
+        static V   bit_or(V a, V b) { return _mm256_or_ps(a, b); }
+        static V   and_not(V a, V b) { return _mm256_andnot_ps(a, b); }
+        static int movemask(V a) { return _mm256_movemask_ps(a); }
+        static void store(float *p, V a) { _mm256_store_ps(p, a); }
+    };
+#endif
+
+    /// The block test with all lanes evaluated in parallel, following #intersect_lane step by step
+    template <int W, typename Ops>
+    int intersect_block_simd(const TriangleBlock<W> &b, const WatertightRay &r, float maxt, float &t, float &u,
+                             float &v)
+    {
+        using V = typename Ops::V;
+
+        const int kx = r.kx, ky = r.ky, kz = r.kz;
+        V         ox = Ops::set1(r.o[kx]), oy = Ops::set1(r.o[ky]), oz = Ops::set1(r.o[kz]);
+
+        V ax = Ops::sub(Ops::load(b.p[0][kx]), ox), ay = Ops::sub(Ops::load(b.p[0][ky]), oy),
+          az = Ops::sub(Ops::load(b.p[0][kz]), oz);
+        V bx = Ops::sub(Ops::load(b.p[1][kx]), ox), by = Ops::sub(Ops::load(b.p[1][ky]), oy),
+          bz = Ops::sub(Ops::load(b.p[1][kz]), oz);
+        V cx = Ops::sub(Ops::load(b.p[2][kx]), ox), cy = Ops::sub(Ops::load(b.p[2][ky]), oy),
+          cz = Ops::sub(Ops::load(b.p[2][kz]), oz);
+
+        V sx = Ops::set1(r.sx), sy = Ops::set1(r.sy);
+        ax   = Ops::add(ax, Ops::mul(sx, az));
+        ay   = Ops::add(ay, Ops::mul(sy, az));
+        bx   = Ops::add(bx, Ops::mul(sx, bz));
+        by   = Ops::add(by, Ops::mul(sy, bz));
+        cx   = Ops::add(cx, Ops::mul(sx, cz));
+        cy   = Ops::add(cy, Ops::mul(sy, cz));
+
+        V e0 = Ops::sub(Ops::mul(bx, cy), Ops::mul(by, cx));
+        V e1 = Ops::sub(Ops::mul(cx, ay), Ops::mul(cy, ax));
+        V e2 = Ops::sub(Ops::mul(ax, by), Ops::mul(ay, bx));
+
+        const int valid = (1 << b.num_triangles) - 1;
+        V         zero  = Ops::zero();
+
+        // rarely, an edge function is exactly zero; redo those lanes in double precision
+        int zero_lanes =
+            Ops::movemask(Ops::bit_or(Ops::bit_or(Ops::eq(e0, zero), Ops::eq(e1, zero)), Ops::eq(e2, zero))) & valid;
+        if (zero_lanes)
+        {
+            alignas(32) float fax[W], fay[W], fbx[W], fby[W], fcx[W], fcy[W], fe0[W], fe1[W], fe2[W];
+            Ops::store(fax, ax);
+            Ops::store(fay, ay);
+            Ops::store(fbx, bx);
+            Ops::store(fby, by);
+            Ops::store(fcx, cx);
+            Ops::store(fcy, cy);
+            Ops::store(fe0, e0);
+            Ops::store(fe1, e1);
+            Ops::store(fe2, e2);
+            for (int i = 0; i < W; ++i)
+                if (zero_lanes & (1 << i))
+                    refine_edge_functions(fax[i], fay[i], fbx[i], fby[i], fcx[i], fcy[i], fe0[i], fe1[i], fe2[i]);
+            e0 = Ops::load(fe0);
+            e1 = Ops::load(fe1);
+            e2 = Ops::load(fe2);
+        }
+
+        V any_neg = Ops::bit_or(Ops::bit_or(Ops::lt(e0, zero), Ops::lt(e1, zero)), Ops::lt(e2, zero));
+        V any_pos = Ops::bit_or(Ops::bit_or(Ops::gt(e0, zero), Ops::gt(e1, zero)), Ops::gt(e2, zero));
+        V det     = Ops::add(Ops::add(e0, e1), e2);
+
+        V sz = Ops::set1(r.sz);
+        V ts = Ops::add(Ops::add(Ops::mul(e0, Ops::mul(az, sz)), Ops::mul(e1, Ops::mul(bz, sz))),
+                        Ops::mul(e2, Ops::mul(cz, sz)));
+        V tt = Ops::div(ts, det);
+
+        V in_range = Ops::bit_and(Ops::ge(tt, Ops::set1(r.mint)), Ops::le(tt, Ops::set1(maxt)));
+        V hit      = Ops::and_not(Ops::bit_and(any_neg, any_pos), Ops::bit_and(Ops::neq(det, zero), in_range));
+
+        int mask = Ops::movemask(hit) & valid;
+        if (!mask)
+            return -1;
+
+        alignas(32) float ft[W];
+        Ops::store(ft, tt);
+        int closest = -1;
+        for (int i = 0; i < W; ++i)
+            if ((mask & (1 << i)) && (closest < 0 || ft[i] < ft[closest]))
+                closest = i;
+
+        alignas(32) float fe1[W], fe2[W], fdet[W];
+        Ops::store(fe1, e1);
+        Ops::store(fe2, e2);
+        Ops::store(fdet, det);
+        t = ft[closest];
+        u = fe1[closest] / fdet[closest];
+        v = fe2[closest] / fdet[closest];
+        return closest;
+    }
+} // namespace
+
+template <int W>
+int intersect_triangle_block(const TriangleBlock<W> &block, const WatertightRay &ray, float maxt, float &t, float &u,
+                             float &v)
+{
+    g_num_total_intersection_tests += block.num_triangles;
+
+#if defined(__AVX__)
+    if constexpr (W == 8)
+        return intersect_block_simd<8, AVXOps>(block, ray, maxt, t, u, v);
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    if constexpr (W == 4)
+        return intersect_block_simd<4, SSEOps>(block, ray, maxt, t, u, v);
+#endif
+    return intersect_block_scalar(block, ray, maxt, t, u, v);
+}
+
+template int intersect_triangle_block<4>(const TriangleBlock<4> &, const WatertightRay &, float, float &, float &,
+                                         float &);
+template int intersect_triangle_block<8>(const TriangleBlock<8> &, const WatertightRay &, float, float &, float &,
+                                         float &);
+
+/**
+    \file
+    \brief Watertight ray-triangle intersection for blocks of 4 or 8 triangles
+*/
@@ -0,0 +1,94 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/parallel.h>
+#include <darts/surface_group.h>
+#include <darts/test.h>
+
+/**
+    Benchmarks the build time of an acceleration structure over a range of thread counts.
+
+    The surfaces are loaded once, and the accelerator is then rebuilt \c repeats times for each thread count from 1 to
+    \c max_threads. The fastest build for each thread count is reported along with its speedup over a single thread.
+    After each build, the same random rays are traced through the accelerator, and the test fails if any of their
+    closest hits differ from those of the single-threaded build.
+*/
+struct BBHBuildTest : public Test
+{
+    BBHBuildTest(const json &j);
+
+    virtual void run() override;
+    virtual void print_header() const override;
+
+    string                   name;
+    shared_ptr<SurfaceGroup> group;
+    uint32_t                 max_threads;
+    int                      repeats  = 3;
+    uint32_t                 num_rays = 1u << 16;
+};
+
+BBHBuildTest::BBHBuildTest(const json &j)
+{
+    name        = j.value("name", "BBH build");
+    max_threads = j.value("max_threads", pool_size());
+    repeats     = j.value("repeats", repeats);
+    num_rays    = j.value("rays", num_rays);
+
+    group = DartsFactory<SurfaceGroup>::create(j.value("accelerator", json{{"type", "bbh"}}));
+
+    if (!j.contains("surfaces"))
+        throw DartsException("Invalid BBH build test. No 'surfaces' field found.");
+
+    for (auto &s : j["surfaces"])
+    {
+        auto surface = DartsFactory<Surface>::create(s);
+        surface->add_to_parent(group.get(), surface, s);
+        surface->build();
+    }
+}
+
+void BBHBuildTest::print_header() const
+{
+    fmt::print("---------------------------------------------------------------------------\n");
+    fmt::print("Benchmarking acceleration structure build for \"{}\"\n", name);
+}
+
+void BBHBuildTest::run()
+{
+    uint32_t original_threads = pool_size();
+
+    group->build();
+    vector<Ray3f> rays = random_rays_towards(group->bounds(), num_rays);
+
+    vector<float> reference_t;
+    double        single_thread_ms = 0.0;
+    for (uint32_t threads = 1; threads <= max_threads; ++threads)
+    {
+        pool_set_size(nullptr, threads);
+
+        double best_ms = best_time_ms(repeats, [&] { group->build(); });
+
+        vector<float> hit_t = trace_rays(*group, rays);
+        if (threads == 1)
+        {
+            single_thread_ms = best_ms;
+            reference_t      = hit_t;
+        }
+        check_hits(hit_t, reference_t, fmt::format("The BBH built with {} threads", threads));
+
+        fmt::print("{:3d} threads: {:10.2f} ms, speedup {:5.2f}x\n", threads, best_ms, single_thread_ms / best_ms);
+    }
+
+    pool_set_size(nullptr, original_threads);
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Test, BBHBuildTest, "bbh_build")
+
+/**
+    \file
+    \brief Class #BBHBuildTest
+*/
@@ -0,0 +1,90 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/mesh.h>
+#include <darts/test.h>
+
+/**
+    Compares the full-precision and the quantized BBH layouts of a #Mesh.
+
+    The mesh's BBH is built once with each layout, and the same random rays, starting inside the mesh's bounds in random
+    directions, are traced through both. The test reports the memory of the nodes and the trace time of each layout, and
+    fails if any ray's closest hit differs, since quantized boxes are conservative.
+*/
+struct BBHQuantizeTest : public Test
+{
+    BBHQuantizeTest(const json &j);
+
+    virtual void run() override;
+    virtual void print_header() const override;
+
+    string           name;
+    shared_ptr<Mesh> mesh;
+    uint32_t         num_rays = 1u << 20;
+};
+
+BBHQuantizeTest::BBHQuantizeTest(const json &j)
+{
+    name     = j.value("name", "BBH quantization");
+    num_rays = j.value("rays", num_rays);
+
+    if (!j.contains("surface"))
+        throw DartsException("Invalid BBH quantize test. No 'surface' field found.");
+
+    mesh = std::dynamic_pointer_cast<Mesh>(DartsFactory<Surface>::create(j["surface"]));
+    if (!mesh || mesh->empty())
+        throw DartsException("Invalid BBH quantize test. The 'surface' should be a non-empty mesh.");
+}
+
+void BBHQuantizeTest::print_header() const
+{
+    fmt::print("---------------------------------------------------------------------------\n");
+    fmt::print("Comparing full-precision and quantized BBH nodes for \"{}\"\n", name);
+}
+
+void BBHQuantizeTest::run()
+{
+    vector<Ray3f> rays = random_rays_within(mesh->bounds(), num_rays);
+
+    mesh->use_bbh = true;
+    // always build from scratch, and never cache BBHs whose settings differ from the ones the cache key was made with
+    mesh->cached_bbh = false;
+    mesh->cache_file.clear();
+
+    vector<float> reference_t;
+    size_t        reference_bytes = 0;
+    for (bool quantize : {false, true})
+    {
+        mesh->quantize = quantize;
+        mesh->build();
+
+        size_t bytes = mesh->bbh_nodes.size() * sizeof(LinearBBHNode) +
+                       mesh->quantized_bbh.nodes.size() * sizeof(QuantizedBBHNode);
+
+        vector<float> hit_t;
+        double        ms = best_time_ms(1, [&] { hit_t = trace_rays(*mesh, rays); });
+
+        if (reference_t.empty())
+        {
+            reference_t     = hit_t;
+            reference_bytes = bytes;
+        }
+
+        // quantized boxes are conservative, so they must find exactly the same hits
+        check_hits(hit_t, reference_t, "The quantized BBH");
+
+        fmt::print("{:>10}: nodes take {:8.2f} MB ({:5.2f}x smaller), traced in {:9.2f} ms\n",
+                   quantize ? "quantized" : "full", bytes / (1024.0 * 1024.0), double(reference_bytes) / bytes, ms);
+    }
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Test, BBHQuantizeTest, "bbh_quantize")
+
+/**
+    \file
+    \brief Class #BBHQuantizeTest
+*/
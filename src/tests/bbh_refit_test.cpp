@@ -0,0 +1,126 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/mesh.h>
+#include <darts/spherical.h>
+#include <darts/surface_group.h>
+#include <darts/test.h>
+
+/**
+    Compares refitting an acceleration structure with rebuilding it over the frames of a turntable animation.
+
+    The surfaces are added to two accelerators. For each of \c frames frames, all surfaces are rotated by
+    \c degrees_per_frame about the vertical axis through the center of their bounds: transformed surfaces (such as
+    instances) by changing their transform, and meshes by moving their vertices. One accelerator is then refit and the
+    other is rebuilt from scratch. The test reports the time of each update and of tracing the same random rays
+    through each accelerator. The test fails if any ray's closest hit differs between them.
+*/
+struct BBHRefitTest : public Test
+{
+    BBHRefitTest(const json &j);
+
+    virtual void run() override;
+    virtual void print_header() const override;
+
+    string                      name;
+    shared_ptr<SurfaceGroup>    refit_group;
+    shared_ptr<SurfaceGroup>    rebuild_group;
+    vector<shared_ptr<Surface>> surfaces;
+    int                         frames            = 36;
+    float                       degrees_per_frame = 10.f;
+    uint32_t                    num_rays          = 1u << 18;
+};
+
+BBHRefitTest::BBHRefitTest(const json &j)
+{
+    name              = j.value("name", "BBH refit");
+    frames            = j.value("frames", frames);
+    degrees_per_frame = j.value("degrees_per_frame", degrees_per_frame);
+    num_rays          = j.value("rays", num_rays);
+
+    json accelerator = j.value("accelerator", json{{"type", "bbh"}});
+    refit_group      = DartsFactory<SurfaceGroup>::create(accelerator);
+    rebuild_group    = DartsFactory<SurfaceGroup>::create(accelerator);
+
+    if (!j.contains("surfaces"))
+        throw DartsException("Invalid BBH refit test. No 'surfaces' field found.");
+
+    for (auto &s : j["surfaces"])
+    {
+        auto surface = DartsFactory<Surface>::create(s);
+        surface->add_to_parent(refit_group.get(), surface, s);
+        surface->add_to_parent(rebuild_group.get(), surface, s);
+        surface->build();
+        surfaces.push_back(surface);
+    }
+
+    refit_group->build();
+    rebuild_group->build();
+}
+
+void BBHRefitTest::print_header() const
+{
+    fmt::print("---------------------------------------------------------------------------\n");
+    fmt::print("Benchmarking BBH refitting against rebuilding for \"{}\"\n", name);
+}
+
+void BBHRefitTest::run()
+{
+    // remember the initial placement, so every frame is a rotation of it instead of accumulating rounding errors
+    Vec3f                            center = refit_group->bounds().center();
+    vector<Transform>                xforms(surfaces.size());
+    map<const Mesh *, vector<Vec3f>> vertices;
+    for (size_t i = 0; i < surfaces.size(); ++i)
+    {
+        if (auto x = std::dynamic_pointer_cast<XformedSurface>(surfaces[i]))
+            xforms[i] = x->transform();
+        else if (auto mesh = std::dynamic_pointer_cast<Mesh>(surfaces[i]))
+            vertices[mesh.get()] = mesh->vs;
+    }
+
+    for (int frame = 1; frame <= frames; ++frame)
+    {
+        Transform turn = Transform(translation_matrix(center)) *
+                         Transform(rotation_matrix(rotation_quat(Vec3f(0.f, 1.f, 0.f),
+                                                                 Spherical::deg2rad(frame * degrees_per_frame)))) *
+                         Transform(translation_matrix(-center));
+        for (size_t i = 0; i < surfaces.size(); ++i)
+        {
+            if (auto x = std::dynamic_pointer_cast<XformedSurface>(surfaces[i]))
+                x->set_transform(turn * xforms[i]);
+            else if (auto mesh = std::dynamic_pointer_cast<Mesh>(surfaces[i]))
+            {
+                auto &original = vertices[mesh.get()];
+                for (size_t v = 0; v < original.size(); ++v)
+                    mesh->vs[v] = turn.point(original[v]);
+            }
+        }
+
+        double refit_ms = best_time_ms(1, [&] { refit_group->refit(); });
+
+        // meshes were already refit along with the first accelerator, so only rebuild the top level
+        double rebuild_ms = best_time_ms(1, [&] { rebuild_group->build(); });
+
+        // aim rays from a sphere enclosing the surfaces at random points within their current bounds
+        vector<Ray3f> rays = random_rays_towards(refit_group->bounds(), num_rays);
+
+        vector<float> refit_t, rebuild_t;
+        double        refit_trace_ms   = best_time_ms(1, [&] { refit_t = trace_rays(*refit_group, rays); });
+        double        rebuild_trace_ms = best_time_ms(1, [&] { rebuild_t = trace_rays(*rebuild_group, rays); });
+        check_hits(refit_t, rebuild_t, fmt::format("Frame {}: the refit BBH", frame));
+
+        fmt::print("frame {:3}: refit {:8.2f} ms, traced in {:8.2f} ms | rebuild {:8.2f} ms, traced in {:8.2f} ms\n",
+                   frame, refit_ms, refit_trace_ms, rebuild_ms, rebuild_trace_ms);
+    }
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Test, BBHRefitTest, "bbh_refit")
+
+/**
+    \file
+    \brief Class #BBHRefitTest
+*/
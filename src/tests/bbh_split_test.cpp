@@ -0,0 +1,140 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/mesh.h>
+#include <darts/test.h>
+#include <darts/triangle.h>
+
+/**
+    Compares the BBHs that different split methods build over a #Mesh.
+
+    The mesh is loaded once and its BBH is rebuilt for each entry of \c split_methods, keeping the other fields of the
+    surface's "bbh" settings. The same random rays, starting inside the mesh's bounds in random directions like the
+    rays of an interior scene, are then traced through each BBH. For each split method, the test reports the build time,
+    the memory of the BBH and its leaf triangles, the number of nodes visited per ray, and their change relative to the
+    first split method. The test fails if any ray's closest hit differs from the first split method.
+*/
+struct BBHSplitTest : public Test
+{
+    BBHSplitTest(const json &j);
+
+    virtual void run() override;
+    virtual void print_header() const override;
+
+    /// Trace \p rays through the mesh's scalar BBH, storing the closest hit distance of each ray in \p hit_t
+    void trace(const vector<Ray3f> &rays, vector<float> &hit_t, int64_t &nodes_visited) const;
+
+    string           name;
+    shared_ptr<Mesh> mesh;
+    json             bbh_json;
+    vector<string>   split_methods = {"sah", "sbvh", "lbvh"};
+    uint32_t         num_rays      = 1u << 20;
+};
+
+BBHSplitTest::BBHSplitTest(const json &j)
+{
+    name          = j.value("name", "BBH split methods");
+    split_methods = j.value("split_methods", split_methods);
+    num_rays      = j.value("rays", num_rays);
+
+    if (!j.contains("surface"))
+        throw DartsException("Invalid BBH split test. No 'surface' field found.");
+
+    mesh = std::dynamic_pointer_cast<Mesh>(DartsFactory<Surface>::create(j["surface"]));
+    if (!mesh || mesh->empty())
+        throw DartsException("Invalid BBH split test. The 'surface' should be a non-empty mesh.");
+
+    bbh_json = j["surface"].value("bbh", json::object());
+}
+
+void BBHSplitTest::print_header() const
+{
+    fmt::print("---------------------------------------------------------------------------\n");
+    fmt::print("Comparing BBH split methods for \"{}\"\n", name);
+}
+
+void BBHSplitTest::trace(const vector<Ray3f> &rays, vector<float> &hit_t, int64_t &nodes_visited) const
+{
+    for (size_t r = 0; r < rays.size(); ++r)
+    {
+        Ray3f ray = rays[r];
+        if (intersect_linear_bbh(mesh->bbh_nodes, ray, nodes_visited,
+                                 [&](uint32_t first, uint32_t count, Ray3f &leaf_ray)
+                                 {
+                                     bool hit_leaf = false;
+                                     for (uint32_t i = first; i < first + count; ++i)
+                                     {
+                                         float t, u, v;
+                                         if (single_triangle_hit(leaf_ray, mesh->leaf_vs[3 * i],
+                                                                 mesh->leaf_vs[3 * i + 1], mesh->leaf_vs[3 * i + 2],
+                                                                 t, u, v))
+                                         {
+                                             hit_leaf      = true;
+                                             leaf_ray.maxt = t;
+                                         }
+                                     }
+                                     return hit_leaf;
+                                 }))
+            hit_t[r] = ray.maxt;
+    }
+}
+
+void BBHSplitTest::run()
+{
+    vector<Ray3f> rays = random_rays_within(mesh->bounds(), num_rays);
+
+    // the scalar leaves store one reference per face in leaf_vs, so the traversal below can count visited nodes itself
+    mesh->use_bbh    = true;
+    mesh->simd_width = 0;
+    mesh->quantize   = false;
+    // always build from scratch, and never cache BBHs whose settings differ from the ones the cache key was made with
+    mesh->cached_bbh = false;
+    mesh->cache_file.clear();
+
+    vector<float> reference_t;
+    size_t        reference_bytes   = 0;
+    double        reference_visited = 0.0;
+    for (auto &method : split_methods)
+    {
+        json settings            = bbh_json;
+        settings["split_method"] = method;
+        mesh->bbh_settings       = BBHSettings(settings);
+
+        double build_ms = best_time_ms(1, [&] { mesh->build(); });
+
+        size_t bytes = mesh->bbh_nodes.size() * sizeof(LinearBBHNode) + mesh->leaf_vs.size() * sizeof(Vec3f) +
+                       mesh->leaf_faces.size() * sizeof(uint32_t);
+
+        int64_t       nodes_visited = 0;
+        vector<float> hit_t(rays.size(), std::numeric_limits<float>::infinity());
+        double        ms = best_time_ms(1, [&] { trace(rays, hit_t, nodes_visited); });
+        double        visited = double(nodes_visited) / rays.size();
+
+        if (reference_t.empty())
+        {
+            reference_t       = hit_t;
+            reference_bytes   = bytes;
+            reference_visited = visited;
+        }
+
+        // every split method stores the same triangles, so they must find exactly the same hits
+        check_hits(hit_t, reference_t, fmt::format("The BBH built with \"{}\"", method));
+
+        fmt::print("{:>8}: built in {:9.2f} ms, {:8} nodes, {:8} references, {:8.2f} MB ({:+6.1f}%), {:6.2f} nodes "
+                   "visited per ray ({:+6.1f}%), traced in {:9.2f} ms\n",
+                   method, build_ms, mesh->bbh_nodes.size(), mesh->leaf_faces.size(), bytes / (1024.0 * 1024.0),
+                   100.0 * (double(bytes) / reference_bytes - 1.0), visited,
+                   100.0 * (visited / reference_visited - 1.0), ms);
+    }
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Test, BBHSplitTest, "bbh_split")
+
+/**
+    \file
+    \brief Class #BBHSplitTest
+*/
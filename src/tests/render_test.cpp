@@ -0,0 +1,73 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/scene.h>
+#include <darts/test.h>
+
+#include <algorithm>
+
+/**
+    Renders a scene with its render settings, and checks how many samples per pixel the budgets allowed.
+
+    Fails if any pixel got fewer than "min spp" samples, or if the pixels got more than "max spp" samples on average,
+    e.g.\ to check that a progressive render neither stops too early nor ignores its budgets.
+*/
+struct RenderTest : public Test
+{
+    RenderTest(const json &j);
+
+    virtual void run() override;
+    virtual void print_header() const override;
+
+    string            name;
+    shared_ptr<Scene> scene;
+    uint32_t          min_spp = 1;
+    float             max_spp = std::numeric_limits<float>::infinity();
+};
+
+RenderTest::RenderTest(const json &j)
+{
+    name    = j.at("name");
+    scene   = make_shared<Scene>(j.at("scene"));
+    min_spp = j.value("min spp", min_spp);
+    max_spp = j.value("max spp", max_spp);
+}
+
+void RenderTest::print_header() const
+{
+    fmt::print("---------------------------------------------------------------------------\n");
+    fmt::print("Running render test for \"{}\"\n", name);
+}
+
+void RenderTest::run()
+{
+    RenderStatistics statistics;
+    scene->raytrace(scene->render_settings(), &statistics);
+
+    float  fewest = std::numeric_limits<float>::infinity();
+    double total  = 0.0;
+    for (int i = 0; i < statistics.samples.length(); ++i)
+    {
+        fewest = std::min(fewest, statistics.samples(i).x);
+        total += statistics.samples(i).x;
+    }
+    float average = float(total / statistics.samples.length());
+
+    if (fewest < min_spp)
+        throw DartsException("Some pixels only got {} samples, but each should get at least {}.", fewest, min_spp);
+    if (average > max_spp)
+        throw DartsException("The pixels got {:.1f} samples on average, but at most {} were expected.", average,
+                             max_spp);
+    spdlog::info("Rendered with at least {} and on average {:.1f} samples per pixel.", fewest, average);
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Test, RenderTest, "render")
+
+/**
+    \file
+    \brief Class #RenderTest
+*/
@@ -36,8 +36,15 @@ SurfaceSampleTest::SurfaceSampleTest(const json &j) : SampleTest(j)
         group->build();
         surface = group;
     }
+    else if (j.contains("light sampler"))
+    {
+        // an emitter group like a scene's "light sampler", e.g. a light tree, with the emitters as its children
+        auto group = DartsFactory<SurfaceGroup>::create(j["light sampler"]);
+        group->build();
+        surface = group;
+    }
     else
-        throw DartsException("Invalid sample surface file. No 'surface' or 'surfaces' field found.");
+        throw DartsException("Invalid sample surface file. No 'surface', 'surfaces' or 'light sampler' field found.");
 }
 
 bool SurfaceSampleTest::sample(Vec3f &dir, const Vec2f &rv, float rv1)
@@ -53,8 +60,9 @@ bool SurfaceSampleTest::sample(Vec3f &dir, const Vec2f &rv, float rv1)
 
 float SurfaceSampleTest::pdf(const Vec3f &dir, float rv1) const
 {
-    auto [child, prob] = surface->sample_child(rv1);
-    return child->pdf(Vec3f{0.f}, dir);
+    // groups weigh the pdf of each child by the probability of sampling it, which for emitter groups like a light tree
+    // depends on the shading point, so this checks these probabilities against the ones sample() uses
+    return surface->pdf(Vec3f{0.f}, dir);
 }
 
 DARTS_REGISTER_CLASS_IN_FACTORY(Test, SurfaceSampleTest, "sample surface")
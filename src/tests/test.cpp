@@ -8,6 +8,7 @@
 #include <darts/parallel.h>
 #include <darts/progress.h>
 #include <darts/sampling.h>
+#include <darts/surface.h>
 #include <darts/test.h>
 #include <filesystem/resolver.h>
 
@@ -45,6 +46,57 @@ void run_tests(const json &j)
     }
 }
 
+vector<Ray3f> random_rays_towards(const Box3f &bbox, uint32_t count)
+{
+    Vec3f         center = bbox.center();
+    float         radius = length(bbox.diagonal());
+    vector<Ray3f> rays(count);
+    for (auto &ray : rays)
+    {
+        Vec3f o = center + radius * normalize(random_in_unit_sphere());
+        Vec3f p = bbox.min + Vec3f(randf(), randf(), randf()) * bbox.diagonal();
+        ray     = Ray3f(o, p - o);
+    }
+    return rays;
+}
+
+vector<Ray3f> random_rays_within(const Box3f &bbox, uint32_t count)
+{
+    vector<Ray3f> rays(count);
+    for (auto &ray : rays)
+        ray = Ray3f(bbox.min + Vec3f(randf(), randf(), randf()) * bbox.diagonal(), random_in_unit_sphere());
+    return rays;
+}
+
+vector<float> trace_rays(const Surface &surface, const vector<Ray3f> &rays)
+{
+    vector<float> t(rays.size(), std::numeric_limits<float>::infinity());
+    for (size_t r = 0; r < rays.size(); ++r)
+    {
+        HitInfo hit;
+        if (surface.intersect(rays[r], hit))
+            t[r] = hit.t;
+    }
+    return t;
+}
+
+size_t check_hits(const vector<float> &t, const vector<float> &reference_t, const string &what, size_t allowed)
+{
+    size_t differing = 0, first = t.size();
+    for (size_t r = 0; r < t.size(); ++r)
+        if (std::isfinite(t[r]) != std::isfinite(reference_t[r]) ||
+            std::abs(t[r] - reference_t[r]) > 1e-4f * std::max(1.f, std::abs(reference_t[r])))
+        {
+            if (!differing++)
+                first = r;
+        }
+
+    if (differing > allowed)
+        throw DartsException("{}: {} of {} rays hit differently (at most {} allowed), e.g. ray {} at t = {} instead of "
+                             "t = {}.",
+                             what, differing, t.size(), allowed, first, t[first], reference_t[first]);
+    return differing;
+}
 
 ScatterTest::ScatterTest(const json &j)
 {
@@ -104,7 +156,7 @@ Array2d<float> ScatterTest::upsample(const Array2d<float> &img, int factor)
 void ScatterTest::run()
 {
     // Step 1: Generate histogram of samples
-    Array2d<float> histogram(image_size.x, image_size.y);
+    histogram = Array2d<float>(image_size.x, image_size.y);
 
     // populate the histogram
     bool     nan_or_inf    = false;
@@ -179,7 +231,8 @@ void ScatterTest::run()
 
 SampleTest::SampleTest(const json &j) : ScatterTest(j)
 {
-    super_samples = j.value("super samples", 32);
+    super_samples  = j.value("super samples", 32);
+    max_difference = j.value("max difference", max_difference);
 }
 
 void SampleTest::run()
@@ -234,6 +287,23 @@ void SampleTest::run()
 
     // Step 3: build the histogram
     ScatterTest::run();
+
+    // Step 4: compare the histogram against the pdf. Both are densities over the sphere, so this is the total variation
+    // distance between the sampled and the analytic distribution, which is only noise if sample() and pdf() agree
+    double difference = 0.0;
+    for (int y = 0; y < pdf.height(); ++y)
+        for (int x = 0; x < pdf.width(); ++x)
+        {
+            Vec3f dir        = pixel_to_sample(Vec2f{x + 0.5f, y + 0.5f});
+            float sin_theta  = std::sqrt(max(1.0f - dir.z * dir.z, 0.0f));
+            float pixel_area = M_PI * (M_PI * 2.0f) * sin_theta / product(image_size);
+            difference += 0.5 * pixel_area * std::abs(histogram(x, y) - pdf(x, y));
+        }
+
+    auto difference_msg = fmt::format("Total variation distance between the histogram and the PDF: {}", difference);
+    if (max_difference >= 0.f && difference > max_difference)
+        throw DartsException("{} (at most {} allowed)", difference_msg, max_difference);
+    spdlog::info(difference_msg);
 }
 
 /**
@@ -0,0 +1,96 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <darts/factory.h>
+#include <darts/mesh.h>
+#include <darts/test.h>
+
+/**
+    Benchmarks the leaf triangle kernels of an accelerated #Mesh against each other.
+
+    The mesh is loaded once and its BBH is rebuilt for each kernel in \c widths (0 is the scalar Moller-Trumbore test,
+    4 and 8 are the watertight block kernel). The same random rays, aimed from a sphere around the mesh at points within
+    its bounds, are then traced with each kernel. The fastest of \c repeats runs is reported along with its speedup over
+    the first kernel. The test fails if more than a fraction \c max_differing of the rays hit differently than with the
+    first kernel; the scalar Moller-Trumbore test is not watertight, so a few rays through shared edges may miss it.
+*/
+struct TriangleKernelTest : public Test
+{
+    TriangleKernelTest(const json &j);
+
+    virtual void run() override;
+    virtual void print_header() const override;
+
+    string           name;
+    shared_ptr<Mesh> mesh;
+    vector<int>      widths        = {0, 4, 8};
+    uint32_t         num_rays      = 1u << 20;
+    int              repeats       = 3;
+    float            max_differing = 1e-5f; ///< Fraction of the rays that may hit differently than the first kernel
+    int              scalar_leaf_size;      ///< Leaf size of the scalar kernel (the block kernels use their width)
+};
+
+TriangleKernelTest::TriangleKernelTest(const json &j)
+{
+    name          = j.value("name", "triangle kernel");
+    widths        = j.value("widths", widths);
+    num_rays      = j.value("rays", num_rays);
+    repeats       = j.value("repeats", repeats);
+    max_differing = j.value("max_differing", max_differing);
+
+    if (!j.contains("surface"))
+        throw DartsException("Invalid triangle kernel test. No 'surface' field found.");
+
+    mesh = std::dynamic_pointer_cast<Mesh>(DartsFactory<Surface>::create(j["surface"]));
+    if (!mesh || mesh->empty())
+        throw DartsException("Invalid triangle kernel test. The 'surface' should be a non-empty mesh.");
+
+    scalar_leaf_size = BBHSettings(j["surface"].value("bbh", json::object())).max_leaf_size;
+}
+
+void TriangleKernelTest::print_header() const
+{
+    fmt::print("---------------------------------------------------------------------------\n");
+    fmt::print("Benchmarking mesh triangle kernels for \"{}\"\n", name);
+}
+
+void TriangleKernelTest::run()
+{
+    vector<Ray3f> rays = random_rays_towards(mesh->bounds(), num_rays);
+
+    vector<float> reference_t;
+    double        reference_ms = 0.0;
+    for (int w : widths)
+    {
+        mesh->use_bbh                    = true;
+        mesh->simd_width                 = w;
+        mesh->bbh_settings.max_leaf_size = w > 0 ? w : scalar_leaf_size;
+        mesh->build();
+
+        vector<float> hit_t;
+        double        ms     = best_time_ms(repeats, [&] { hit_t = trace_rays(*mesh, rays); });
+        string        kernel = w > 0 ? fmt::format("{}-wide", w) : "scalar";
+
+        if (reference_t.empty())
+        {
+            reference_t  = hit_t;
+            reference_ms = ms;
+        }
+
+        size_t differing = check_hits(hit_t, reference_t, fmt::format("The {} triangle kernel", kernel),
+                                      size_t(max_differing * rays.size()));
+
+        fmt::print("{:>6}: {:10.2f} ms, {:7.2f} Mrays/s, speedup {:5.2f}x, {} rays differ\n", kernel, ms,
+                   rays.size() / (ms * 1000.0), reference_ms / ms, differing);
+    }
+}
+
+DARTS_REGISTER_CLASS_IN_FACTORY(Test, TriangleKernelTest, "triangle_kernel")
+
+/**
+    \file
+    \brief Class #TriangleKernelTest
+*/
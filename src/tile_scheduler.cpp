@@ -0,0 +1,170 @@
+/*
+    This file is part of darts – the Dartmouth Academic Ray Tracing Skeleton.
+
+    Copyright (c) 2017-2022 by Wojciech Jarosz
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <darts/parallel.h>
+#include <darts/tile_scheduler.h>
+
+namespace
+{
+    /// Convert distance \p d along a Hilbert curve that fills an \p n × \p n grid (n a power of two) to a cell
+    Vec2i hilbert_cell(uint32_t n, uint32_t d)
+    {
+        uint32_t x = 0, y = 0;
+        for (uint32_t s = 1; s < n; s *= 2, d /= 4)
+        {
+            uint32_t rx = 1 & (d / 2), ry = 1 & (d ^ rx);
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+        }
+        return Vec2i(x, y);
+    }
+} // namespace
+
+TileScheduler::TileScheduler(const Vec2i &resolution, int tile_size_, TileOrder order_, int packet_size) :
+    tile_size(std::max(tile_size_, 1)), order(order_), m_resolution(resolution)
+{
+    // make the packets at least twice as wide as tall, since rows of pixels are contiguous in memory, and let large
+    // packets cover whole rows of the tile
+    packet_size     = std::max(packet_size, 1);
+    m_packet_size.x = std::min({tile_size, packet_size, std::max(8, packet_size / 8)});
+    m_packet_size.y = std::min(tile_size, packet_size / m_packet_size.x);
+
+    Vec2i count = (resolution + tile_size - 1) / tile_size;
+    switch (order)
+    {
+    case TileOrder::Hilbert:
+    {
+        uint32_t n = 1;
+        while (n < uint32_t(std::max(count.x, count.y)))
+            n *= 2;
+        for (uint32_t d = 0; d < n * n; ++d)
+        {
+            Vec2i cell = hilbert_cell(n, d);
+            if (cell.x < count.x && cell.y < count.y)
+                m_tiles.push_back(cell * tile_size);
+        }
+        break;
+    }
+    case TileOrder::Spiral:
+    {
+        for (int y = 0; y < count.y; ++y)
+            for (int x = 0; x < count.x; ++x)
+                m_tiles.push_back(Vec2i(x, y));
+
+        // sort the tiles by the ring around the central tile they lie in, and within each ring by angle
+        Vec2f center = Vec2f(count - 1) / 2.f;
+        auto  ring   = [center](const Vec2i &t)
+        { return std::max(std::abs(t.x - center.x), std::abs(t.y - center.y)); };
+        auto angle = [center](const Vec2i &t) { return std::atan2(t.y - center.y, t.x - center.x); };
+        std::stable_sort(m_tiles.begin(), m_tiles.end(),
+                         [&](const Vec2i &a, const Vec2i &b)
+                         { return ring(a) != ring(b) ? ring(a) < ring(b) : angle(a) < angle(b); });
+        for (auto &t : m_tiles)
+            t *= tile_size;
+        break;
+    }
+    default:
+        for (int y = 0; y < count.y; ++y)
+            for (int x = 0; x < count.x; ++x)
+                m_tiles.push_back(Vec2i(x, y) * tile_size);
+    }
+}
+
+TileOrder TileScheduler::parse_order(const string &name)
+{
+    if (name == "hilbert")
+        return TileOrder::Hilbert;
+    else if (name == "spiral")
+        return TileOrder::Spiral;
+    else if (name == "scanline")
+        return TileOrder::Scanline;
+    else
+        throw DartsException("Unknown tile order '{}'. Expected \"hilbert\", \"spiral\", or \"scanline\".", name);
+}
+
+uint32_t TileScheduler::num_workers()
+{
+    return uint32_t(pool_size()) + 1;
+}
+
+Box2i TileScheduler::tile(uint32_t i) const
+{
+    return Box2i(m_tiles[i], la::min(m_tiles[i] + tile_size, m_resolution));
+}
+
+uint32_t TileScheduler::num_packets(uint32_t t) const
+{
+    Vec2i size  = tile(t).diagonal();
+    Vec2i count = (size + m_packet_size - 1) / m_packet_size;
+    return uint32_t(count.x * count.y);
+}
+
+int TileScheduler::packet(uint32_t t, uint32_t p, Vec2i *pixels) const
+{
+    Box2i bounds  = tile(t);
+    int   columns = (bounds.diagonal().x + m_packet_size.x - 1) / m_packet_size.x;
+    Vec2i start   = bounds.min + Vec2i(p % columns, p / columns) * m_packet_size;
+    Vec2i end     = la::min(start + m_packet_size, bounds.max);
+
+    int count = 0;
+    for (int y = start.y; y < end.y; ++y)
+        for (int x = start.x; x < end.x; ++x)
+            pixels[count++] = Vec2i(x, y);
+    return count;
+}
+
+void TileScheduler::run(const PacketFunction &func) const
+{
+    // every tile counts the packets that have been claimed from it, by its owner or by other workers
+    uint32_t                                n = num_tiles();
+    std::unique_ptr<std::atomic<uint32_t>[]> claimed(new std::atomic<uint32_t>[n]);
+    for (uint32_t t = 0; t < n; ++t)
+        claimed[t] = 0;
+    std::atomic<uint32_t> next_tile(0);
+
+    parallel_for(blocked_range<uint32_t>(0, num_workers(), 1),
+                 [&](blocked_range<uint32_t> range)
+                 {
+                     vector<Vec2i> pixels(packet_capacity());
+                     for (uint32_t worker = range.begin(); worker != range.end(); ++worker)
+                     {
+                         auto render_tile = [&](uint32_t t)
+                         {
+                             bool     rendered = false;
+                             uint32_t packets  = num_packets(t);
+                             for (uint32_t p; (p = claimed[t].fetch_add(1)) < packets; rendered = true)
+                                 func(worker, pixels.data(), packet(t, p, pixels.data()));
+                             return rendered;
+                         };
+
+                         // start new tiles while there are any
+                         for (uint32_t t; (t = next_tile.fetch_add(1)) < n;)
+                             render_tile(t);
+
+                         // then help with the tiles that are still running; the most recently started ones have the
+                         // most work left
+                         for (uint32_t t = n; t-- > 0;)
+                             if (claimed[t].load() < num_packets(t) && render_tile(t))
+                                 t = n;
+                     }
+                 });
+}
+
+/**
+    \file
+    \brief Class #TileScheduler
+*/